@@ -5,24 +5,179 @@
  *
  *     This class implements the definition of the methods of the SegMem module
  *     which consists of the next available id, empty id list and the memory
- *     that is represented by a 2D sequence.
+ *     itself. Each segment is a length-prefixed array of uint32_t words, and
+ *     the segment ids index a growable table of entries holding a pointer 
+ *     to the words and a copy of the length, so a lookup with its bounds 
+ *     check touches one entry.
+ *     Segment storage comes from arenas: small segments are bump-allocated 
+ *     from slabs and large ones get a mapping of their own, both backed by
+ *     huge pages once they are big enough, so freeing the memory takes one
+ *     munmap per arena. Storage of unmapped small segments goes to 
+ *     per-size-class free lists, so map/unmap churn reuses it, and a slab
+ *     is unmapped once every block carved from it is free again.
+ *     A memory restored from a snapshot keeps its segments in a private 
+ *     mapping of the snapshot file, which is paged in as they are used.
+ *     A forked memory shares the segments of its parent copy-on-write: a 
+ *     segment is copied by the first memory that stores into it.
  */
 
+/* mmap, fstat and fileno are POSIX; MAP_ANONYMOUS and madvise are not */
+#define _DEFAULT_SOURCE
+#define _POSIX_C_SOURCE 200809L
+
 #include "SegMem.h"
-#include "seq.h"
 #include <assert.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <tmmintrin.h>
+#define HAVE_SSSE3_BSWAP 1
+#endif
+
+/* initial number of slots in the segment table */
+#define INITIAL_CAPACITY 64
+
+/* bytes of a segment table and free-id stack with the given capacity */
+#define TABLE_BYTES(capacity) \
+        ((size_t)(capacity) * (sizeof(SegEntry) + sizeof(uint32_t)))
+
+/* 
+ * Size classes: class k holds segments with room for 2^k words, carved 
+ * from slabs and pooled when unmapped. Segments larger than 2^MAX_CLASS 
+ * words are allocated exactly, each in a mapping of its own.
+ */
+#define MAX_CLASS 16
+#define NUM_CLASSES (MAX_CLASS + 1)
+
+/* 
+ * Slabs double in size from FIRST_SLAB up to HUGE_PAGE, so a small program
+ * only touches a little memory. Every slab is aligned to HUGE_PAGE, so the
+ * slab of a block is found by masking its address. Slabs and large 
+ * mappings of HUGE_PAGE bytes or more are advised to use transparent huge 
+ * pages.
+ */
+#define FIRST_SLAB ((size_t)1 << 16)
+#define HUGE_PAGE ((size_t)1 << 21)
+#define PAGE_SIZE ((size_t)1 << 12)
+
+/* a slab, followed by the blocks carved from it */
+struct Slab {
+        struct Slab *prev, *next; /* the newer and the older slab */
+        size_t bytes; /* size of the slab, this header included */
+        size_t live; /* blocks carved from the slab and not pooled */
+};
+
+#define SLAB_OF(block) ((struct Slab *)                                   \
+        ((uintptr_t)(block) & ~(uintptr_t)(HUGE_PAGE - 1)))
+
+/* the mapping of a large segment, followed by its block */
+struct Mapping {
+        struct Mapping *prev, *next; /* neighbours in the owner's list */
+        size_t bytes; /* size of the mapping, this header included */
+        struct Arenas *owner; /* the arenas the mapping is listed in */
+};
+
+/* 
+ * The arenas a memory allocates from. A forked memory also keeps the 
+ * arenas of its ancestors alive, since it may hold their segments, so they
+ * are freed by the last memory releasing them.
+ */
+struct Arenas {
+        unsigned refs; /* number of memories keeping the arenas */
+        struct Slab *slabs; /* every slab, newest first */
+        struct Mapping *large; /* mappings of the large segments */
+};
 
+/* a snapshot mapped by seg_restore, shared by the memories forked from it */
+struct Image {
+        uint32_t *words; /* the mapping */
+        size_t bytes; /* size of the mapping */
+        unsigned refs; /* number of memories using the mapping */
+};
 
 struct SegMem_T {
         unsigned curr_id; /* the current id of the largest segment id */
-        Seq_T empty_id; /* a sequence of empty segment ids */
-        Seq_T memory; /* the representation of segmented memory */
+        SegTable table; /* segment table, indexed by segment id */
+        uint32_t *free_ids; /* stack of unmapped ids, the next to reuse last */
+        unsigned free_count; /* number of ids on the stack */
+        uint32_t *pool[NUM_CLASSES]; /* free lists of segment storage */
+        unsigned long allocations; /* mappings and table allocations */
+        struct Image *image; /* mapped snapshot holding segments, or NULL */
+        bool forked; /* segments may be shared with other memories */
+        struct Arenas *arenas; /* the arenas segments are allocated from */
+        struct Arenas **inherited; /* arenas of the ancestors, see seg_fork */
+        unsigned inherited_count; /* number of inherited arenas */
+        unsigned char *bump; /* next free byte of the newest slab */
+        unsigned char *bump_end; /* end of the newest slab */
+        size_t slab_bytes; /* size of the next slab */
+        size_t arena_bytes; /* size of the slabs and large mappings */
+        size_t mapped_bytes; /* storage of the mapped segments */
+        unsigned segments; /* number of mapped segments */
+        size_t pooled_bytes; /* storage kept in the pools */
+        size_t peak_bytes; /* most bytes held at once */
+        size_t limit; /* most bytes map_seg may hold, or 0 for no limit */
 };
 
+/* private helper functions */
+static uint32_t *alloc_segment(SegMem_T seg_mem, unsigned num_words);
+static uint32_t *new_segment(SegMem_T seg_mem, unsigned num_words);
+static void free_segment(SegMem_T seg_mem, uint32_t *seg);
+static unsigned size_class(unsigned num_words);
+static unsigned char *read_all(FILE *instructions, size_t *size);
+static void bswap_words(uint32_t *dst, const unsigned char *src, size_t n);
+static void ensure_capacity(SegMem_T seg_mem, unsigned segid);
+static void set_segment(SegMem_T seg_mem, unsigned segid, uint32_t *seg);
+static bool in_image(SegMem_T seg_mem, const uint32_t *block);
+static bool release(SegMem_T seg_mem, uint32_t *seg);
+static uint32_t *unshare(SegMem_T seg_mem, unsigned segid);
+static bool restore_segments(SegMem_T seg_mem, const uint32_t *words, 
+                             size_t count);
+static void count_segment(SegMem_T seg_mem, const uint32_t *seg);
+static size_t held_bytes(SegMem_T seg_mem);
+static void note_peak(SegMem_T seg_mem);
+static bool within_limit(SegMem_T seg_mem, unsigned num_words);
+static uint32_t *carve(SegMem_T seg_mem, size_t bytes);
+static void release_slab(SegMem_T seg_mem, struct Slab *slab);
+static size_t slab_size(SegMem_T seg_mem, size_t bytes);
+static uint32_t *map_large(SegMem_T seg_mem, size_t bytes);
+static size_t large_size(size_t bytes);
+static void unmap_large(SegMem_T seg_mem, uint32_t *block);
+static void *map_arena(SegMem_T seg_mem, size_t bytes, size_t align);
+static void release_arenas(struct Arenas *arenas);
+
+/* 
+ * Every segment is preceded by a three word header: the number of memories
+ * sharing the storage, the number of words the storage has room for, then 
+ * the length of the segment. A pooled block reuses the header to link to 
+ * the next free block of its class.
+ */
+#define HEADER_WORDS 3
+#define SEG_REFS(seg) ((seg)[-3])
+#define SEG_CAPACITY(seg) ((seg)[-2])
+#define SEG_LENGTH(seg) ((seg)[-1])
+
+/* the words of segment id, NULL if it is not mapped */
+#define SEGMENT(seg_mem, id) ((seg_mem)->table.entries[(id)].base)
+
+/* bytes of storage of a segment with room for capacity words */
+#define BLOCK_BYTES(capacity) \
+        (((size_t)(capacity) + HEADER_WORDS) * sizeof(uint32_t))
+
+/* 
+ * Reference counts are atomic, since forked memories may run on different 
+ * threads. Memories that never forked own all their segments and skip them.
+ */
+#define RETAIN(count) __atomic_add_fetch(&(count), 1, __ATOMIC_RELAXED)
+#define RELEASE(count) __atomic_sub_fetch(&(count), 1, __ATOMIC_ACQ_REL)
+#define SHARED(seg_mem, seg) ((seg_mem)->forked &&                        \
+        __atomic_load_n(&SEG_REFS(seg), __ATOMIC_ACQUIRE) != 1)
+
 /* initialize_seg
 *
-* Initialize the struct SegMem_T, and initialize the structure of segmented 
-* memory which is represented by sequence of sequences
+* Initialize the struct SegMem_T, and initialize the segment table of the 
+* segmented memory
 *
 * Parameters:
 *      FILE *instructions:    The input file with instructions in it
@@ -30,51 +185,132 @@ struct SegMem_T {
 * Returns: an initialized struct SegMem_T
 * Expects: None
 *
-* Notes: Allocates new memory for Seq_T (sequence of sequences); memory will 
-* be deallocated when finishing using the segmented memory by calling the 
-* seg_free() or deleting a segment by calling unmap_seg()
+* Notes: Allocates new memory for the segment table; memory will be 
+* deallocated when finishing using the segmented memory by calling seg_free()
 */
 SegMem_T initialize_segmem()
 {
         SegMem_T seg_mem = malloc(sizeof(*seg_mem));
         assert(seg_mem != NULL);
         seg_mem->curr_id = 0;
-        seg_mem->empty_id = Seq_new(0);
-        seg_mem->memory = Seq_new(0);
-        assert(seg_mem->memory != NULL);
-        assert(seg_mem->empty_id != NULL);
+        seg_mem->table.capacity = INITIAL_CAPACITY;
+        seg_mem->table.entries = calloc(seg_mem->table.capacity, 
+                                        sizeof(SegEntry));
+        assert(seg_mem->table.entries != NULL);
+        seg_mem->free_ids = malloc(seg_mem->table.capacity * sizeof(uint32_t));
+        assert(seg_mem->free_ids != NULL);
+        seg_mem->free_count = 0;
+        seg_mem->allocations = 1;
+        seg_mem->image = NULL;
+        seg_mem->forked = false;
+        seg_mem->arenas = malloc(sizeof(struct Arenas));
+        assert(seg_mem->arenas != NULL);
+        seg_mem->arenas->refs = 1;
+        seg_mem->arenas->slabs = NULL;
+        seg_mem->arenas->large = NULL;
+        seg_mem->inherited = NULL;
+        seg_mem->inherited_count = 0;
+        seg_mem->bump = NULL;
+        seg_mem->bump_end = NULL;
+        seg_mem->slab_bytes = FIRST_SLAB;
+        seg_mem->arena_bytes = 0;
+        seg_mem->mapped_bytes = 0;
+        seg_mem->segments = 0;
+        seg_mem->pooled_bytes = 0;
+        seg_mem->peak_bytes = held_bytes(seg_mem);
+        seg_mem->limit = 0;
+        for (int k = 0; k < NUM_CLASSES; k++) {
+                seg_mem->pool[k] = NULL;
+        }
         return seg_mem;
 }
 
 /* populate_seg
 *
-* Initialize $m[0] with the instructions read from file. 
+* Initialize $m[0] with the instructions read from file. Each instruction is
+* stored as 4 bytes in big-endian order.
 *
 * Parameters:
 *      FILE *instructions:    The input file with instructions in it
 *
-* Returns: None
-* Expects: None
+* Returns: true if the program was loaded, false if the file could not be
+*          read or its length is not a multiple of 4
+* Expects: The seg_mem cannot be NULL
 *
-* Notes: Allocates new memory for Seq_T (sequence of sequences); memory will 
-* be deallocated when finishing using the segmented memory by calling the 
-* seg_free() or deleting a segment by calling unmap_seg()
+* Notes: Allocates new memory for $m[0]; memory will be deallocated when 
+* finishing using the segmented memory by calling seg_free(). Regular files
+* are mapped with mmap and converted in one pass, other streams (such as 
+* pipes) are read in one go. An error message is printed to stderr when the 
+* load fails.
 */
-void populate_seg(SegMem_T seg_mem, FILE *instructions)
+bool populate_seg(SegMem_T seg_mem, FILE *instructions)
 {
         assert(seg_mem != NULL);
-        uint32_t words = 0;
-        int ch = 0;
-        Seq_T seg0 = Seq_new(0);
-        while ((ch = getc(instructions)) != EOF) {
-                words = Bitpack_newu(0, 8, 24, ch);
-                for (int i = 0; i < 3; i++) {
-                        ch = getc(instructions);
-                        words = Bitpack_newu(words, 8, 16 - (i * 8), ch);
+        assert(instructions != NULL);
+        unsigned char *bytes = NULL;
+        size_t size = 0;
+        bool mapped = false;
+
+        struct stat st;
+        int fd = fileno(instructions);
+        if (fd >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) 
+            && st.st_size > 0 && ftell(instructions) == 0) {
+                size = (size_t)st.st_size;
+                bytes = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+                mapped = bytes != MAP_FAILED;
+        }
+        if (!mapped) {
+                bytes = read_all(instructions, &size);
+                if (bytes == NULL) {
+                        fprintf(stderr, "Error reading program image\n");
+                        return false;
                 }
-                Seq_addhi(seg0, (void *)(uintptr_t)words);
         }
-        Seq_addhi(seg_mem->memory, seg0);
+
+        bool ok = size % sizeof(uint32_t) == 0;
+        if (ok) {
+                unsigned length = size / sizeof(uint32_t);
+                uint32_t *seg0 = alloc_segment(seg_mem, length);
+                bswap_words(seg0, bytes, length);
+                free_segment(seg_mem, SEGMENT(seg_mem, 0));
+                set_segment(seg_mem, 0, seg0);
+        } else {
+                fprintf(stderr, "Error: program image is truncated "
+                        "(%lu bytes is not a multiple of 4)\n", 
+                        (unsigned long)size);
+        }
+
+        if (mapped) {
+                munmap(bytes, size);
+        } else {
+                free(bytes);
+        }
+        return ok;
+}
+
+/* populate_seg_words
+*
+* Initialize $m[0] with a copy of a program that is already in memory
+*
+* Parameters:
+*      SegMem_T seg_mem:	The segmented memory to be updated
+*      const uint32_t *words:	The instructions
+*      unsigned length:		The number of instructions
+*
+* Returns: None
+* Expects: The seg_mem cannot be NULL
+*
+* Notes: Used by programs generated by um2c, which carry their own image
+*/
+void populate_seg_words(SegMem_T seg_mem, const uint32_t *words, 
+                        unsigned length)
+{
+        assert(seg_mem != NULL);
+        assert(length == 0 || words != NULL);
+        uint32_t *seg0 = alloc_segment(seg_mem, length);
+        memcpy(seg0, words, (size_t)length * sizeof(uint32_t));
+        free_segment(seg_mem, SEGMENT(seg_mem, 0));
+        set_segment(seg_mem, 0, seg0);
 }
 
 /* map_seg
@@ -88,42 +324,41 @@ void populate_seg(SegMem_T seg_mem, FILE *instructions)
 *      SegMem_T seg_mem:      The segmented memory to be updated. 
 *      unsigned num_words:        number of words in the new segment.
 *
-* Returns: the id of the new segment created.
+* Returns: the id of the new segment created, or 0 if the segment would 
+*          take the memory over its limit
 * Expects: the passed in SegMem_T is not NULL.
 *
-* Notes: It’s a CRE for seg_mem to be null.
+* Notes: It’s a CRE for seg_mem to be null. Nothing changes when the limit 
+* is hit.
 */
 unsigned map_seg(SegMem_T seg_mem, unsigned num_words) 
 {
         assert(seg_mem != NULL);
-        /* initialize new segment */
-        Seq_T new_seg = Seq_new(num_words);
-        /* initialize elements to 0 */
-        for (int i = 0; i < (int)num_words; i++) {
-                Seq_addhi(new_seg, (void *)(uintptr_t)0);
-        }
-        assert(new_seg != NULL);
-        /* check if there is an empty segment */
-        if (Seq_length(seg_mem->empty_id) > 0) {
+        if (seg_mem->limit != 0 && !within_limit(seg_mem, num_words)) {
+                return 0;
+        }
+        /* initialize new segment, with all words set to 0 */
+        uint32_t *new_seg = new_segment(seg_mem, num_words);
+        /* reuse the most recently unmapped id, its slot is likely cached */
+        if (seg_mem->free_count > 0) {
                 unsigned empty_index 
-                                = (uintptr_t)Seq_get(seg_mem->empty_id, 0);
-                Seq_T seg = Seq_get(seg_mem->memory, empty_index);
-                Seq_free(&seg);
-                Seq_put(seg_mem->memory, empty_index, new_seg);
-                Seq_remlo(seg_mem->empty_id);
+                                = seg_mem->free_ids[--seg_mem->free_count];
+                assert(SEGMENT(seg_mem, empty_index) == NULL);
+                set_segment(seg_mem, empty_index, new_seg);
                 return empty_index;
         } else {
-                Seq_addhi(seg_mem->memory, new_seg);
                 seg_mem->curr_id++;
+                ensure_capacity(seg_mem, seg_mem->curr_id);
+                set_segment(seg_mem, seg_mem->curr_id, new_seg);
                 return seg_mem->curr_id;
         }
 }
 
 /* unmap_seg
 *
-* Delete and Deallocate $m[index] and update the segmented memory represented by
-* sequence of sequences. This function will be used when the opcode Unmap 
-* Segment is used which communicates with um.h
+* Delete and Deallocate $m[index] and update the segmented memory. This 
+* function will be used when the opcode Unmap Segment is used which 
+* communicates with um.h
 *
 * Parameters:
 *      SegMem_T seg_mem:		The segmented memory to be updated
@@ -133,14 +368,20 @@ unsigned map_seg(SegMem_T seg_mem, unsigned num_words)
 * Expects: the seg_mem cannot be NULL
 *
 * Notes: 
-* CRE if the seg_mem is NULL
-* this function deallocates the memory of the unmapped segment when the opcode 
-* Unmap Segment is used
+* CRE if the seg_mem is NULL, index is 0 or $m[index] is not mapped
+* this function returns the storage of the unmapped segment to its size class
+* pool (or frees it) when the opcode Unmap Segment is used
 */
 void unmap_seg(SegMem_T seg_mem, unsigned index)
 {
         assert(seg_mem != NULL);
-        Seq_addlo(seg_mem->empty_id, (void *)(uintptr_t)index);
+        assert(index != 0 && index < seg_mem->table.capacity 
+               && SEGMENT(seg_mem, index) != NULL);
+        free_segment(seg_mem, SEGMENT(seg_mem, index));
+        set_segment(seg_mem, index, NULL);
+        seg_mem->table.entries[index].generation++;
+        /* never full: every id on it is below curr_id, hence the capacity */
+        seg_mem->free_ids[seg_mem->free_count++] = index;
 }
 
 /* seg_load
@@ -165,12 +406,12 @@ void unmap_seg(SegMem_T seg_mem, unsigned index)
 uint32_t seg_load(SegMem_T seg_mem, unsigned segid, unsigned offset)
 {
         assert(seg_mem != NULL);
-        Seq_T seg = Seq_get(seg_mem->memory, segid);
-        assert(seg != NULL);
+        assert(segid < seg_mem->table.capacity);
+        const SegEntry *entry = &seg_mem->table.entries[segid];
+        assert(offset < entry->length);
         
         /* get the value at the offset in the segment */
-        uint32_t value = (uintptr_t)Seq_get(seg, offset);
-        return value;
+        return entry->base[offset];
 }
 
 /* seg_store
@@ -193,15 +434,22 @@ uint32_t seg_load(SegMem_T seg_mem, unsigned segid, unsigned offset)
 * Notes: 
 * CRE if seg_mem is NULL or any of segid or offset to be accessing empty 
 * segment or out of range.
+* A segment shared with a forked memory is copied before the store.
 */
 uint32_t seg_store(SegMem_T seg_mem, unsigned segid, 
                         unsigned offset, uint32_t value) 
 {
         assert(seg_mem != NULL);
-        uint32_t old_value = (uint32_t)(uintptr_t)
-                            Seq_get(Seq_get(seg_mem->memory, segid), offset);
-        Seq_put(Seq_get(seg_mem->memory, segid), offset, 
-                (void *)(uintptr_t)value);
+        assert(segid < seg_mem->table.capacity);
+        uint32_t *seg = SEGMENT(seg_mem, segid);
+        assert(offset < seg_mem->table.entries[segid].length);
+
+        if (SHARED(seg_mem, seg)) {
+                seg = unshare(seg_mem, segid);
+        }
+
+        uint32_t old_value = seg[offset];
+        seg[offset] = value;
         return old_value;
 }
 
@@ -217,20 +465,35 @@ uint32_t seg_store(SegMem_T seg_mem, unsigned segid,
 *
 * Notes: 
 * CRE if seg_mem is NULL
-* this function deallocates the memory of the segmented memory
+* this function deallocates the memory of the segmented memory. The 
+* segments go with their arenas, so this takes one munmap per arena rather 
+* than a free per segment. A forked memory only drops its references to the
+* segments; its arenas live on until every memory that may share them is 
+* freed.
 */
 void seg_free(SegMem_T seg_mem)
 {
         assert(seg_mem != NULL);
-        int length = Seq_length(seg_mem->memory);
-        /* free the mapped segments */
-        for (int i = 0; i < length; i++) {
-                Seq_T seg = Seq_get(seg_mem->memory, i);
-                Seq_free(&seg);
+        if (seg_mem->forked) {
+                for (unsigned i = 0; i <= seg_mem->curr_id; i++) {
+                        if (SEGMENT(seg_mem, i) != NULL) {
+                                release(seg_mem, SEGMENT(seg_mem, i));
+                        }
+                }
+        }
+        struct Image *image = seg_mem->image;
+        if (image != NULL && RELEASE(image->refs) == 0) {
+                munmap(image->words, image->bytes);
+                free(image);
         }
 
-        Seq_free(&seg_mem->memory);
-        Seq_free(&seg_mem->empty_id);
+        release_arenas(seg_mem->arenas);
+        for (unsigned i = 0; i < seg_mem->inherited_count; i++) {
+                release_arenas(seg_mem->inherited[i]);
+        }
+        free(seg_mem->inherited);
+        free(seg_mem->table.entries);
+        free(seg_mem->free_ids);
         free(seg_mem);
 }
 
@@ -253,5 +516,1195 @@ void seg_free(SegMem_T seg_mem)
 int seg_length(SegMem_T seg_mem, unsigned segid)
 {
         assert(seg_mem != NULL);
-        return Seq_length(Seq_get(seg_mem->memory, segid));
-}
\ No newline at end of file
+        assert(segid < seg_mem->table.capacity 
+               && SEGMENT(seg_mem, segid) != NULL);
+        return seg_mem->table.entries[segid].length;
+}
+
+/* seg_mapped
+*
+* Tell whether segid names a mapped segment
+*
+* Parameters:
+*      SegMem_T seg_mem:	The segmented memory
+*      unsigned segid:		The id to look up, which may be any value
+*
+* Returns: true if the segment with segid is mapped
+* Expects: The seg_mem cannot be NULL
+*
+* Notes:
+* Lets callers check an id from a program before handing it to the 
+* functions that assert on it.
+*/
+bool seg_mapped(SegMem_T seg_mem, unsigned segid)
+{
+        assert(seg_mem != NULL);
+        return segid < seg_mem->table.capacity 
+               && SEGMENT(seg_mem, segid) != NULL;
+}
+
+/* seg_in_bounds
+*
+* Tell whether offset names a word of the mapped segment segid
+*
+* Parameters:
+*      SegMem_T seg_mem:	The segmented memory
+*      unsigned segid:		The id to look up, which may be any value
+*      unsigned offset:		The offset to look up, which may be any value
+*
+* Returns: true if seg_load and seg_store accept segid and offset
+* Expects: The seg_mem cannot be NULL
+*
+* Notes: An unmapped id has length 0 in the table, so one comparison 
+* covers both
+*/
+bool seg_in_bounds(SegMem_T seg_mem, unsigned segid, unsigned offset)
+{
+        assert(seg_mem != NULL);
+        return segid < seg_mem->table.capacity 
+               && offset < seg_mem->table.entries[segid].length;
+}
+
+/* seg_words
+*
+* Return a raw pointer to the first word of the segment with segid, so that
+* hot loops can index the segment directly
+*
+* Parameters:
+*      SegMem_T seg_mem:	The segmented memory
+*      unsigned segid:		The id of the segment
+*
+* Returns: a pointer to word 0 of the segment
+* Expects: The seg_mem cannot be NULL, segid must refer to a mapped segment
+*
+* Notes:
+* The pointer stays valid until the segment is unmapped; map_seg() never 
+* moves existing segments
+*/
+uint32_t *seg_words(SegMem_T seg_mem, unsigned segid)
+{
+        assert(seg_mem != NULL);
+        assert(segid < seg_mem->table.capacity 
+               && SEGMENT(seg_mem, segid) != NULL);
+        return SEGMENT(seg_mem, segid);
+}
+
+/* seg_allocations
+*
+* Return the number of heap allocations made so far for segment storage and
+* the segment table. Storage reused from the pools is not counted.
+*
+* Parameters:
+*      SegMem_T seg_mem:	The segmented memory
+*
+* Returns: the number of allocations
+* Expects: The seg_mem cannot be NULL
+*
+* Notes: Used by the profiler and the benchmark harness
+*/
+unsigned long seg_allocations(SegMem_T seg_mem)
+{
+        assert(seg_mem != NULL);
+        return seg_mem->allocations;
+}
+
+/* seg_usage
+*
+* Return how much memory the segmented memory holds
+*
+* Parameters:
+*      SegMem_T seg_mem:	The segmented memory
+*
+* Returns: the current usage, the peak and the limit
+* Expects: The seg_mem cannot be NULL
+*
+* Notes: 
+* Segment bytes include headers and size class rounding. Pooled storage and
+* the unused ends of slabs are part of the arenas, which are what the peak
+* and the limit count, together with the table. A segment shared after 
+* seg_fork counts as mapped in every memory using it, but only in the 
+* arenas of the memory that allocated it; a segment in a restored snapshot
+* counts as mapped but is not in any arena.
+*/
+SegMem_usage seg_usage(SegMem_T seg_mem)
+{
+        assert(seg_mem != NULL);
+        SegMem_usage usage;
+        usage.mapped_bytes = seg_mem->mapped_bytes;
+        usage.segments = seg_mem->segments;
+        usage.pooled_bytes = seg_mem->pooled_bytes;
+        usage.arena_bytes = seg_mem->arena_bytes;
+        usage.table_bytes = TABLE_BYTES(seg_mem->table.capacity);
+        usage.peak_bytes = seg_mem->peak_bytes;
+        usage.limit = seg_mem->limit;
+        return usage;
+}
+
+/* seg_set_limit
+*
+* Cap the bytes the segmented memory may hold (see seg_usage): map_seg 
+* fails instead of going over it
+*
+* Parameters:
+*      SegMem_T seg_mem:	The segmented memory
+*      size_t limit:		The most bytes, or 0 for no limit
+*
+* Returns: None
+* Expects: The seg_mem cannot be NULL
+*
+* Notes: 
+* The arenas count against the limit, pooled storage and the unused end of
+* the newest slab included, until an older slab is unmapped when all of its
+* blocks are pooled; a forked memory keeps its slabs. Only map_seg is 
+* refused: the copy made by seg_load_program and the private copies of 
+* forked segments are not, so the limit can be passed by at most the size 
+* of the largest segment.
+*/
+void seg_set_limit(SegMem_T seg_mem, size_t limit)
+{
+        assert(seg_mem != NULL);
+        seg_mem->limit = limit;
+}
+
+/* seg_parse_limit
+*
+* Parse a memory limit for seg_set_limit: a byte count with an optional K, 
+* M or G suffix
+*
+* Parameters:
+*      const char *text:	The count
+*      size_t *bytes:		Receives the number of bytes
+*
+* Returns: true if text is a positive count
+* Expects: text and bytes cannot be NULL
+*
+* Notes: The suffixes are powers of 1024. Shared by the --max-memory options
+* of um and um-batch.
+*/
+bool seg_parse_limit(const char *text, size_t *bytes)
+{
+        char *end;
+        if (*text < '0' || *text > '9') {
+                return false;
+        }
+        unsigned long long count = strtoull(text, &end, 10);
+        int shift = 0;
+        if (*end == 'K') {
+                shift = 10;
+        } else if (*end == 'M') {
+                shift = 20;
+        } else if (*end == 'G') {
+                shift = 30;
+        }
+        if (shift != 0) {
+                end++;
+        }
+        if (*end != '\0' || count == 0 || count > (SIZE_MAX >> shift)) {
+                return false;
+        }
+        *bytes = (size_t)count << shift;
+        return true;
+}
+
+/* seg_table
+*
+* Return the segment table: one entry per id below its capacity, holding 
+* the words and the length of the segment. Used by the interpreter and the
+* JIT to inline segmented loads and stores and their bounds checks.
+*
+* Parameters:
+*      SegMem_T seg_mem:	The segmented memory
+*
+* Returns: the table, which lives as long as the memory
+* Expects: The seg_mem cannot be NULL
+*
+* Notes:
+* The entries move when map_seg() grows the table, so callers must read 
+* the entries pointer after every map_seg(). The table must not be written
+* through; stores into a forked memory must go through seg_store, which 
+* copies shared segments.
+*/
+const SegTable *seg_table(SegMem_T seg_mem)
+{
+        assert(seg_mem != NULL);
+        return &seg_mem->table;
+}
+
+/* seg_snapshot
+*
+* Write the segmented memory to a snapshot: curr_id, the number of empty 
+* ids, the number of mapped segments, the empty ids in the order they will 
+* be reused, then every mapped segment as its id, a 1, its length twice and
+* its words
+*
+* Parameters:
+*      SegMem_T seg_mem:	The segmented memory to be saved
+*      FILE *snapshot:		The stream the image is written to
+*
+* Returns: true if everything was written
+* Expects: The seg_mem and snapshot cannot be NULL
+*
+* Notes: 
+* The words are written in native byte order. The 1 and the lengths 
+* followed by the words have the layout of a segment with its header (one 
+* reference, the length standing in for the capacity), so seg_restore can 
+* use the segments in place.
+*/
+bool seg_snapshot(SegMem_T seg_mem, FILE *snapshot)
+{
+        assert(seg_mem != NULL);
+        assert(snapshot != NULL);
+        uint32_t counts[3] = { seg_mem->curr_id, seg_mem->free_count, 0 };
+        for (unsigned i = 0; i <= seg_mem->curr_id; i++) {
+                counts[2] += SEGMENT(seg_mem, i) != NULL;
+        }
+        bool ok = fwrite(counts, sizeof(uint32_t), 3, snapshot) == 3;
+        for (unsigned i = 0; ok && i < counts[1]; i++) {
+                /* from the top of the stack, in the order of reuse */
+                uint32_t id = seg_mem->free_ids[counts[1] - 1 - i];
+                ok = fwrite(&id, sizeof(uint32_t), 1, snapshot) == 1;
+        }
+        for (unsigned i = 0; ok && i <= seg_mem->curr_id; i++) {
+                uint32_t *seg = SEGMENT(seg_mem, i);
+                if (seg == NULL) {
+                        continue;
+                }
+                uint32_t record[1 + HEADER_WORDS] = { 
+                        i, 1, SEG_LENGTH(seg), SEG_LENGTH(seg) 
+                };
+                ok = fwrite(record, sizeof(uint32_t), 1 + HEADER_WORDS, 
+                            snapshot) == 1 + HEADER_WORDS &&
+                     fwrite(seg, sizeof(uint32_t), SEG_LENGTH(seg), 
+                            snapshot) == SEG_LENGTH(seg);
+        }
+        return ok;
+}
+
+/* seg_restore
+*
+* Create a segmented memory from a snapshot file. The file starts with 
+* header_words words that belong to the caller, followed by the image 
+* written by seg_snapshot.
+*
+* Parameters:
+*      FILE *snapshot:		The snapshot file, a regular file
+*      uint32_t *header:	Receives the first header_words words
+*      unsigned header_words:	The number of words in front of the image
+*
+* Returns: the restored segmented memory, or NULL if the file cannot be 
+*          mapped or is not a valid snapshot (an error message has been 
+*          printed)
+* Expects: snapshot and header cannot be NULL
+*
+* Notes: 
+* The whole file is mapped copy-on-write and the segments are used in 
+* place, so nothing is copied and the pages of a segment are read only when
+* it is first touched; stores change the private copy, never the file. 
+* Segments that are unmapped or replaced are not pooled; the mapping is 
+* released by seg_free of the last memory using it.
+*/
+SegMem_T seg_restore(FILE *snapshot, uint32_t *header, unsigned header_words)
+{
+        assert(snapshot != NULL);
+        assert(header != NULL);
+        struct stat st;
+        int fd = fileno(snapshot);
+        if (fd < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) 
+            || st.st_size % sizeof(uint32_t) != 0 
+            || (size_t)st.st_size < (header_words + 3) * sizeof(uint32_t)) {
+                fprintf(stderr, "Error: snapshot is not a regular file of "
+                        "whole words\n");
+                return NULL;
+        }
+        size_t bytes = (size_t)st.st_size;
+        uint32_t *words = mmap(NULL, bytes, PROT_READ | PROT_WRITE, 
+                               MAP_PRIVATE, fd, 0);
+        if (words == MAP_FAILED) {
+                fprintf(stderr, "Error mapping snapshot\n");
+                return NULL;
+        }
+        memcpy(header, words, header_words * sizeof(uint32_t));
+
+        SegMem_T seg_mem = initialize_segmem();
+        seg_mem->image = malloc(sizeof(struct Image));
+        assert(seg_mem->image != NULL);
+        seg_mem->image->words = words;
+        seg_mem->image->bytes = bytes;
+        seg_mem->image->refs = 1;
+        seg_mem->allocations += 2;
+        if (!restore_segments(seg_mem, words + header_words, 
+                              bytes / sizeof(uint32_t) - header_words)) {
+                fprintf(stderr, "Error: snapshot is corrupt\n");
+                seg_free(seg_mem);
+                return NULL;
+        }
+        return seg_mem;
+}
+
+/* seg_fork
+*
+* Create a copy of the segmented memory that shares every segment with the
+* original, copy-on-write
+*
+* Parameters:
+*      SegMem_T seg_mem:	The segmented memory to be copied
+*
+* Returns: the new segmented memory, with the same segments, curr_id and 
+*          empty ids
+* Expects: The seg_mem cannot be NULL
+*
+* Notes: 
+* Takes time in the number of segment ids and copies no words. Both 
+* memories are marked forked: from then on a store into a shared segment 
+* (seg_store, seg_load_program) first gives the storing memory its own copy,
+* and shared segments are released by reference count. The memories may be
+* used from different threads, but not one memory from two threads. 
+* Pointers from seg_words and seg_table must not be written through while 
+* the memory is forked.
+*/
+SegMem_T seg_fork(SegMem_T seg_mem)
+{
+        assert(seg_mem != NULL);
+        SegMem_T fork = initialize_segmem();
+        ensure_capacity(fork, seg_mem->curr_id);
+        fork->curr_id = seg_mem->curr_id;
+        memcpy(fork->table.entries, seg_mem->table.entries, 
+               ((size_t)seg_mem->curr_id + 1) * sizeof(SegEntry));
+        for (unsigned i = 0; i <= seg_mem->curr_id; i++) {
+                uint32_t *seg = SEGMENT(seg_mem, i);
+                if (seg != NULL) {
+                        RETAIN(SEG_REFS(seg));
+                        count_segment(fork, seg);
+                }
+        }
+        memcpy(fork->free_ids, seg_mem->free_ids, 
+               seg_mem->free_count * sizeof(uint32_t));
+        fork->free_count = seg_mem->free_count;
+        fork->image = seg_mem->image;
+        if (fork->image != NULL) {
+                RETAIN(fork->image->refs);
+        }
+
+        /* keep the arenas the shared segments live in */
+        fork->inherited_count = seg_mem->inherited_count + 1;
+        fork->inherited = malloc(fork->inherited_count 
+                                 * sizeof(struct Arenas *));
+        assert(fork->inherited != NULL);
+        for (unsigned i = 0; i < seg_mem->inherited_count; i++) {
+                fork->inherited[i] = seg_mem->inherited[i];
+                RETAIN(fork->inherited[i]->refs);
+        }
+        fork->inherited[seg_mem->inherited_count] = seg_mem->arenas;
+        RETAIN(seg_mem->arenas->refs);
+        fork->forked = true;
+        seg_mem->forked = true;
+        return fork;
+}
+
+/* seg_forked
+*
+* Tell whether the memory may share segments with forked memories
+*
+* Parameters:
+*      SegMem_T seg_mem:	The segmented memory
+*
+* Returns: true if seg_fork made it or was called on it
+* Expects: The seg_mem cannot be NULL
+*
+* Notes: Used by the JIT, whose inlined stores do not copy shared segments
+*/
+bool seg_forked(SegMem_T seg_mem)
+{
+        assert(seg_mem != NULL);
+        return seg_mem->forked;
+}
+
+/* seg_load_program
+*
+* Replace $m[0] with a duplicate of the segment with segid. This is used by 
+* the Load Program instruction.
+*
+* Parameters:
+*      SegMem_T seg_mem:	The segmented memory to be updated
+*      unsigned segid:		The id of the segment to be duplicated
+*
+* Returns: None
+* Expects: The seg_mem cannot be NULL, segid must refer to a mapped segment
+*
+* Notes:
+* The duplicate is always installed as segment 0 and is made with a single 
+* memcpy. The storage of the old $m[0] is reused when it is big enough and
+* not shared, and no id is pushed to or taken from the empty id list.
+* Pointers returned by seg_words(seg_mem, 0) are invalidated.
+*/
+void seg_load_program(SegMem_T seg_mem, unsigned segid)
+{
+        assert(seg_mem != NULL);
+        if (segid == 0) {
+                return;
+        }
+        assert(segid < seg_mem->table.capacity);
+        uint32_t *src = SEGMENT(seg_mem, segid);
+        assert(src != NULL);
+        unsigned length = SEG_LENGTH(src);
+
+        uint32_t *seg0 = SEGMENT(seg_mem, 0);
+        if (seg0 == NULL || SEG_CAPACITY(seg0) < length 
+            || SHARED(seg_mem, seg0)) {
+                free_segment(seg_mem, seg0);
+                seg0 = alloc_segment(seg_mem, length);
+        }
+        SEG_LENGTH(seg0) = length;
+        set_segment(seg_mem, 0, seg0);
+        memcpy(seg0, src, (size_t)length * sizeof(uint32_t));
+}
+
+/* alloc_segment
+*
+* Allocate storage for a segment of num_words words, taking a block from the
+* pool of its size class when one is available, else carving one from a 
+* slab, or giving a large segment a mapping of its own. The words are not 
+* initialized.
+*
+* Parameters:
+*      SegMem_T seg_mem:	The segmented memory owning the pools
+*      unsigned num_words:	number of words in the new segment
+*
+* Returns: a pointer to the first word of the new segment
+* Expects: The seg_mem cannot be NULL
+*
+* Notes: CRE if the allocation fails; the segment is freed with free_segment()
+*/
+static uint32_t *alloc_segment(SegMem_T seg_mem, unsigned num_words)
+{
+        uint32_t *block;
+        unsigned capacity = num_words;
+        if (num_words <= (1u << MAX_CLASS)) {
+                unsigned k = size_class(num_words);
+                capacity = 1u << k;
+                block = seg_mem->pool[k];
+                if (block != NULL) {
+                        /* pop the free list */
+                        memcpy(&seg_mem->pool[k], block, sizeof(uint32_t *));
+                        seg_mem->pooled_bytes -= BLOCK_BYTES(capacity);
+                } else {
+                        block = carve(seg_mem, BLOCK_BYTES(capacity));
+                }
+                if (!seg_mem->forked) {
+                        SLAB_OF(block)->live++;
+                }
+        } else {
+                block = map_large(seg_mem, BLOCK_BYTES(capacity));
+        }
+        block[0] = 1;
+        block[1] = capacity;
+        block[2] = num_words;
+        count_segment(seg_mem, block + HEADER_WORDS);
+        return block + HEADER_WORDS;
+}
+
+/* new_segment
+*
+* Allocate a segment of num_words words, all initialized to 0
+*
+* Parameters:
+*      SegMem_T seg_mem:	The segmented memory owning the pools
+*      unsigned num_words:	number of words in the new segment
+*
+* Returns: a pointer to the first word of the new segment
+* Expects: The seg_mem cannot be NULL
+*
+* Notes: CRE if the allocation fails; the segment is freed with free_segment()
+*/
+static uint32_t *new_segment(SegMem_T seg_mem, unsigned num_words)
+{
+        uint32_t *seg = alloc_segment(seg_mem, num_words);
+        memset(seg, 0, (size_t)num_words * sizeof(uint32_t));
+        return seg;
+}
+
+/* free_segment
+*
+* Release the storage of a segment created by alloc_segment(). Blocks of a 
+* size class go back to the pool of that class and large segments are 
+* unmapped. Does nothing if seg is NULL or is still shared with a forked 
+* memory.
+*
+* Parameters:
+*      SegMem_T seg_mem:	The segmented memory owning the pools
+*      uint32_t *seg:		The segment to be released
+*
+* Returns: None
+* Expects: The seg_mem cannot be NULL
+*
+* Notes: 
+* Unless the memory is forked, a slab other than the newest is unmapped 
+* when its last block in use is pooled.
+*/
+static void free_segment(SegMem_T seg_mem, uint32_t *seg)
+{
+        if (seg == NULL) {
+                return;
+        }
+        seg_mem->segments--;
+        seg_mem->mapped_bytes -= BLOCK_BYTES(SEG_CAPACITY(seg));
+        if (!release(seg_mem, seg)) {
+                return;
+        }
+        uint32_t *block = seg - HEADER_WORDS;
+        if (in_image(seg_mem, block)) {
+                /* the mapping is released as a whole by seg_free */
+                return;
+        }
+        unsigned capacity = SEG_CAPACITY(seg);
+        if (capacity > (1u << MAX_CLASS)) {
+                unmap_large(seg_mem, block);
+                return;
+        }
+        /* push onto the free list */
+        unsigned k = size_class(capacity);
+        memcpy(block, &seg_mem->pool[k], sizeof(uint32_t *));
+        seg_mem->pool[k] = block;
+        seg_mem->pooled_bytes += BLOCK_BYTES(capacity);
+        if (!seg_mem->forked) {
+                struct Slab *slab = SLAB_OF(block);
+                if (--slab->live == 0 && slab != seg_mem->arenas->slabs) {
+                        release_slab(seg_mem, slab);
+                }
+        }
+}
+
+/* size_class
+*
+* Return the smallest k such that a segment of num_words words fits in 2^k
+* words
+*
+* Parameters:
+*      unsigned num_words:	number of words in the segment
+*
+* Returns: the size class of the segment
+* Expects: num_words is at most 2^MAX_CLASS
+*
+* Notes: None
+*/
+static unsigned size_class(unsigned num_words)
+{
+        unsigned k = 0;
+        while ((1u << k) < num_words) {
+                k++;
+        }
+        return k;
+}
+
+/* ensure_capacity
+*
+* Grow the segment table, doubling its size, until segid is a valid index. 
+* New slots are set to NULL. The free-id stack grows with the table, so it 
+* always has room for every id below the capacity.
+*
+* Parameters:
+*      SegMem_T seg_mem:	The segmented memory to be updated
+*      unsigned segid:		The id that must fit in the table
+*
+* Returns: None
+* Expects: The seg_mem cannot be NULL
+*
+* Notes: CRE if the reallocation fails
+*/
+static void ensure_capacity(SegMem_T seg_mem, unsigned segid)
+{
+        if (segid < seg_mem->table.capacity) {
+                return;
+        }
+        SegTable *table = &seg_mem->table;
+        unsigned old_capacity = table->capacity;
+        while (segid >= table->capacity) {
+                table->capacity *= 2;
+        }
+        table->entries = realloc(table->entries, 
+                                 table->capacity * sizeof(SegEntry));
+        assert(table->entries != NULL);
+        seg_mem->allocations++;
+        memset(table->entries + old_capacity, 0, 
+               (table->capacity - old_capacity) * sizeof(SegEntry));
+        seg_mem->free_ids = realloc(seg_mem->free_ids, 
+                                    table->capacity * sizeof(uint32_t));
+        assert(seg_mem->free_ids != NULL);
+        note_peak(seg_mem);
+}
+
+/* set_segment
+*
+* Point the table entry of segid at a segment, or clear it
+*
+* Parameters:
+*      SegMem_T seg_mem:	The segmented memory to be updated
+*      unsigned segid:		The id, below the capacity of the table
+*      uint32_t *seg:		The words of the segment, or NULL to unmap
+*
+* Returns: None
+* Expects: The seg_mem cannot be NULL
+*
+* Notes: The entry keeps a copy of the length from the header of the 
+* segment, so lookups and bounds checks touch only the table; an unmapped
+* entry has length 0
+*/
+static void set_segment(SegMem_T seg_mem, unsigned segid, uint32_t *seg)
+{
+        SegEntry *entry = &seg_mem->table.entries[segid];
+        entry->base = seg;
+        entry->length = seg == NULL ? 0 : SEG_LENGTH(seg);
+}
+
+/* restore_segments
+*
+* Rebuild the ids and the segment table of an empty segmented memory from 
+* an image written by seg_snapshot, pointing the table into the image
+*
+* Parameters:
+*      SegMem_T seg_mem:	The new segmented memory
+*      const uint32_t *words:	The image
+*      size_t count:		The number of words in the image
+*
+* Returns: true if the image is well formed
+* Expects: The seg_mem cannot be NULL, words has at least 3 words
+*
+* Notes: A failed restore leaves seg_mem consistent, ready for seg_free
+*/
+static bool restore_segments(SegMem_T seg_mem, const uint32_t *words, 
+                             size_t count)
+{
+        uint32_t curr_id = words[0];
+        uint32_t empty = words[1];
+        uint32_t mapped = words[2];
+        size_t i = 3;
+        /* every id up to curr_id is either mapped or empty */
+        if (empty > count - i || mapped == 0 
+            || (uint64_t)curr_id + 1 != (uint64_t)mapped + empty) {
+                return false;
+        }
+
+        ensure_capacity(seg_mem, curr_id);
+        seg_mem->curr_id = curr_id;
+        for (; mapped > 0; mapped--) {
+                if (count - i < 1 + HEADER_WORDS + (size_t)empty) {
+                        return false;
+                }
+                const uint32_t *record = words + i + empty;
+                uint32_t id = record[0];
+                uint32_t length = record[2];
+                if (id > curr_id || SEGMENT(seg_mem, id) != NULL 
+                    || record[1] != 1 || record[3] != length 
+                    || length > count - i - empty - 1 - HEADER_WORDS) {
+                        return false;
+                }
+                set_segment(seg_mem, id, 
+                            (uint32_t *)record + 1 + HEADER_WORDS);
+                count_segment(seg_mem, SEGMENT(seg_mem, id));
+                i += 1 + HEADER_WORDS + (size_t)length;
+        }
+        if (SEGMENT(seg_mem, 0) == NULL || i + empty != count) {
+                return false;
+        }
+
+        /* the empty ids come right after the counts */
+        for (uint32_t k = 0; k < empty; k++) {
+                uint32_t id = words[3 + k];
+                if (id == 0 || id > curr_id || SEGMENT(seg_mem, id) != NULL) {
+                        return false;
+                }
+                seg_mem->free_ids[empty - 1 - k] = id;
+        }
+        return true;
+}
+
+/* in_image
+*
+* Tell whether a segment block lies in the mapped snapshot of the memory
+*
+* Parameters:
+*      SegMem_T seg_mem:	The segmented memory
+*      const uint32_t *block:	The block, header included
+*
+* Returns: true if the block is part of the mapping
+* Expects: The seg_mem cannot be NULL
+*
+* Notes: None
+*/
+static bool in_image(SegMem_T seg_mem, const uint32_t *block)
+{
+        struct Image *image = seg_mem->image;
+        return image != NULL && block >= image->words 
+               && block < image->words + image->bytes / sizeof(uint32_t);
+}
+
+/* release
+*
+* Drop the reference of seg_mem to a segment
+*
+* Parameters:
+*      SegMem_T seg_mem:	The segmented memory
+*      uint32_t *seg:		The segment
+*
+* Returns: true if no memory uses the segment any more, so its storage 
+*          can be reused
+* Expects: The seg_mem and seg cannot be NULL
+*
+* Notes: None
+*/
+static bool release(SegMem_T seg_mem, uint32_t *seg)
+{
+        return !seg_mem->forked || RELEASE(SEG_REFS(seg)) == 0;
+}
+
+/* unshare
+*
+* Replace a segment that is shared with forked memories by a private copy
+*
+* Parameters:
+*      SegMem_T seg_mem:	The segmented memory
+*      unsigned segid:		The id of the segment
+*
+* Returns: a pointer to the first word of the copy
+* Expects: The seg_mem cannot be NULL, segid must refer to a mapped segment
+*
+* Notes: If the other memories released the segment in the meantime, the 
+* original storage is freed here
+*/
+static uint32_t *unshare(SegMem_T seg_mem, unsigned segid)
+{
+        uint32_t *seg = SEGMENT(seg_mem, segid);
+        uint32_t *copy = alloc_segment(seg_mem, SEG_LENGTH(seg));
+        memcpy(copy, seg, (size_t)SEG_LENGTH(seg) * sizeof(uint32_t));
+        free_segment(seg_mem, seg);
+        set_segment(seg_mem, segid, copy);
+        return copy;
+}
+
+/* read_all
+*
+* Read a stream to its end into a single buffer
+*
+* Parameters:
+*      FILE *instructions:	The stream to be read
+*      size_t *size:		Set to the number of bytes read
+*
+* Returns: a malloc'd buffer holding the bytes, or NULL on a read error
+* Expects: None
+*
+* Notes: The caller frees the buffer
+*/
+static unsigned char *read_all(FILE *instructions, size_t *size)
+{
+        size_t capacity = 1 << 16;
+        size_t used = 0;
+        unsigned char *buffer = malloc(capacity);
+        assert(buffer != NULL);
+        for (;;) {
+                used += fread(buffer + used, 1, capacity - used, 
+                              instructions);
+                if (used < capacity) {
+                        break;
+                }
+                capacity *= 2;
+                buffer = realloc(buffer, capacity);
+                assert(buffer != NULL);
+        }
+        if (ferror(instructions)) {
+                free(buffer);
+                return NULL;
+        }
+        *size = used;
+        return buffer;
+}
+
+#ifdef HAVE_SSSE3_BSWAP
+/* bswap_words_ssse3
+*
+* SSSE3 version of bswap_words, reversing four words per shuffle
+*/
+__attribute__((target("ssse3")))
+static size_t bswap_words_ssse3(uint32_t *dst, const unsigned char *src, 
+                                size_t n)
+{
+        const __m128i reverse = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 
+                                              11, 10, 9, 8, 15, 14, 13, 12);
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+                __m128i v = _mm_loadu_si128((const __m128i *)(src + 4 * i));
+                _mm_storeu_si128((__m128i *)(dst + i), 
+                                 _mm_shuffle_epi8(v, reverse));
+        }
+        return i;
+}
+#endif
+
+/* bswap_words
+*
+* Convert n big-endian 32-bit words from src into native words in dst
+*
+* Parameters:
+*      uint32_t *dst:		The destination words
+*      const unsigned char *src:	The big-endian bytes
+*      size_t n:		The number of words
+*
+* Returns: None
+* Expects: src holds at least 4 * n bytes
+*
+* Notes: Uses an SSSE3 shuffle when the host supports it; the remaining 
+* words are assembled byte by byte, which is endian independent.
+*/
+static void bswap_words(uint32_t *dst, const unsigned char *src, size_t n)
+{
+        size_t i = 0;
+#ifdef HAVE_SSSE3_BSWAP
+        if (__builtin_cpu_supports("ssse3")) {
+                i = bswap_words_ssse3(dst, src, n);
+        }
+#endif
+        for (; i < n; i++) {
+                const unsigned char *p = src + 4 * i;
+                dst[i] = (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 
+                       | (uint32_t)p[2] << 8 | (uint32_t)p[3];
+        }
+}
+
+/* count_segment
+*
+* Add a segment the memory now refers to to its usage
+*
+* Parameters:
+*      SegMem_T seg_mem:	The segmented memory
+*      const uint32_t *seg:	The segment, with its header set
+*
+* Returns: None
+* Expects: The seg_mem and seg cannot be NULL
+*
+* Notes: free_segment takes it off again
+*/
+static void count_segment(SegMem_T seg_mem, const uint32_t *seg)
+{
+        seg_mem->segments++;
+        seg_mem->mapped_bytes += BLOCK_BYTES(SEG_CAPACITY(seg));
+}
+
+/* held_bytes
+*
+* Return the bytes the memory holds: its arenas and its table
+*/
+static size_t held_bytes(SegMem_T seg_mem)
+{
+        return seg_mem->arena_bytes + TABLE_BYTES(seg_mem->table.capacity);
+}
+
+/* note_peak
+*
+* Raise the peak to the bytes the memory holds now
+*/
+static void note_peak(SegMem_T seg_mem)
+{
+        if (held_bytes(seg_mem) > seg_mem->peak_bytes) {
+                seg_mem->peak_bytes = held_bytes(seg_mem);
+        }
+}
+
+/* within_limit
+*
+* Tell whether a new segment of num_words words fits under the limit of the
+* memory
+*
+* Parameters:
+*      SegMem_T seg_mem:	The segmented memory, with a limit
+*      unsigned num_words:	number of words in the new segment
+*
+* Returns: true if map_seg may map the segment
+* Expects: The seg_mem cannot be NULL
+*
+* Notes: 
+* A block from the pool or the newest slab takes no new bytes. Counts the 
+* growth of the table when the segment needs a new id.
+*/
+static bool within_limit(SegMem_T seg_mem, unsigned num_words)
+{
+        size_t need = 0;
+        if (num_words <= (1u << MAX_CLASS)) {
+                unsigned k = size_class(num_words);
+                size_t bytes = BLOCK_BYTES(1u << k);
+                if (seg_mem->pool[k] == NULL 
+                    && (size_t)(seg_mem->bump_end - seg_mem->bump) 
+                       < ((bytes + 15) & ~(size_t)15)) {
+                        need = slab_size(seg_mem, bytes);
+                }
+        } else {
+                need = large_size(BLOCK_BYTES(num_words));
+        }
+        if (seg_mem->free_count == 0 
+            && seg_mem->curr_id + 1 >= seg_mem->table.capacity) {
+                need += TABLE_BYTES(seg_mem->table.capacity);
+        }
+        return held_bytes(seg_mem) + need <= seg_mem->limit;
+}
+
+/* carve
+*
+* Bump-allocate a block from the newest slab, starting a new slab when it 
+* is too full
+*
+* Parameters:
+*      SegMem_T seg_mem:	The segmented memory
+*      size_t bytes:		The size of the block
+*
+* Returns: the block
+* Expects: The seg_mem cannot be NULL, bytes fits in a huge page
+*
+* Notes: CRE if the slab cannot be mapped. Blocks are rounded up to 16 
+* bytes. The rest of a full slab is left unused, and the full slab is 
+* released at once if all of its blocks are already pooled.
+*/
+static uint32_t *carve(SegMem_T seg_mem, size_t bytes)
+{
+        /* keep blocks 16-byte aligned, as malloc would */
+        bytes = (bytes + 15) & ~(size_t)15;
+        if ((size_t)(seg_mem->bump_end - seg_mem->bump) < bytes) {
+                struct Arenas *arenas = seg_mem->arenas;
+                struct Slab *full = arenas->slabs;
+                size_t size = slab_size(seg_mem, bytes);
+                struct Slab *slab = map_arena(seg_mem, size, HUGE_PAGE);
+                slab->bytes = size;
+                slab->live = 0;
+                slab->prev = NULL;
+                slab->next = full;
+                if (full != NULL) {
+                        full->prev = slab;
+                }
+                arenas->slabs = slab;
+                seg_mem->bump = (unsigned char *)(slab + 1);
+                seg_mem->bump_end = (unsigned char *)slab + size;
+                if (seg_mem->slab_bytes < HUGE_PAGE) {
+                        seg_mem->slab_bytes *= 2;
+                }
+                if (full != NULL && full->live == 0 && !seg_mem->forked) {
+                        release_slab(seg_mem, full);
+                }
+        }
+        uint32_t *block = (uint32_t *)seg_mem->bump;
+        seg_mem->bump += bytes;
+        return block;
+}
+
+/* release_slab
+*
+* Unmap a slab none of whose blocks is in use, taking its blocks out of the
+* pools
+*
+* Parameters:
+*      SegMem_T seg_mem:	The segmented memory, which is not forked
+*      struct Slab *slab:	The slab, which is not the newest one
+*
+* Returns: None
+* Expects: The seg_mem and slab cannot be NULL
+*
+* Notes: 
+* Walks every pool, so that map and unmap keep to the singly linked free 
+* lists. This happens at most once per slab mapped.
+*/
+static void release_slab(SegMem_T seg_mem, struct Slab *slab)
+{
+        for (unsigned k = 0; k < NUM_CLASSES; k++) {
+                uint32_t *prev = NULL;
+                uint32_t *block = seg_mem->pool[k];
+                while (block != NULL) {
+                        uint32_t *next;
+                        memcpy(&next, block, sizeof(uint32_t *));
+                        if (SLAB_OF(block) != slab) {
+                                prev = block;
+                                block = next;
+                                continue;
+                        }
+                        /* unlink the block */
+                        if (prev != NULL) {
+                                memcpy(prev, &next, sizeof(uint32_t *));
+                        } else {
+                                seg_mem->pool[k] = next;
+                        }
+                        seg_mem->pooled_bytes -= BLOCK_BYTES(1u << k);
+                        block = next;
+                }
+        }
+
+        struct Arenas *arenas = seg_mem->arenas;
+        if (slab->prev != NULL) {
+                slab->prev->next = slab->next;
+        } else {
+                arenas->slabs = slab->next;
+        }
+        if (slab->next != NULL) {
+                slab->next->prev = slab->prev;
+        }
+        seg_mem->arena_bytes -= slab->bytes;
+        munmap(slab, slab->bytes);
+}
+
+/* slab_size
+*
+* Return the size of the next slab, which must hold a block of bytes bytes
+*/
+static size_t slab_size(SegMem_T seg_mem, size_t bytes)
+{
+        size_t size = seg_mem->slab_bytes;
+        while (size < sizeof(struct Slab) + bytes) {
+                size *= 2;
+        }
+        return size;
+}
+
+/* map_large
+*
+* Give a block of bytes bytes a mapping of its own and list it in the 
+* arenas of the memory
+*
+* Parameters:
+*      SegMem_T seg_mem:	The segmented memory
+*      size_t bytes:		The size of the block
+*
+* Returns: the block
+* Expects: The seg_mem cannot be NULL
+*
+* Notes: CRE if the mapping fails
+*/
+static uint32_t *map_large(SegMem_T seg_mem, size_t bytes)
+{
+        size_t size = large_size(bytes);
+        struct Mapping *mapping = map_arena(seg_mem, size, 
+                                            size >= HUGE_PAGE ? HUGE_PAGE : 0);
+        struct Arenas *arenas = seg_mem->arenas;
+        mapping->bytes = size;
+        mapping->owner = arenas;
+        mapping->prev = NULL;
+        mapping->next = arenas->large;
+        if (arenas->large != NULL) {
+                arenas->large->prev = mapping;
+        }
+        arenas->large = mapping;
+        return (uint32_t *)(mapping + 1);
+}
+
+/* large_size
+*
+* Return the size of the mapping of a large block of bytes bytes
+*/
+static size_t large_size(size_t bytes)
+{
+        return (sizeof(struct Mapping) + bytes + PAGE_SIZE - 1) 
+               & ~(PAGE_SIZE - 1);
+}
+
+/* unmap_large
+*
+* Unmap the mapping of a large block that no memory uses any more
+*
+* Parameters:
+*      SegMem_T seg_mem:	The segmented memory releasing the block
+*      uint32_t *block:		The block, made by map_large
+*
+* Returns: None
+* Expects: The seg_mem and block cannot be NULL
+*
+* Notes: 
+* A block made by another memory is left in the list of its owner, which 
+* only that memory changes, and goes when the owner's arenas are released.
+*/
+static void unmap_large(SegMem_T seg_mem, uint32_t *block)
+{
+        struct Mapping *mapping = (struct Mapping *)block - 1;
+        struct Arenas *arenas = seg_mem->arenas;
+        if (mapping->owner != arenas) {
+                return;
+        }
+        if (mapping->prev != NULL) {
+                mapping->prev->next = mapping->next;
+        } else {
+                arenas->large = mapping->next;
+        }
+        if (mapping->next != NULL) {
+                mapping->next->prev = mapping->prev;
+        }
+        seg_mem->arena_bytes -= mapping->bytes;
+        munmap(mapping, mapping->bytes);
+}
+
+/* map_arena
+*
+* Map bytes bytes of zeroed memory for a slab or a large segment
+*
+* Parameters:
+*      SegMem_T seg_mem:	The segmented memory the arena is for
+*      size_t bytes:		The size, a multiple of the page size
+*      size_t align:		HUGE_PAGE to align the mapping to it, or 0
+*
+* Returns: the start of the mapping
+* Expects: The seg_mem cannot be NULL
+*
+* Notes: 
+* CRE if the mapping fails. The mapping is aligned by mapping more and 
+* trimming. A mapping of HUGE_PAGE bytes or more is advised to use huge 
+* pages where the system has them.
+*/
+static void *map_arena(SegMem_T seg_mem, size_t bytes, size_t align)
+{
+        unsigned char *start = mmap(NULL, bytes + align, 
+                                    PROT_READ | PROT_WRITE, 
+                                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        assert(start != MAP_FAILED);
+        if (align != 0) {
+                unsigned char *aligned = (unsigned char *)
+                        (((uintptr_t)start + align - 1) 
+                         & ~(uintptr_t)(align - 1));
+                if (aligned > start) {
+                        munmap(start, aligned - start);
+                }
+                if (aligned + bytes < start + bytes + align) {
+                        munmap(aligned + bytes, start + align - aligned);
+                }
+                start = aligned;
+        }
+#ifdef MADV_HUGEPAGE
+        if (bytes >= HUGE_PAGE) {
+                madvise(start, bytes, MADV_HUGEPAGE);
+        }
+#endif
+        seg_mem->allocations++;
+        seg_mem->arena_bytes += bytes;
+        note_peak(seg_mem);
+        return start;
+}
+
+/* release_arenas
+*
+* Drop a reference to arenas, unmapping them when it was the last
+*
+* Parameters:
+*      struct Arenas *arenas:	The arenas
+*
+* Returns: None
+* Expects: arenas cannot be NULL
+*
+* Notes: Takes one munmap per slab and large mapping
+*/
+static void release_arenas(struct Arenas *arenas)
+{
+        if (RELEASE(arenas->refs) != 0) {
+                return;
+        }
+        while (arenas->slabs != NULL) {
+                struct Slab *slab = arenas->slabs;
+                arenas->slabs = slab->next;
+                munmap(slab, slab->bytes);
+        }
+        while (arenas->large != NULL) {
+                struct Mapping *mapping = arenas->large;
+                arenas->large = mapping->next;
+                munmap(mapping, mapping->bytes);
+        }
+        free(arenas);
+}
@@ -13,15 +13,42 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdbool.h>
 #include <bitpack.h>
 
 #define T SegMem_T
 typedef struct T *T;
 
+/* one entry of the segment table, see seg_table */
+typedef struct SegEntry {
+        uint32_t *base; /* word 0 of the segment, NULL if it is unmapped */
+        uint32_t length; /* number of words, 0 if it is unmapped */
+        uint32_t generation; /* number of times the id has been unmapped */
+} SegEntry;
+
+/* the segment table, indexed by segment id */
+typedef struct SegTable {
+        SegEntry *entries; /* one entry per id below the capacity */
+        unsigned capacity; /* number of entries */
+} SegTable;
+
+/* the memory a SegMem_T holds, in bytes, see seg_usage */
+typedef struct SegMem_usage {
+        size_t mapped_bytes; /* storage of the mapped segments */
+        unsigned segments; /* number of mapped segments */
+        size_t pooled_bytes; /* storage of unmapped segments kept for reuse */
+        size_t arena_bytes; /* slabs and large mappings holding the above */
+        size_t table_bytes; /* the segment table and free-id stack */
+        size_t peak_bytes; /* most arena and table bytes held at once */
+        size_t limit; /* see seg_set_limit, 0 for none */
+} SegMem_usage;
+
 
 T initialize_segmem();
 
-void populate_seg(T seg_mem, FILE *instructions);
+bool populate_seg(T seg_mem, FILE *instructions);
+
+void populate_seg_words(T seg_mem, const uint32_t *words, unsigned length);
 
 unsigned map_seg(T seg_mem, unsigned num_words);
 
@@ -35,5 +62,31 @@ void seg_free(T seg_mem);
 
 int seg_length(T seg_mem, unsigned segid);
 
+bool seg_mapped(T seg_mem, unsigned segid);
+
+bool seg_in_bounds(T seg_mem, unsigned segid, unsigned offset);
+
+uint32_t *seg_words(T seg_mem, unsigned segid);
+
+void seg_load_program(T seg_mem, unsigned segid);
+
+bool seg_snapshot(T seg_mem, FILE *snapshot);
+
+T seg_restore(FILE *snapshot, uint32_t *header, unsigned header_words);
+
+T seg_fork(T seg_mem);
+
+bool seg_forked(T seg_mem);
+
+unsigned long seg_allocations(T seg_mem);
+
+SegMem_usage seg_usage(T seg_mem);
+
+void seg_set_limit(T seg_mem, size_t limit);
+
+bool seg_parse_limit(const char *text, size_t *bytes);
+
+const SegTable *seg_table(T seg_mem);
+
 #undef T
 #endif
\ No newline at end of file
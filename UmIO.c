@@ -0,0 +1,345 @@
+/*
+ *     UmIO.c
+ *     by Elisa and Cynthia, 04/10/2025
+ *     Project 6 - um
+ *
+ *     This is the implementation of the UmIO module. When the streams are 
+ *     backed by file descriptors the device talks to them directly with 
+ *     read and write; otherwise it falls back to the unlocked stdio calls.
+ *     A device made with umio_new_callbacks uses neither and calls the 
+ *     client's functions instead.
+ */
+
+/* 
+ * read, write, fileno and sched_yield are POSIX; the unlocked stdio calls 
+ * are too 
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include "UmIO.h"
+#include <assert.h>
+#include <errno.h>
+#include <poll.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/* sizes of the output and input buffers in bytes */
+#define OUT_SIZE (1 << 16)
+#define IN_SIZE (1 << 12)
+
+/* the value the UM sees when the input is exhausted */
+#define UM_EOF 0xFFFFFFFF
+
+struct UmIO_T {
+        FILE *input; /* input stream */
+        FILE *output; /* output stream */
+        int in_fd; /* descriptor of input, or -1 to use stdio */
+        int out_fd; /* descriptor of output, or -1 to use stdio */
+        size_t out_len; /* number of bytes waiting in out_buf */
+        size_t in_pos; /* next unread byte in in_buf */
+        size_t in_len; /* number of valid bytes in in_buf */
+        bool in_eof; /* the input stream is exhausted */
+        UmIO_read *read; /* input callback, or NULL to use the streams */
+        UmIO_write *write; /* output callback, or NULL to use the streams */
+        void *cl; /* closure of the callbacks */
+        unsigned char out_buf[OUT_SIZE];
+        unsigned char in_buf[IN_SIZE];
+};
+
+static void write_all(UmIO_T io, const unsigned char *buf, size_t len);
+static bool call_read(UmIO_T io);
+
+/* umio_new
+*
+* Create an I/O device reading from input and writing to output
+*
+* Parameters:
+*      FILE *input:		the input stream
+*      FILE *output:		the output stream
+*
+* Returns: a new UmIO_T
+* Expects: input and output cannot be NULL
+*
+* Notes: 
+* CRE if the allocation fails. Anything already buffered in output is 
+* flushed so bytes written through the descriptor keep their order. The 
+* input descriptor is only used if the stream has no buffered bytes of its
+* own. The device is freed with umio_free().
+*/
+UmIO_T umio_new(FILE *input, FILE *output)
+{
+        assert(input != NULL);
+        assert(output != NULL);
+        UmIO_T io = malloc(sizeof(*io));
+        assert(io != NULL);
+
+        io->input = input;
+        io->output = output;
+        fflush(output);
+        io->out_fd = fileno(output);
+        io->in_fd = ftell(input) <= 0 ? fileno(input) : -1;
+        io->out_len = 0;
+        io->in_pos = 0;
+        io->in_len = 0;
+        io->in_eof = false;
+        io->read = NULL;
+        io->write = NULL;
+        io->cl = NULL;
+        return io;
+}
+
+/* umio_new_callbacks
+*
+* Create an I/O device that gets its input from read and hands its output 
+* to write
+*
+* Parameters:
+*      UmIO_read *read:		the input callback
+*      UmIO_write *write:	the output callback
+*      void *cl:		passed to both callbacks
+*
+* Returns: the new device
+* Expects: read and write cannot be NULL
+*
+* Notes: 
+* CRE if the allocation fails. Output is buffered like on a stream, so write
+* gets batches, at the latest when the UM waits for input, stops or halts. 
+* read may return 0 when it has nothing yet: um_run then stops with 
+* UM_WAITING and calls it again when it is run next. The other loops cannot
+* stop and keep calling read, yielding the thread in between, so they are 
+* best used with a read that blocks.
+*/
+UmIO_T umio_new_callbacks(UmIO_read *read, UmIO_write *write, void *cl)
+{
+        assert(read != NULL);
+        assert(write != NULL);
+        UmIO_T io = malloc(sizeof(*io));
+        assert(io != NULL);
+
+        io->input = NULL;
+        io->output = NULL;
+        io->out_fd = -1;
+        io->in_fd = -1;
+        io->out_len = 0;
+        io->in_pos = 0;
+        io->in_len = 0;
+        io->in_eof = false;
+        io->read = read;
+        io->write = write;
+        io->cl = cl;
+        return io;
+}
+
+/* umio_put
+*
+* Queue a byte for output, writing the buffer out once it is full
+*
+* Parameters:
+*      UmIO_T io:		the I/O device
+*      uint32_t value:		the byte to be written
+*
+* Returns: None
+* Expects: io cannot be NULL and value must be at most 255
+*
+* Notes: CRE if value does not fit in a byte
+*/
+void umio_put(UmIO_T io, uint32_t value)
+{
+        assert(value <= 255);
+        if (io->out_len == OUT_SIZE) {
+                umio_flush(io);
+        }
+        io->out_buf[io->out_len++] = (unsigned char)value;
+}
+
+/* umio_get
+*
+* Read the next input byte
+*
+* Parameters:
+*      UmIO_T io:		the I/O device
+*
+* Returns: the byte read, or 0xFFFFFFFF (all ones) once the input is at EOF
+* Expects: io cannot be NULL
+*
+* Notes: Pending output is flushed before the device blocks on the input
+*/
+uint32_t umio_get(UmIO_T io)
+{
+        if (io->in_pos < io->in_len) {
+                return io->in_buf[io->in_pos++];
+        }
+        if (io->in_eof) {
+                return UM_EOF;
+        }
+
+        umio_flush(io);
+        if (io->read != NULL) {
+                while (!call_read(io)) {
+                        sched_yield();
+                }
+                return io->in_eof ? UM_EOF : io->in_buf[io->in_pos++];
+        }
+        if (io->in_fd < 0) {
+                int ch = getc_unlocked(io->input);
+                if (ch == EOF) {
+                        io->in_eof = true;
+                        return UM_EOF;
+                }
+                return (uint32_t)ch;
+        }
+
+        ssize_t n;
+        do {
+                n = read(io->in_fd, io->in_buf, IN_SIZE);
+        } while (n < 0 && errno == EINTR);
+        if (n <= 0) {
+                io->in_eof = true;
+                return UM_EOF;
+        }
+        io->in_len = (size_t)n;
+        io->in_pos = 1;
+        return io->in_buf[0];
+}
+
+/* umio_ready
+*
+* Tell whether umio_get would return without blocking
+*
+* Parameters:
+*      UmIO_T io:		the I/O device
+*
+* Returns: true if a byte is buffered, the input is at EOF, the input 
+*          descriptor is readable or hung up, or the input callback 
+*          delivered bytes or the end of the input
+* Expects: io cannot be NULL
+*
+* Notes: 
+* Input read through stdio is always reported ready, as is a descriptor 
+* that poll() fails on; umio_get then settles it by reading.
+*/
+bool umio_ready(UmIO_T io)
+{
+        assert(io != NULL);
+        if (io->in_pos < io->in_len || io->in_eof) {
+                return true;
+        }
+        if (io->read != NULL) {
+                return call_read(io);
+        }
+        if (io->in_fd < 0) {
+                return true;
+        }
+        struct pollfd fd = { .fd = io->in_fd, .events = POLLIN };
+        return poll(&fd, 1, 0) != 0;
+}
+
+/* umio_flush
+*
+* Write out all pending output
+*
+* Parameters:
+*      UmIO_T io:		the I/O device
+*
+* Returns: None
+* Expects: io cannot be NULL
+*
+* Notes: None
+*/
+void umio_flush(UmIO_T io)
+{
+        assert(io != NULL);
+        if (io->out_len > 0) {
+                write_all(io, io->out_buf, io->out_len);
+                io->out_len = 0;
+        }
+}
+
+/* umio_free
+*
+* Flush pending output and deallocate the I/O device. The streams are not 
+* closed.
+*
+* Parameters:
+*      UmIO_T io:		the I/O device
+*
+* Returns: None
+* Expects: io cannot be NULL
+*
+* Notes: None
+*/
+void umio_free(UmIO_T io)
+{
+        assert(io != NULL);
+        umio_flush(io);
+        free(io);
+}
+
+/* write_all
+*
+* Write len bytes to the output, retrying short writes
+*
+* Parameters:
+*      UmIO_T io:		the I/O device
+*      const unsigned char *buf:	the bytes to be written
+*      size_t len:		the number of bytes
+*
+* Returns: None
+* Expects: None
+*
+* Notes: Output errors (for example a closed pipe) drop the remaining bytes
+*/
+static void write_all(UmIO_T io, const unsigned char *buf, size_t len)
+{
+        if (io->write != NULL) {
+                io->write(io->cl, buf, len);
+                return;
+        }
+        if (io->out_fd < 0) {
+                fwrite(buf, 1, len, io->output);
+                fflush(io->output);
+                return;
+        }
+        while (len > 0) {
+                ssize_t n = write(io->out_fd, buf, len);
+                if (n < 0) {
+                        if (errno == EINTR) {
+                                continue;
+                        }
+                        return;
+                }
+                buf += n;
+                len -= (size_t)n;
+        }
+}
+
+/* call_read
+*
+* Ask the input callback for the next block of input
+*
+* Parameters:
+*      UmIO_T io:		the I/O device, with an empty input buffer
+*
+* Returns: true if the buffer was refilled or the input ended, false if the
+*          callback had nothing yet
+* Expects: io->read cannot be NULL
+*
+* Notes: None
+*/
+static bool call_read(UmIO_T io)
+{
+        long n = io->read(io->cl, io->in_buf, IN_SIZE);
+        assert(n <= IN_SIZE);
+        if (n == 0) {
+                return false;
+        }
+        if (n < 0) {
+                io->in_eof = true;
+        } else {
+                io->in_len = (size_t)n;
+                io->in_pos = 0;
+        }
+        return true;
+}
@@ -0,0 +1,47 @@
+/*
+ *     UmIO.h
+ *     by Elisa and Cynthia, 04/10/2025
+ *     Project 6 - um
+ *
+ *     Declarations for the UmIO module, the I/O device of the UM. Output 
+ *     bytes are collected in a large buffer and written in batches; input is
+ *     read in blocks. Pending output is always flushed before the device 
+ *     waits for input, so interactive programs see their prompts. Instead
+ *     of streams, a device can call back into its client for input and 
+ *     output, which lets an event loop feed a UM without blocking on it.
+ */
+#ifndef UMIO_INCLUDED
+#define UMIO_INCLUDED
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define T UmIO_T
+typedef struct T *T;
+
+/* 
+ * The callbacks of a device without streams. UmIO_read puts up to size 
+ * bytes in buf and returns how many, 0 if none are available yet, or a 
+ * negative number at the end of the input. UmIO_write takes len bytes. 
+ * Both get the cl given to umio_new_callbacks.
+ */
+typedef long UmIO_read(void *cl, unsigned char *buf, size_t size);
+typedef void UmIO_write(void *cl, const unsigned char *buf, size_t len);
+
+T umio_new(FILE *input, FILE *output);
+
+T umio_new_callbacks(UmIO_read *read, UmIO_write *write, void *cl);
+
+void umio_put(T io, uint32_t value);
+
+uint32_t umio_get(T io);
+
+bool umio_ready(T io);
+
+void umio_flush(T io);
+
+void umio_free(T io);
+
+#undef T
+#endif
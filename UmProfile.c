@@ -0,0 +1,481 @@
+/*
+ *     UmProfile.c
+ *     by Elisa and Cynthia, 04/10/2025
+ *     Project 6 - um
+ *
+ *     This is the implementation of the UmProfile module. Counters are kept
+ *     per address in arrays that grow with the program, so a profile can
+ *     span several programs loaded with LOADP; addresses are then shared
+ *     between them. A basic block is counted each time the program starts
+ *     or a LOADP jumps to it, and it extends to the next LOADP, HALT or
+ *     illegal instruction of the program in $m[0] when the report is made.
+ */
+
+#include "UmProfile.h"
+#include "decode.h"
+#include <assert.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* number of entries in the hot address and hot block tables */
+#define PROFILE_TOP 20
+
+/* the opcodes that are counted: the 14 instructions and illegal ones */
+#define PROFILE_OPCODES 15
+
+/* bucket 0 counts empty segments, bucket k sizes in [2^(k-1), 2^k) */
+#define SIZE_BUCKETS 33
+
+struct UmProfile_T {
+        uint64_t instructions; /* instructions executed */
+        uint64_t opcodes[PROFILE_OPCODES]; /* executions per opcode */
+        uint64_t *counts; /* executions per address */
+        uint64_t *entries; /* block entries per address */
+        unsigned capacity; /* number of addresses counts has room for */
+        bool block_start; /* the next instruction starts a block */
+        uint64_t loadps; /* LOADP instructions */
+        uint64_t new_programs; /* LOADPs that replaced $m[0] */
+        uint64_t maps; /* map_seg calls */
+        uint64_t unmaps; /* unmap_seg calls */
+        uint64_t sizes[SIZE_BUCKETS]; /* histogram of mapped sizes */
+        uint64_t allocations; /* heap allocations made by the memory */
+};
+
+static void grow(UmProfile_T prof, uint32_t pc);
+static unsigned top(const uint64_t *values, unsigned length,
+                    unsigned *indices);
+static unsigned block_end(const uint32_t *program, unsigned length,
+                          unsigned start);
+static unsigned size_bucket(uint32_t num_words);
+static void bucket_range(unsigned bucket, uint64_t *low, uint64_t *high);
+
+/* profile_new
+*
+* Create an empty profile
+*
+* Parameters: None
+*
+* Returns: a new UmProfile_T
+* Expects: None
+*
+* Notes: CRE if the allocation fails. The profile is freed with
+* profile_free().
+*/
+UmProfile_T profile_new(void)
+{
+        UmProfile_T prof = calloc(1, sizeof(*prof));
+        assert(prof != NULL);
+        prof->counts = NULL;
+        prof->entries = NULL;
+        prof->capacity = 0;
+        prof->block_start = true;
+        return prof;
+}
+
+/* profile_instruction
+*
+* Count one executed instruction
+*
+* Parameters:
+*      UmProfile_T prof:	The profile
+*      uint32_t pc:		The address of the instruction
+*      unsigned opcode:		The plain opcode of the instruction
+*
+* Returns: None
+* Expects: prof cannot be NULL
+*
+* Notes: The per address arrays grow to cover pc
+*/
+void profile_instruction(UmProfile_T prof, uint32_t pc, unsigned opcode)
+{
+        assert(prof != NULL);
+        if (pc >= prof->capacity) {
+                grow(prof, pc);
+        }
+        prof->instructions++;
+        prof->opcodes[opcode <= LV ? opcode : PROFILE_OPCODES - 1]++;
+        prof->counts[pc]++;
+        if (prof->block_start) {
+                prof->entries[pc]++;
+                prof->block_start = false;
+        }
+}
+
+/* profile_loadp
+*
+* Count a LOADP; the next instruction starts a basic block
+*
+* Parameters:
+*      UmProfile_T prof:	The profile
+*      bool new_program:	true if $m[0] was replaced
+*
+* Returns: None
+* Expects: prof cannot be NULL
+*
+* Notes: None
+*/
+void profile_loadp(UmProfile_T prof, bool new_program)
+{
+        assert(prof != NULL);
+        prof->loadps++;
+        if (new_program) {
+                prof->new_programs++;
+        }
+        prof->block_start = true;
+}
+
+/* profile_map
+*
+* Count a mapped segment and its size
+*
+* Parameters:
+*      UmProfile_T prof:	The profile
+*      uint32_t num_words:	The size of the segment
+*
+* Returns: None
+* Expects: prof cannot be NULL
+*
+* Notes: None
+*/
+void profile_map(UmProfile_T prof, uint32_t num_words)
+{
+        assert(prof != NULL);
+        prof->maps++;
+        prof->sizes[size_bucket(num_words)]++;
+}
+
+/* profile_unmap
+*
+* Count an unmapped segment
+*
+* Parameters:
+*      UmProfile_T prof:	The profile
+*
+* Returns: None
+* Expects: prof cannot be NULL
+*
+* Notes: None
+*/
+void profile_unmap(UmProfile_T prof)
+{
+        assert(prof != NULL);
+        prof->unmaps++;
+}
+
+/* profile_allocations
+*
+* Record the number of heap allocations the segmented memory made
+*
+* Parameters:
+*      UmProfile_T prof:	The profile
+*      uint64_t allocations:	The count, see seg_allocations()
+*
+* Returns: None
+* Expects: prof cannot be NULL
+*
+* Notes: None
+*/
+void profile_allocations(UmProfile_T prof, uint64_t allocations)
+{
+        assert(prof != NULL);
+        prof->allocations = allocations;
+}
+
+/* profile_report
+*
+* Write the report of the profile as text and as JSON
+*
+* Parameters:
+*      UmProfile_T prof:	The profile
+*      const uint32_t *program:	The words of $m[0], used to find the extent
+*                               of the hot blocks
+*      unsigned length:		The number of words in $m[0]
+*      FILE *text:		The stream for the text report, or NULL
+*      FILE *json:		The stream for the JSON report, or NULL
+*
+* Returns: None
+* Expects: prof cannot be NULL, program cannot be NULL unless length is 0
+*
+* Notes:
+* The report lists every opcode, the histogram of mapped segment sizes and
+* the PROFILE_TOP hottest addresses and blocks
+*/
+void profile_report(UmProfile_T prof, const uint32_t *program,
+                    unsigned length, FILE *text, FILE *json)
+{
+        assert(prof != NULL);
+        assert(length == 0 || program != NULL);
+
+        unsigned hot[PROFILE_TOP], blocks[PROFILE_TOP];
+        unsigned num_hot = top(prof->counts, prof->capacity, hot);
+        unsigned num_blocks = top(prof->entries, prof->capacity, blocks);
+        double total = prof->instructions > 0 ? prof->instructions : 1;
+
+        if (text != NULL) {
+                fprintf(text, "UM profile\n"
+                              "instructions %" PRIu64 "\n"
+                              "loadp %" PRIu64 " (%" PRIu64
+                              " loaded a new program)\n"
+                              "map %" PRIu64 ", unmap %" PRIu64 "\n"
+                              "allocations %" PRIu64 "\n\n",
+                        prof->instructions, prof->loadps,
+                        prof->new_programs, prof->maps, prof->unmaps,
+                        prof->allocations);
+
+                fprintf(text, "opcode               count       %%\n");
+                for (int i = 0; i < PROFILE_OPCODES; i++) {
+                        fprintf(text, "%-10s %15" PRIu64 " %7.2f\n",
+                                opcode_name(i), prof->opcodes[i],
+                                100.0 * prof->opcodes[i] / total);
+                }
+
+                fprintf(text, "\nmapped segment size          count\n");
+                for (unsigned i = 0; i < SIZE_BUCKETS; i++) {
+                        uint64_t low, high;
+                        if (prof->sizes[i] == 0) {
+                                continue;
+                        }
+                        bucket_range(i, &low, &high);
+                        fprintf(text, "%10" PRIu64 " - %10" PRIu64
+                                " %10" PRIu64 "\n", low, high,
+                                prof->sizes[i]);
+                }
+
+                fprintf(text, "\nhot addresses       count       %%  "
+                              "opcode\n");
+                for (unsigned i = 0; i < num_hot; i++) {
+                        unsigned pc = hot[i];
+                        fprintf(text, "%10u %12" PRIu64 " %7.2f  %s\n", pc,
+                                prof->counts[pc],
+                                100.0 * prof->counts[pc] / total,
+                                pc < length ? opcode_name(program[pc] >> 28)
+                                            : "-");
+                }
+
+                fprintf(text, "\nhot blocks       start        end     "
+                              "entries\n");
+                for (unsigned i = 0; i < num_blocks; i++) {
+                        unsigned start = blocks[i];
+                        fprintf(text, "           %10u %10u %11" PRIu64
+                                "\n", start,
+                                block_end(program, length, start),
+                                prof->entries[start]);
+                }
+        }
+
+        if (json != NULL) {
+                fprintf(json, "{\n  \"instructions\": %" PRIu64 ",\n"
+                              "  \"loadp\": %" PRIu64 ",\n"
+                              "  \"new_programs\": %" PRIu64 ",\n"
+                              "  \"map\": %" PRIu64 ",\n"
+                              "  \"unmap\": %" PRIu64 ",\n"
+                              "  \"allocations\": %" PRIu64 ",\n"
+                              "  \"opcodes\": {",
+                        prof->instructions, prof->loadps,
+                        prof->new_programs, prof->maps, prof->unmaps,
+                        prof->allocations);
+                for (int i = 0; i < PROFILE_OPCODES; i++) {
+                        fprintf(json, "%s\n    \"%s\": %" PRIu64,
+                                i == 0 ? "" : ",", opcode_name(i),
+                                prof->opcodes[i]);
+                }
+
+                fprintf(json, "\n  },\n  \"segment_sizes\": [");
+                bool first = true;
+                for (unsigned i = 0; i < SIZE_BUCKETS; i++) {
+                        uint64_t low, high;
+                        if (prof->sizes[i] == 0) {
+                                continue;
+                        }
+                        bucket_range(i, &low, &high);
+                        fprintf(json, "%s\n    { \"min\": %" PRIu64
+                                ", \"max\": %" PRIu64 ", \"count\": %"
+                                PRIu64 " }", first ? "" : ",", low, high,
+                                prof->sizes[i]);
+                        first = false;
+                }
+
+                fprintf(json, "\n  ],\n  \"hot_addresses\": [");
+                for (unsigned i = 0; i < num_hot; i++) {
+                        fprintf(json, "%s\n    { \"pc\": %u, \"count\": %"
+                                PRIu64 " }", i == 0 ? "" : ",", hot[i],
+                                prof->counts[hot[i]]);
+                }
+
+                fprintf(json, "\n  ],\n  \"hot_blocks\": [");
+                for (unsigned i = 0; i < num_blocks; i++) {
+                        unsigned start = blocks[i];
+                        fprintf(json, "%s\n    { \"start\": %u, \"end\": %u,"
+                                " \"entries\": %" PRIu64 " }",
+                                i == 0 ? "" : ",", start,
+                                block_end(program, length, start),
+                                prof->entries[start]);
+                }
+                fprintf(json, "\n  ]\n}\n");
+        }
+}
+
+/* profile_free
+*
+* Free the profile
+*
+* Parameters:
+*      UmProfile_T prof:	The profile
+*
+* Returns: None
+* Expects: prof cannot be NULL
+*
+* Notes: None
+*/
+void profile_free(UmProfile_T prof)
+{
+        assert(prof != NULL);
+        free(prof->counts);
+        free(prof->entries);
+        free(prof);
+}
+
+/* grow
+*
+* Grow the per address arrays so they cover pc, zeroing the new part
+*
+* Parameters:
+*      UmProfile_T prof:	The profile
+*      uint32_t pc:		The address that has to fit
+*
+* Returns: None
+* Expects: prof cannot be NULL
+*
+* Notes: CRE if the allocation fails
+*/
+static void grow(UmProfile_T prof, uint32_t pc)
+{
+        uint64_t capacity = prof->capacity == 0 ? 1024 : prof->capacity;
+        while (capacity <= pc) {
+                capacity *= 2;
+        }
+
+        uint64_t *counts = realloc(prof->counts, capacity * sizeof(uint64_t));
+        assert(counts != NULL);
+        uint64_t *entries = realloc(prof->entries,
+                                    capacity * sizeof(uint64_t));
+        assert(entries != NULL);
+
+        size_t added = (capacity - prof->capacity) * sizeof(uint64_t);
+        memset(counts + prof->capacity, 0, added);
+        memset(entries + prof->capacity, 0, added);
+        prof->counts = counts;
+        prof->entries = entries;
+        prof->capacity = capacity;
+}
+
+/* top
+*
+* Find the indices of the largest non-zero values, largest first
+*
+* Parameters:
+*      const uint64_t *values:	The values
+*      unsigned length:		The number of values
+*      unsigned *indices:	Receives up to PROFILE_TOP indices
+*
+* Returns: the number of indices found
+* Expects: indices has room for PROFILE_TOP entries
+*
+* Notes: Ties keep the lower index first
+*/
+static unsigned top(const uint64_t *values, unsigned length,
+                    unsigned *indices)
+{
+        unsigned found = 0;
+        for (unsigned i = 0; i < length; i++) {
+                if (values[i] == 0 || (found == PROFILE_TOP &&
+                    values[i] <= values[indices[found - 1]])) {
+                        continue;
+                }
+
+                /* insertion into the sorted table */
+                unsigned j = found < PROFILE_TOP ? found++ : found - 1;
+                while (j > 0 && values[indices[j - 1]] < values[i]) {
+                        indices[j] = indices[j - 1];
+                        j--;
+                }
+                indices[j] = i;
+        }
+        return found;
+}
+
+/* block_end
+*
+* Find the last instruction of the basic block starting at start
+*
+* Parameters:
+*      const uint32_t *program:	The words of $m[0]
+*      unsigned length:		The number of words in $m[0]
+*      unsigned start:		The first address of the block
+*
+* Returns: the address of the LOADP, HALT or illegal instruction ending the
+*          block, or the last address of the program
+* Expects: None
+*
+* Notes: None
+*/
+static unsigned block_end(const uint32_t *program, unsigned length,
+                          unsigned start)
+{
+        for (unsigned pc = start; pc < length; pc++) {
+                unsigned opcode = program[pc] >> 28;
+                if (opcode == LOADP || opcode == HALT || opcode > LV) {
+                        return pc;
+                }
+        }
+        return length > 0 ? length - 1 : 0;
+}
+
+/* size_bucket
+*
+* Find the histogram bucket of a segment size
+*
+* Parameters:
+*      uint32_t num_words:	The size of the segment
+*
+* Returns: 0 for an empty segment, else one more than the index of the
+*          highest set bit
+* Expects: None
+*
+* Notes: None
+*/
+static unsigned size_bucket(uint32_t num_words)
+{
+        unsigned bucket = 0;
+        while (num_words != 0) {
+                bucket++;
+                num_words >>= 1;
+        }
+        return bucket;
+}
+
+/* bucket_range
+*
+* Find the smallest and largest size counted by a bucket
+*
+* Parameters:
+*      unsigned bucket:		The bucket
+*      uint64_t *low:		Receives the smallest size
+*      uint64_t *high:		Receives the largest size
+*
+* Returns: None
+* Expects: bucket is less than SIZE_BUCKETS
+*
+* Notes: None
+*/
+static void bucket_range(unsigned bucket, uint64_t *low, uint64_t *high)
+{
+        if (bucket == 0) {
+                *low = 0;
+                *high = 0;
+        } else {
+                *low = (uint64_t)1 << (bucket - 1);
+                *high = ((uint64_t)1 << bucket) - 1;
+        }
+}
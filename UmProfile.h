@@ -0,0 +1,40 @@
+/*
+ *     UmProfile.h
+ *     by Elisa and Cynthia, 04/10/2025
+ *     Project 6 - um
+ *
+ *     Declarations for the UmProfile module, which collects what a UM
+ *     program spends its time on: executions per opcode and per address,
+ *     entries into basic blocks, LOADPs, maps, unmaps and the sizes of the
+ *     mapped segments. It is only fed by the profiling copy of the execution
+ *     loop (um --profile), so the normal loop pays nothing for it.
+ */
+#ifndef UMPROFILE_INCLUDED
+#define UMPROFILE_INCLUDED
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define T UmProfile_T
+typedef struct T *T;
+
+T profile_new(void);
+
+void profile_instruction(T prof, uint32_t pc, unsigned opcode);
+
+void profile_loadp(T prof, bool new_program);
+
+void profile_map(T prof, uint32_t num_words);
+
+void profile_unmap(T prof);
+
+void profile_allocations(T prof, uint64_t allocations);
+
+void profile_report(T prof, const uint32_t *program, unsigned length,
+                    FILE *text, FILE *json);
+
+void profile_free(T prof);
+
+#undef T
+#endif
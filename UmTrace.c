@@ -0,0 +1,497 @@
+/*
+ *     UmTrace.c
+ *     by Elisa and Cynthia, 04/10/2025
+ *     Project 6 - um
+ *
+ *     This is the implementation of the UmTrace module. Both directions
+ *     drive the UM with um_run, the checked loop, which counts instructions
+ *     at LOADPs only and so runs at the speed of the normal loop. The UM
+ *     gets an input device that has nothing to give until the module hands
+ *     it a byte, so um_run stops in front of every input instruction with
+ *     the exact instruction count; a byte is then read (or, in a replay,
+ *     taken from the trace) and given to the program. A checkpoint is taken
+ *     when a slice of period instructions runs out, at the first LOADP past
+ *     it. A replay runs its slices to the recorded counts, so every build
+ *     stops on the same instructions: the debug build, which counts every
+ *     instruction, stops there exactly as the fast loop does.
+ *
+ *     The trace starts with the 4 bytes "UMT1" and, as variable-length
+ *     integers (7 bits per byte, low bits first), the period, the length
+ *     and a hash of $m[0] and the checksum of the UM when it started. Each
+ *     event is a tag byte, the number of instructions since the previous
+ *     event as a variable-length integer, and its data: the byte for an
+ *     input, nothing at the end of the input, and the checksum as 4 bytes,
+ *     low byte first, for a checkpoint, a halt or a fault.
+ */
+
+#include "UmTrace.h"
+#include <assert.h>
+#include <inttypes.h>
+#include <string.h>
+
+/* the first bytes of a trace */
+static const char TRACE_MAGIC[4] = { 'U', 'M', 'T', '1' };
+
+/* the tags of the events */
+typedef enum Trace_tag {
+        TRACE_INPUT = 1,        /* the program read a byte */
+        TRACE_EOF,              /* the program read past the end */
+        TRACE_CHECK,            /* a checkpoint */
+        TRACE_HALT,             /* the program halted */
+        TRACE_FAULT             /* the program failed */
+} Trace_tag;
+
+/* an event of the trace */
+typedef struct Event {
+        Trace_tag tag;
+        uint64_t at; /* the instruction count of the event */
+        uint32_t data; /* the byte or the checksum */
+} Event;
+
+/* the input device of the UM while it is traced */
+typedef struct Feed {
+        FILE *output; /* where the program writes */
+        int pending; /* the byte to give the program, FEED_EOF or NONE */
+} Feed;
+
+/* values of Feed.pending other than a byte */
+#define FEED_NONE (-2)
+#define FEED_EOF (-1)
+
+static long feed_read(void *cl, unsigned char *buf, size_t size);
+static void feed_write(void *cl, const unsigned char *buf, size_t len);
+static uint32_t checksum(UM_T um);
+static uint32_t program_hash(UM_T um);
+static void put_number(FILE *trace, uint64_t value);
+static bool get_number(FILE *trace, uint64_t *value);
+static void put_event(FILE *trace, Event event, uint64_t *last);
+static bool get_event(FILE *trace, Event *event, uint64_t *last);
+static void describe(Event event, char *text, size_t size);
+
+/* trace_record
+*
+* Run a UM to the end, feeding it input and writing the trace of the run
+*
+* Parameters:
+*      UM_T um:			The UM, not yet run
+*      FILE *input:		The input of the program
+*      FILE *output:		The output of the program
+*      FILE *trace:		The trace file
+*      uint64_t period:		The instructions between checkpoints
+*
+* Returns: true if the trace was written
+* Expects: um, input, output and trace cannot be NULL, period cannot be 0
+*
+* Notes:
+* CRE if um, input, output or trace is NULL or period is 0
+* The I/O device of the UM is replaced. When the program fails, um_fault
+* says why and the trace ends with the fault.
+*/
+bool trace_record(UM_T um, FILE *input, FILE *output, FILE *trace,
+                  uint64_t period)
+{
+        assert(um != NULL && input != NULL && output != NULL);
+        assert(trace != NULL);
+        assert(period != 0);
+        Feed feed = { output, FEED_NONE };
+        um_set_callbacks(um, feed_read, feed_write, &feed);
+
+        fwrite(TRACE_MAGIC, 1, sizeof(TRACE_MAGIC), trace);
+        put_number(trace, period);
+        put_number(trace, seg_length(um_seg_mem(um), 0));
+        put_number(trace, program_hash(um));
+        put_number(trace, checksum(um));
+
+        uint64_t last = 0; /* the instruction count of the last event */
+        uint64_t mark = 0; /* the instruction count of the last checkpoint */
+        for (;;) {
+                uint64_t now = um_instructions(um);
+                Um_status status = um_run(um, now - mark < period
+                                              ? mark + period - now : 1);
+                Event event = { TRACE_CHECK, um_instructions(um), 0 };
+                if (status == UM_WAITING) {
+                        int ch = getc(input);
+                        feed.pending = ch == EOF ? FEED_EOF : ch;
+                        event.tag = ch == EOF ? TRACE_EOF : TRACE_INPUT;
+                        event.data = ch == EOF ? 0 : (uint32_t)ch;
+                        put_event(trace, event, &last);
+                        continue;
+                }
+                event.data = checksum(um);
+                if (status == UM_BUDGET) {
+                        mark = event.at;
+                        put_event(trace, event, &last);
+                        continue;
+                }
+                event.tag = status == UM_HALTED ? TRACE_HALT : TRACE_FAULT;
+                put_event(trace, event, &last);
+                return !ferror(trace);
+        }
+}
+
+/* trace_replay
+*
+* Run a UM with the input of a trace, checking it against the trace
+*
+* Parameters:
+*      UM_T um:			The UM, not yet run, in the state the
+*                               recorded one started in
+*      FILE *output:		The output of the program
+*      FILE *trace:		The trace file
+*
+* Returns: true if the run matched the trace to its end
+* Expects: um, output and trace cannot be NULL
+*
+* Notes:
+* CRE if um, output or trace is NULL
+* The I/O device of the UM is replaced. The first difference is reported on
+* stderr, with the last checkpoint that matched, and the run stops there;
+* the divergence lies between the two. A trace recorded with a smaller
+* period narrows it down. A fault of the replay is left to um_fault.
+*/
+bool trace_replay(UM_T um, FILE *output, FILE *trace)
+{
+        assert(um != NULL && output != NULL && trace != NULL);
+        Feed feed = { output, FEED_NONE };
+        um_set_callbacks(um, feed_read, feed_write, &feed);
+
+        char magic[sizeof(TRACE_MAGIC)];
+        uint64_t period, length, hash, start;
+        if (fread(magic, 1, sizeof(magic), trace) != sizeof(magic) ||
+            memcmp(magic, TRACE_MAGIC, sizeof(magic)) != 0 ||
+            !get_number(trace, &period) || !get_number(trace, &length) ||
+            !get_number(trace, &hash) || !get_number(trace, &start)) {
+                fprintf(stderr, "Error: not a UM trace\n");
+                return false;
+        }
+        if (length != (uint64_t)seg_length(um_seg_mem(um), 0) ||
+            hash != program_hash(um) || start != checksum(um)) {
+                fprintf(stderr, "Error: the trace is of another program or "
+                        "state\n");
+                return false;
+        }
+
+        uint64_t last = 0, matched = 0;
+        Event expected;
+        char want[96], got[96];
+        while (get_event(trace, &expected, &last)) {
+                uint64_t now = um_instructions(um);
+                Um_status status = UM_BUDGET;
+                if (expected.at >= now) {
+                        status = um_run(um, expected.tag == TRACE_CHECK
+                                            ? expected.at - now
+                                            : UINT64_MAX);
+                }
+                Event event = { TRACE_CHECK, um_instructions(um), 0 };
+                if (status == UM_WAITING) {
+                        event.tag = expected.tag == TRACE_EOF ? TRACE_EOF
+                                                              : TRACE_INPUT;
+                        event.data = expected.data;
+                } else {
+                        event.tag = status == UM_BUDGET ? TRACE_CHECK
+                                  : status == UM_HALTED ? TRACE_HALT
+                                  : TRACE_FAULT;
+                        event.data = checksum(um);
+                }
+                if (event.tag != expected.tag || event.at != expected.at ||
+                    event.data != expected.data) {
+                        describe(expected, want, sizeof(want));
+                        describe(event, got, sizeof(got));
+                        fprintf(stderr, "Replay diverged: expected %s, got "
+                                "%s; last checkpoint matched at instruction"
+                                " %" PRIu64 "\n", want, got, matched);
+                        return false;
+                }
+                if (event.tag == TRACE_INPUT || event.tag == TRACE_EOF) {
+                        feed.pending = event.tag == TRACE_EOF
+                                       ? FEED_EOF : (int)event.data;
+                } else if (event.tag == TRACE_CHECK) {
+                        matched = event.at;
+                } else {
+                        return true;
+                }
+        }
+        fprintf(stderr, "Error: the trace ends before the program\n");
+        return false;
+}
+
+/* feed_read
+*
+* The input callback of a traced UM: give it the pending byte, if any
+*
+* Parameters:
+*      void *cl:		The Feed
+*      unsigned char *buf:	Receives the byte
+*      size_t size:		The room in buf
+*
+* Returns: 1, -1 at the end of the input, or 0 if no byte is pending, which
+*          makes um_run stop in front of the input instruction
+* Expects: cl and buf cannot be NULL, size cannot be 0
+*
+* Notes: One byte at a time, so every input instruction stops the UM
+*/
+static long feed_read(void *cl, unsigned char *buf, size_t size)
+{
+        Feed *feed = cl;
+        assert(size > 0);
+        int pending = feed->pending;
+        feed->pending = FEED_NONE;
+        if (pending == FEED_NONE) {
+                return 0;
+        }
+        if (pending == FEED_EOF) {
+                return -1;
+        }
+        buf[0] = (unsigned char)pending;
+        return 1;
+}
+
+/* feed_write
+*
+* The output callback of a traced UM
+*
+* Parameters:
+*      void *cl:		The Feed
+*      const unsigned char *buf:	The bytes
+*      size_t len:		The number of bytes
+*
+* Returns: None
+* Expects: cl and buf cannot be NULL
+*
+* Notes: None
+*/
+static void feed_write(void *cl, const unsigned char *buf, size_t len)
+{
+        Feed *feed = cl;
+        fwrite(buf, 1, len, feed->output);
+}
+
+/* fnv
+*
+* Fold a word into an FNV-1a hash, low byte first
+*
+* Parameters:
+*      uint32_t hash:		The hash so far
+*      uint32_t word:		The word
+*
+* Returns: the new hash
+* Expects: None
+*
+* Notes: None
+*/
+static inline uint32_t fnv(uint32_t hash, uint32_t word)
+{
+        for (int i = 0; i < 4; i++) {
+                hash = (hash ^ ((word >> (8 * i)) & 0xFF)) * 16777619u;
+        }
+        return hash;
+}
+
+/* checksum
+*
+* Hash the registers and the program counter of a stopped UM
+*
+* Parameters:
+*      UM_T um:			The UM
+*
+* Returns: the checksum
+* Expects: um cannot be NULL
+*
+* Notes: None
+*/
+static uint32_t checksum(UM_T um)
+{
+        uint32_t registers[8], pc;
+        um_state(um, registers, &pc);
+        uint32_t hash = 2166136261u;
+        for (int r = 0; r < 8; r++) {
+                hash = fnv(hash, registers[r]);
+        }
+        return fnv(hash, pc);
+}
+
+/* program_hash
+*
+* Hash the program in $m[0]
+*
+* Parameters:
+*      UM_T um:			The UM
+*
+* Returns: the hash
+* Expects: um cannot be NULL
+*
+* Notes: Tells a replay that it runs the recorded program
+*/
+static uint32_t program_hash(UM_T um)
+{
+        SegMem_T seg_mem = um_seg_mem(um);
+        const uint32_t *words = seg_words(seg_mem, 0);
+        int length = seg_length(seg_mem, 0);
+        uint32_t hash = 2166136261u;
+        for (int i = 0; i < length; i++) {
+                hash = fnv(hash, words[i]);
+        }
+        return hash;
+}
+
+/* put_number
+*
+* Write a variable-length integer, 7 bits per byte, low bits first
+*
+* Parameters:
+*      FILE *trace:		The trace
+*      uint64_t value:		The integer
+*
+* Returns: None
+* Expects: trace cannot be NULL
+*
+* Notes: The top bit of a byte says that another one follows
+*/
+static void put_number(FILE *trace, uint64_t value)
+{
+        while (value >= 0x80) {
+                putc((int)(value & 0x7F) | 0x80, trace);
+                value >>= 7;
+        }
+        putc((int)value, trace);
+}
+
+/* get_number
+*
+* Read a variable-length integer written by put_number
+*
+* Parameters:
+*      FILE *trace:		The trace
+*      uint64_t *value:		Receives the integer
+*
+* Returns: false at the end of the trace or on a damaged number
+* Expects: trace and value cannot be NULL
+*
+* Notes: None
+*/
+static bool get_number(FILE *trace, uint64_t *value)
+{
+        *value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+                int ch = getc(trace);
+                if (ch == EOF) {
+                        return false;
+                }
+                *value |= (uint64_t)(ch & 0x7F) << shift;
+                if ((ch & 0x80) == 0) {
+                        return true;
+                }
+        }
+        return false;
+}
+
+/* put_event
+*
+* Append an event to the trace
+*
+* Parameters:
+*      FILE *trace:		The trace
+*      Event event:		The event
+*      uint64_t *last:		The instruction count of the previous event,
+*                               updated
+*
+* Returns: None
+* Expects: trace and last cannot be NULL
+*
+* Notes: None
+*/
+static void put_event(FILE *trace, Event event, uint64_t *last)
+{
+        putc(event.tag, trace);
+        put_number(trace, event.at - *last);
+        *last = event.at;
+        if (event.tag == TRACE_INPUT) {
+                putc((int)event.data, trace);
+        } else if (event.tag != TRACE_EOF) {
+                for (int i = 0; i < 4; i++) {
+                        putc((int)(event.data >> (8 * i)) & 0xFF, trace);
+                }
+        }
+}
+
+/* get_event
+*
+* Read the next event of the trace
+*
+* Parameters:
+*      FILE *trace:		The trace
+*      Event *event:		Receives the event
+*      uint64_t *last:		The instruction count of the previous event,
+*                               updated
+*
+* Returns: false at the end of the trace or on a damaged event
+* Expects: trace, event and last cannot be NULL
+*
+* Notes: None
+*/
+static bool get_event(FILE *trace, Event *event, uint64_t *last)
+{
+        int tag = getc(trace);
+        uint64_t delta;
+        if (tag < TRACE_INPUT || tag > TRACE_FAULT ||
+            !get_number(trace, &delta)) {
+                return false;
+        }
+        event->tag = (Trace_tag)tag;
+        event->at = *last + delta;
+        *last = event->at;
+        event->data = 0;
+        if (event->tag == TRACE_INPUT) {
+                int ch = getc(trace);
+                event->data = (uint32_t)ch;
+                return ch != EOF;
+        }
+        if (event->tag == TRACE_EOF) {
+                return true;
+        }
+        for (int i = 0; i < 4; i++) {
+                int ch = getc(trace);
+                if (ch == EOF) {
+                        return false;
+                }
+                event->data |= (uint32_t)ch << (8 * i);
+        }
+        return true;
+}
+
+/* describe
+*
+* Write an event in words, for the report of a divergence
+*
+* Parameters:
+*      Event event:		The event
+*      char *text:		Receives the text
+*      size_t size:		The room in text
+*
+* Returns: None
+* Expects: text cannot be NULL
+*
+* Notes: None
+*/
+static void describe(Event event, char *text, size_t size)
+{
+        switch (event.tag) {
+        case TRACE_INPUT:
+        case TRACE_EOF:
+                snprintf(text, size, "input at instruction %" PRIu64,
+                         event.at);
+                break;
+        case TRACE_CHECK:
+                snprintf(text, size, "checksum %08" PRIx32 " at instruction"
+                         " %" PRIu64, event.data, event.at);
+                break;
+        case TRACE_HALT:
+                snprintf(text, size, "halt at instruction %" PRIu64,
+                         event.at);
+                break;
+        default:
+                snprintf(text, size, "fault at instruction %" PRIu64,
+                         event.at);
+                break;
+        }
+}
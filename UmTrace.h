@@ -0,0 +1,26 @@
+/*
+ *     UmTrace.h
+ *     by Elisa and Cynthia, 04/10/2025
+ *     Project 6 - um
+ *
+ *     Declarations for the UmTrace module, which records a run of a UM to
+ *     a trace file and replays it. The trace holds every input byte with
+ *     the instruction count it was read at, and a checksum of the registers
+ *     and the program counter every period instructions, so a run whose
+ *     input is gone can be run again exactly, and two builds of the UM can
+ *     be compared checkpoint by checkpoint.
+ */
+#ifndef UMTRACE_INCLUDED
+#define UMTRACE_INCLUDED
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "um.h"
+
+bool trace_record(UM_T um, FILE *input, FILE *output, FILE *trace,
+                  uint64_t period);
+
+bool trace_replay(UM_T um, FILE *output, FILE *trace);
+
+#endif
@@ -0,0 +1,47 @@
+/*
+ *     decode.c
+ *     by Elisa and Cynthia, 04/10/2025
+ *     Project 6 - um
+ *
+ *     This is the implementation of the decode module, which pre-decodes 
+ *     whole program segments. A peephole pass then replaces the first 
+ *     record of common instruction pairs with a superinstruction, so the 
+ *     loop dispatches once for both.
+ */
+
+#include "decode.h"
+#include <assert.h>
+#include <stddef.h>
+
+/* decode_program
+*
+* Decode every word of a program segment into the matching record of code
+*
+* Parameters:
+*      const uint32_t *words:	The words of the program segment
+*      unsigned length:		The number of words in the segment
+*      Um_decoded *code:	The array receiving the decoded records
+*
+* Returns: None
+* Expects: code has room for length + 1 records
+*
+* Notes: CRE if words or code is NULL
+* Fused records keep the plain record of the second instruction after them,
+* so a jump to the second instruction still runs it alone. code[length] is 
+* set to an illegal instruction, which never fuses, so decode_patch needs 
+* no bounds check.
+*/
+void decode_program(const uint32_t *words, unsigned length, Um_decoded *code)
+{
+        assert(code != NULL);
+        assert(length == 0 || words != NULL);
+        for (unsigned i = 0; i < length; i++) {
+                code[i] = decode_word(words[i]);
+        }
+        code[length] = decode_word(0xFFFFFFFF);
+
+        /* code[i + 1] is still plain when record i is fused */
+        for (unsigned i = 0; i < length; i++) {
+                code[i].opcode = fuse(code[i], code[i + 1].opcode);
+        }
+}
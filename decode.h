@@ -0,0 +1,185 @@
+/*
+ *     decode.h
+ *     by Elisa and Cynthia, 04/10/2025
+ *     Project 6 - um
+ *
+ *     Declarations for the decode module, which owns the UM instruction 
+ *     format. It turns 32-bit instruction words into compact pre-decoded 
+ *     records so that the execution loop does no bit extraction, and fuses
+ *     common pairs of instructions into superinstructions.
+ */
+#ifndef DECODE_INCLUDED
+#define DECODE_INCLUDED
+
+#include <stdint.h>
+
+/* declare the opcodes, each represents a instruction */
+typedef enum Um_opcode {
+        CMOV = 0, SLOAD, SSTORE, ADD, MUL, DIV,
+        NAND, HALT, ACTIVATE, INACTIVATE, OUT, IN, LOADP, LV,
+
+        /* 
+         * Superinstructions, only found in pre-decoded programs. The record
+         * holds the operands of the first instruction; the second one is 
+         * the plain record that follows it.
+         */
+        FUSED_FIRST = 16,
+        LV_ADD = FUSED_FIRST,   /* LV then ADD */
+        NOT_NAND,               /* NAND r, x, x (NOT) then NAND */
+        LV_LOADP,               /* LV then LOADP, a computed jump */
+        LV_OUT,                 /* LV then OUT, printing a character */
+        FUSED_END
+} Um_opcode;
+
+/* 
+ * A pre-decoded instruction. For LV, a is the register and value the 
+ * immediate; for every other opcode a, b and c are the register numbers.
+ */
+typedef struct Um_decoded {
+        uint8_t opcode;
+        uint8_t a, b, c;
+        uint32_t value;
+} Um_decoded;
+
+/* decode_word
+*
+* Decode a single instruction word
+*
+* Parameters:
+*      uint32_t word:		The instruction word
+*
+* Returns: the decoded record
+* Expects: None
+*
+* Notes: Opcodes 14 and 15 are kept as they are, the loop treats them as 
+* illegal instructions. Defined here so the loop can inline it when SSTORE 
+* writes to $m[0].
+*/
+static inline Um_decoded decode_word(uint32_t word)
+{
+        Um_decoded ins;
+        ins.opcode = word >> 28;
+        if (ins.opcode == LV) {
+                ins.a = (word >> 25) & 0x7;
+                ins.b = 0;
+                ins.c = 0;
+                ins.value = word & 0x1FFFFFF;
+        } else {
+                ins.a = (word >> 6) & 0x7;
+                ins.b = (word >> 3) & 0x7;
+                ins.c = word & 0x7;
+                ins.value = 0;
+        }
+        return ins;
+}
+
+/* plain_opcode
+*
+* Recover the opcode of the first instruction of a record
+*
+* Parameters:
+*      uint8_t opcode:		The opcode of a pre-decoded record
+*
+* Returns: the opcode itself, or the first opcode of a superinstruction
+* Expects: None
+*
+* Notes: None
+*/
+static inline uint8_t plain_opcode(uint8_t opcode)
+{
+        if (opcode < FUSED_FIRST) {
+                return opcode;
+        }
+        return opcode == NOT_NAND ? NAND : LV;
+}
+
+/* opcode_name
+*
+* Return the mnemonic of a plain opcode
+*
+* Parameters:
+*      unsigned opcode:		The opcode
+*
+* Returns: the name, "ILLEGAL" for opcodes 14 and 15
+* Expects: None
+*
+* Notes: Used by the profile reports and the fault reports
+*/
+static inline const char *opcode_name(unsigned opcode)
+{
+        static const char *const names[LV + 2] = {
+                "CMOV", "SLOAD", "SSTORE", "ADD", "MUL", "DIV", "NAND", 
+                "HALT", "ACTIVATE", "INACTIVATE", "OUT", "IN", "LOADP", "LV",
+                "ILLEGAL"
+        };
+        return names[opcode <= LV ? opcode : LV + 1];
+}
+
+/* fuse
+*
+* Choose the opcode of a record given the instruction that follows it
+*
+* Parameters:
+*      Um_decoded first:	The plain record of the instruction
+*      uint8_t second:		The plain opcode of the next instruction
+*
+* Returns: the superinstruction for the pair, or the opcode of first
+* Expects: first is plain
+*
+* Notes: None
+*/
+static inline uint8_t fuse(Um_decoded first, uint8_t second)
+{
+        if (first.opcode == LV) {
+                switch (second) {
+                case ADD:
+                        return LV_ADD;
+                case LOADP:
+                        return LV_LOADP;
+                case OUT:
+                        return LV_OUT;
+                default:
+                        break;
+                }
+        } else if (first.opcode == NAND && first.b == first.c &&
+                   second == NAND) {
+                return NOT_NAND;
+        }
+        return first.opcode;
+}
+
+/* decode_patch
+*
+* Bring a pre-decoded program up to date after one word changed. The word 
+* is decoded again and the fusion pass is re-run on the records that depend
+* on it: its own and the one in front of it.
+*
+* Parameters:
+*      Um_decoded *code:	The program built by decode_program
+*      unsigned address:	The address of the word that changed
+*      uint32_t word:		The new word
+*
+* Returns: None
+* Expects: address is less than the length of the program
+*
+* Notes: 
+* The operands of a record survive fusion, so the neighbours are taken from
+* code itself. Defined here so the loop can inline it when SSTORE writes to
+* $m[0].
+*/
+static inline void decode_patch(Um_decoded *code, unsigned address, 
+                                uint32_t word)
+{
+        Um_decoded plain = decode_word(word);
+        if (address > 0) {
+                Um_decoded prev = code[address - 1];
+                prev.opcode = plain_opcode(prev.opcode);
+                code[address - 1].opcode = fuse(prev, plain.opcode);
+        }
+        plain.opcode = fuse(plain, plain_opcode(code[address + 1].opcode));
+        code[address] = plain;
+}
+
+void decode_program(const uint32_t *words, unsigned length, Um_decoded *code);
+
+#endif
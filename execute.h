@@ -0,0 +1,322 @@
+/*
+ *     execute.h
+ *     by Elisa and Cynthia, 04/10/2025
+ *     Project 6 - um
+ *
+ *     The body of the fast execution loop. um.c includes this file four 
+ *     times, with EXECUTE naming the function to define: once for the normal
+ *     loop, once with UM_PROFILE defined for the profiling loop, whose hooks
+ *     feed a UmProfile_T, once with UM_BOUNDED defined for the loop that 
+ *     stops after an exact number of instructions or before an input, and 
+ *     once with UM_SLICED defined for the checked loop behind um_run, 
+ *     fetch_decode_execute_checked and fetch_decode_execute_to_load, which 
+ *     checks its budget at LOADPs and turns failures into UM_FAULT. The 
+ *     hooks and the checks compile to nothing in the normal loop, so it 
+ *     pays nothing for them.
+ *
+ *     It is not a header of its own; it relies on the struct, the dispatch 
+ *     macros and the helpers that um.c defines before including it.
+ */
+
+#ifdef UM_PROFILE
+#define PROFILE(call) (call)
+#else
+#define PROFILE(call) ((void)0)
+#endif
+
+#ifdef UM_BOUNDED
+#define BOUNDED(statement) statement
+#else
+#define BOUNDED(statement)
+#endif
+
+/* 
+ * The sliced loop faults instead of failing an assertion. LOADP is the only
+ * jump, so the instructions of a run are counted from the program counter
+ * when it ends, and the budget is only looked at between runs.
+ */
+#ifdef UM_SLICED
+#define SLICED(statement) statement
+#define CHECK(condition, message) do {                                   \
+        if (!(condition)) {                                              \
+                um->fault = (message);                                   \
+                goto fault;                                              \
+        }                                                                \
+} while (0)
+
+/* 
+ * spend the budget once the program just loaded is long enough, so the loop
+ * stops in front of its first instruction (see fetch_decode_execute_to_load)
+ */
+#define LOAD_STOP() do {                                                 \
+        if (um->load_stop != 0 &&                                        \
+            table->entries[0].length >= um->load_stop) {                 \
+                budget = 0;                                              \
+        }                                                                \
+} while (0)
+#else
+#define SLICED(statement)
+#define CHECK(condition, message) ((void)0)
+#endif
+
+/* 
+ * segment id is mapped, and offset is one of its words; an unmapped entry 
+ * has length 0
+ */
+#define MAPPED(id) ((id) < table->capacity && table->entries[(id)].base != NULL)
+#define IN_BOUNDS(id, offset) \
+        ((id) < table->capacity && (offset) < table->entries[(id)].length)
+
+/* 
+ * count the instruction at pc before it is fetched, and stop in front of it
+ * when the budget is spent
+ */
+#define FETCH_HOOK() do {                                                \
+        PROFILE(profile_instruction(prof, pc,                            \
+                                    plain_opcode(code[pc].opcode)));     \
+        BOUNDED(if (budget-- == 0) goto stop;)                           \
+} while (0)
+
+/* EXECUTE
+*
+* Run the program in $m[0] from the program counter of the UM until it halts
+* or, in the bounded and sliced loops, until it is stopped
+*
+* Parameters:
+*      UM um:			The UM to be executed
+*      UmProfile_T prof:	The profile to feed, only used by the profiling
+*                               loop
+*      uint64_t budget:		The number of instructions to run before 
+*                               stopping, used by the bounded and sliced 
+*                               loops
+*      bool on_input:		In the bounded loop, whether to stop in front
+*                               of the first input instruction; in the sliced
+*                               loop, whether to stop in front of an input 
+*                               instruction when no input is ready
+*
+* Returns: UM_HALTED, or why the bounded or sliced loop stopped
+* Expects: The UM cannot be NULL, prof cannot be NULL in the profiling loop
+*
+* Notes: 
+* See fetch_decode_execute. When the loop stops, the registers and the 
+* program counter of the next instruction are written back to the UM, so 
+* running it again continues the program. A stop between the two halves of 
+* a superinstruction leaves the program counter on the plain record of the 
+* second one. On a fault the program counter is left on the failing 
+* instruction; every loop faults when ACTIVATE hits the memory limit (see 
+* seg_set_limit), only the sliced loop checks for the other failures. 
+* Segmented loads and stores index the segment table inline; stores into a 
+* forked memory go through seg_store, which copies shared segments. Labels
+* as values are a GNU extension, hence the pedantic warnings are silenced 
+* for this function only.
+*/
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+static Um_status EXECUTE(UM_T um, UmProfile_T prof, uint64_t budget, 
+                         bool on_input)
+{
+#ifndef UM_PROFILE
+        (void)prof;
+#endif
+#if !defined(UM_BOUNDED) && !defined(UM_SLICED)
+        (void)on_input;
+        (void)budget;
+#endif
+        Um_status status = UM_BUDGET;
+        uint32_t r[REGISTERS];
+        memcpy(r, um->registers, sizeof(r));
+        uint32_t pc = um->program_counter;
+        SegMem_T seg_mem = um->seg_mem;
+        const SegTable *table = seg_table(seg_mem);
+        const bool forked = seg_forked(seg_mem);
+        SLICED(uint32_t run = pc;)      /* where the current run started */
+        SLICED(uint64_t ran = 0;)       /* instructions of finished runs */
+
+        /* pre-decoded $m[0]; only LOADP can move it */
+        const Um_decoded *code = um->code;
+        const Um_decoded *ins;
+        uint32_t a, b, c;
+        uint32_t id;
+
+#ifdef UM_COMPUTED_GOTO
+        /* 
+         * one label per opcode; the two unused opcodes are illegal, then 
+         * come the superinstructions
+         */
+        static const void *const dispatch_table[FUSED_END] = {
+                &&op_cmov, &&op_sload, &&op_sstore, &&op_add, &&op_mul,
+                &&op_div, &&op_nand, &&op_halt, &&op_activate, 
+                &&op_inactivate, &&op_out, &&op_in, &&op_loadp, &&op_lv,
+                &&op_illegal, &&op_illegal,
+                &&op_lv_add, &&op_not_nand, &&op_lv_loadp, &&op_lv_out
+        };
+        DISPATCH();
+#else
+        for (;;) {
+                FETCH_DECODE();
+                switch (ins->opcode) {
+#endif
+        OPCODE(CMOV, op_cmov)
+                if (r[c] != 0) {
+                        r[a] = r[b];
+                }
+                NEXT;
+        OPCODE(SLOAD, op_sload)
+                CHECK(IN_BOUNDS(r[b], r[c]), "segmented load out of bounds");
+                r[a] = table->entries[r[b]].base[r[c]];
+                NEXT;
+        OPCODE(SSTORE, op_sstore)
+                CHECK(IN_BOUNDS(r[a], r[b]), "segmented store out of bounds");
+                if (forked) {
+                        seg_store(seg_mem, r[a], r[b], r[c]);
+                } else {
+                        table->entries[r[a]].base[r[b]] = r[c];
+                }
+                if (r[a] == 0) {
+                        /* self-modifying code: keep the cache in sync */
+                        code = own_code(um);
+                        decode_patch(um->code, r[b], r[c]);
+                }
+                NEXT;
+        OPCODE(ADD, op_add)
+                r[a] = r[b] + r[c];
+                NEXT;
+        OPCODE(MUL, op_mul)
+                r[a] = r[b] * r[c];
+                NEXT;
+        OPCODE(DIV, op_div)
+                CHECK(r[c] != 0, "division by zero");
+                r[a] = r[b] / r[c];
+                NEXT;
+        OPCODE(NAND, op_nand)
+                r[a] = ~(r[b] & r[c]);
+                NEXT;
+        OPCODE(HALT, op_halt)
+                SLICED(um->instructions += ran + (pc - run);)
+                umio_flush(um->io);
+                memcpy(um->registers, r, sizeof(r));
+                um->program_counter = pc;
+                return UM_HALTED;
+        OPCODE(ACTIVATE, op_activate)
+                PROFILE(profile_map(prof, r[c]));
+                id = map_seg(seg_mem, r[c]);
+                if (id == 0) {
+                        /* even the normal loop stops on a memory limit */
+                        um->fault = "memory limit exceeded";
+                        goto fault;
+                }
+                r[b] = id;
+                NEXT;
+        OPCODE(INACTIVATE, op_inactivate)
+                PROFILE(profile_unmap(prof));
+                CHECK(r[c] != 0 && MAPPED(r[c]), 
+                      "unmap of segment 0 or of an unmapped segment");
+                unmap_seg(seg_mem, r[c]);
+                NEXT;
+        OPCODE(OUT, op_out)
+                CHECK(r[c] <= 255, "output value above 255");
+                umio_put(um->io, r[c]);
+                NEXT;
+        OPCODE(IN, op_in)
+                BOUNDED(if (on_input) { 
+                        pc--; 
+                        status = UM_WAITING; 
+                        goto stop; 
+                })
+                SLICED(if (on_input && !umio_ready(um->io)) { 
+                        pc--; 
+                        status = UM_WAITING; 
+                        goto stop; 
+                })
+                r[c] = umio_get(um->io);
+                NEXT;
+        OPCODE(LOADP, op_loadp)
+                CHECK(IN_BOUNDS(r[b], r[c]), "jump outside the program");
+                PROFILE(profile_loadp(prof, r[b] != 0));
+                if (r[b] != 0) {
+                        loadp_helper(r[b], um);
+                        predecode(um);
+                        code = um->code;
+                        SLICED(LOAD_STOP();)
+                }
+                SLICED(ran += pc - run;)
+                pc = r[c];
+                SLICED(run = pc; if (ran >= budget) goto stop;)
+                NEXT;
+        OPCODE(LV, op_lv)
+                r[a] = ins->value;
+                NEXT;
+        OPCODE(LV_ADD, op_lv_add)
+                FUSION_FIRED(LV_ADD);
+                r[a] = ins->value;
+                FETCH_HOOK();
+                ins = &code[pc++];
+                r[ins->a] = r[ins->b] + r[ins->c];
+                NEXT;
+        OPCODE(NOT_NAND, op_not_nand)
+                FUSION_FIRED(NOT_NAND);
+                r[a] = ~r[b];
+                FETCH_HOOK();
+                ins = &code[pc++];
+                r[ins->a] = ~(r[ins->b] & r[ins->c]);
+                NEXT;
+        OPCODE(LV_LOADP, op_lv_loadp)
+                FUSION_FIRED(LV_LOADP);
+                r[a] = ins->value;
+                FETCH_HOOK();
+                ins = &code[pc++];
+                CHECK(IN_BOUNDS(r[ins->b], r[ins->c]), 
+                      "jump outside the program");
+                PROFILE(profile_loadp(prof, r[ins->b] != 0));
+                if (r[ins->b] != 0) {
+                        loadp_helper(r[ins->b], um);
+                        predecode(um);
+                        code = um->code;
+                        SLICED(LOAD_STOP();)
+                }
+                SLICED(ran += pc - run;)
+                pc = r[ins->c];
+                SLICED(run = pc; if (ran >= budget) goto stop;)
+                NEXT;
+        OPCODE(LV_OUT, op_lv_out)
+                FUSION_FIRED(LV_OUT);
+                r[a] = ins->value;
+                FETCH_HOOK();
+                ins = &code[pc++];
+                CHECK(r[ins->c] <= 255, "output value above 255");
+                umio_put(um->io, r[ins->c]);
+                NEXT;
+        OPCODE_ILLEGAL(op_illegal)
+                CHECK(false, "illegal instruction");
+                assert(ins->opcode < OPCODE_NUM);
+                NEXT;
+#ifndef UM_COMPUTED_GOTO
+                }
+        }
+#endif
+fault:
+        pc--;
+        status = UM_FAULT;
+#if defined(UM_BOUNDED) || defined(UM_SLICED)
+stop:
+#endif
+        SLICED(um->instructions += ran + (pc - run);)
+        umio_flush(um->io);
+        memcpy(um->registers, r, sizeof(r));
+        um->program_counter = pc;
+        return status;
+}
+#pragma GCC diagnostic pop
+
+#undef FETCH_HOOK
+#undef IN_BOUNDS
+#undef MAPPED
+#undef LOAD_STOP
+#undef CHECK
+#undef SLICED
+#undef BOUNDED
+#undef PROFILE
+#undef EXECUTE
+#undef UM_SLICED
+#undef UM_BOUNDED
+#undef UM_PROFILE
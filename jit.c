@@ -0,0 +1,688 @@
+/*
+ *     jit.c
+ *     by Elisa and Cynthia, 04/10/2025
+ *     Project 6 - um
+ *
+ *     This is the implementation of the jit module. A basic block starts at
+ *     any address the program jumps to and runs until LOADP, HALT, the end
+ *     of $m[0] or MAX_BLOCK instructions. Each block becomes a native
+ *     function that loads the eight UM registers into host registers, runs
+ *     the block with them pinned there and returns the next program counter.
+ *     Segmented loads and stores index the SegMem segment table inline and,
+ *     like the release interpreter, do no bounds checks; ACTIVATE,
+ *     INACTIVATE, IN and OUT call the SegMem and UmIO routines through small
+ *     helpers. A store into $m[0] drops every block covering the written
+ *     word. LOADP is a lookup in the block table, indexed by address: when
+ *     the target is already translated the block jumps straight into it.
+ */
+
+/* MAP_ANONYMOUS is not part of POSIX */
+#define _DEFAULT_SOURCE
+
+#include "jit.h"
+#include "decode.h"
+#include <assert.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__))
+#define JIT_SUPPORTED 1
+#include <sys/mman.h>
+#endif
+
+#ifdef JIT_SUPPORTED
+
+/* size of the executable code buffer */
+#define CODE_SIZE (32u << 20)
+
+/* maximum number of instructions in a block, and the worst case code size */
+#define MAX_BLOCK 256
+#define MAX_INSTRUCTION_BYTES 256
+#define MAX_BLOCK_BYTES (MAX_BLOCK * MAX_INSTRUCTION_BYTES + 256)
+
+/*
+ * The struct doubles as the context passed to every block: the registers
+ * and the halted flag must stay at the offsets the generated code uses.
+ */
+struct Jit_T {
+        uint32_t regs[8]; /* UM registers while no block is running */
+        uint32_t halted; /* set by the code generated for HALT */
+        uint32_t length; /* length of $m[0] the tables are sized for */
+        unsigned char **entry; /* native code of the block at each address */
+        uint16_t *cover; /* number of blocks covering each word */
+        SegMem_T seg_mem; /* segmented memory of the UM */
+        UmIO_T io; /* I/O device of the UM */
+        unsigned char *code; /* executable code buffer */
+        size_t code_used; /* bytes of the code buffer in use */
+        size_t prologue_size; /* bytes of code before the block body */
+        uint16_t *block_len; /* number of words of the block at an address */
+};
+
+#define CTX_REG(i) (4 * (i))
+#define CTX_HALTED 32
+#define CTX_LENGTH 36
+#define CTX_ENTRY 40
+#define CTX_COVER 48
+
+typedef uint32_t (*Block_fn)(struct Jit_T *ctx);
+
+/* x86-64 register numbers */
+enum { RAX = 0, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+       R8, R9, R10, R11, R12, R13, R14, R15 };
+
+/*
+ * host registers the UM registers are pinned to; r6 and r7 live in
+ * caller-saved registers and are spilled around helper calls
+ */
+static const int HOST[8] = { RBX, RBP, R12, R13, R14, R15, R10, R11 };
+
+/* private helper functions */
+static void reset_tables(Jit_T jit);
+static void flush_code(Jit_T jit);
+static unsigned char *translate(Jit_T jit, uint32_t pc);
+static int invalidate(Jit_T jit, uint32_t addr);
+
+/****************************************************************/
+/*                  helpers called by generated code            */
+/****************************************************************/
+
+/* 
+ * called after a store to a word of $m[0] that translated code covers;
+ * returns non-zero when a block was dropped and the caller must exit 
+ */
+static uint32_t helper_invalidate(Jit_T jit, uint32_t b)
+{
+        return invalidate(jit, b);
+}
+
+static uint32_t helper_activate(Jit_T jit, uint32_t c)
+{
+        return map_seg(jit->seg_mem, c);
+}
+
+static void helper_inactivate(Jit_T jit, uint32_t c)
+{
+        unmap_seg(jit->seg_mem, c);
+}
+
+static void helper_out(Jit_T jit, uint32_t c)
+{
+        umio_put(jit->io, c);
+}
+
+static uint32_t helper_in(Jit_T jit)
+{
+        return umio_get(jit->io);
+}
+
+/* only called when b is not 0; the running block exits right after */
+static void helper_loadp(Jit_T jit, uint32_t b)
+{
+        seg_load_program(jit->seg_mem, b);
+        reset_tables(jit);
+}
+
+/* opcodes 14 and 15; the interpreter treats them the same way */
+static void helper_illegal(Jit_T jit)
+{
+        (void)jit;
+        assert(0);
+}
+
+/****************************************************************/
+/*                      x86-64 code emission                    */
+/****************************************************************/
+
+static inline void emit8(unsigned char **p, unsigned byte)
+{
+        *(*p)++ = (unsigned char)byte;
+}
+
+static inline void emit32(unsigned char **p, uint32_t value)
+{
+        memcpy(*p, &value, sizeof(value));
+        *p += sizeof(value);
+}
+
+static inline void emit64(unsigned char **p, uint64_t value)
+{
+        memcpy(*p, &value, sizeof(value));
+        *p += sizeof(value);
+}
+
+/* REX prefix for a 32-bit operation on reg and rm, if one is needed */
+static inline void emit_rex(unsigned char **p, int reg, int rm)
+{
+        unsigned rex = 0x40 | ((reg >> 3) << 2) | (rm >> 3);
+        if (rex != 0x40) {
+                emit8(p, rex);
+        }
+}
+
+/* register to register operation: [REX] op [op2] modrm */
+static void emit_rr(unsigned char **p, unsigned op, int two_byte,
+                    int reg, int rm)
+{
+        emit_rex(p, reg, rm);
+        if (two_byte) {
+                emit8(p, 0x0F);
+        }
+        emit8(p, op);
+        emit8(p, 0xC0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+/* mov dst, src (32 bit) */
+static void emit_mov(unsigned char **p, int dst, int src)
+{
+        emit_rr(p, 0x89, 0, src, dst);
+}
+
+/* mov dst, imm32 */
+static void emit_mov_imm(unsigned char **p, int dst, uint32_t imm)
+{
+        if (dst >= 8) {
+                emit8(p, 0x41);
+        }
+        emit8(p, 0xB8 + (dst & 7));
+        emit32(p, imm);
+}
+
+/* mov reg, [rdi + disp] or mov [rdi + disp], reg (32 bit) */
+static void emit_ctx(unsigned char **p, unsigned op, int reg, unsigned disp)
+{
+        emit_rex(p, reg, RDI);
+        emit8(p, op);
+        emit8(p, 0x40 | ((reg & 7) << 3) | RDI);
+        emit8(p, disp);
+}
+
+/* 
+ * mov rax, [table entries]; mov rax, [rax + id*16]: address of segment id,
+ * the base of its 16 byte SegEntry
+ */
+static void emit_segment(unsigned char **p, const SegTable *table, int id)
+{
+        emit8(p, 0x48); emit8(p, 0xB8);
+        emit64(p, (uint64_t)(uintptr_t)&table->entries); /* mov rax, imm */
+        emit8(p, 0x48); emit8(p, 0x8B); emit8(p, 0x00); /* mov rax, [rax] */
+        emit_mov(p, RDX, id);                           /* mov edx, id */
+        emit8(p, 0x48); emit8(p, 0xC1); emit8(p, 0xE2);
+        emit8(p, 4);                                    /* shl rdx, 4 */
+        emit8(p, 0x48); emit8(p, 0x8B); emit8(p, 0x04);
+        emit8(p, 0x10);                                 /* mov rax, [rax+rdx] */
+}
+
+/* mov reg, [rax + index*4] (op 0x8B) or mov [rax + index*4], reg (0x89) */
+static void emit_word(unsigned char **p, unsigned op, int reg, int index)
+{
+        unsigned rex = 0x40 | ((reg >> 3) << 2) | ((index >> 3) << 1);
+        if (rex != 0x40) {
+                emit8(p, rex);
+        }
+        emit8(p, op);
+        emit8(p, 0x04 | ((reg & 7) << 3));
+        emit8(p, 0x80 | ((index & 7) << 3));
+}
+
+/* mov rdi, [rsp]: reload the context pointer saved by the prologue */
+static void emit_load_ctx_ptr(unsigned char **p)
+{
+        emit8(p, 0x48); emit8(p, 0x8B); emit8(p, 0x3C); emit8(p, 0x24);
+}
+
+static void emit_prologue(unsigned char **p)
+{
+        emit8(p, 0x53);                                 /* push rbx */
+        emit8(p, 0x55);                                 /* push rbp */
+        emit8(p, 0x41); emit8(p, 0x54);                 /* push r12 */
+        emit8(p, 0x41); emit8(p, 0x55);                 /* push r13 */
+        emit8(p, 0x41); emit8(p, 0x56);                 /* push r14 */
+        emit8(p, 0x41); emit8(p, 0x57);                 /* push r15 */
+        emit8(p, 0x48); emit8(p, 0x83); emit8(p, 0xEC);
+        emit8(p, 0x08);                                 /* sub rsp, 8 */
+        emit8(p, 0x48); emit8(p, 0x89); emit8(p, 0x3C);
+        emit8(p, 0x24);                                 /* mov [rsp], rdi */
+        for (int i = 0; i < 8; i++) {
+                emit_ctx(p, 0x8B, HOST[i], CTX_REG(i));
+        }
+}
+
+/* write the registers back and return, eax holds the next pc */
+static void emit_exit(unsigned char **p)
+{
+        emit_load_ctx_ptr(p);
+        for (int i = 0; i < 8; i++) {
+                emit_ctx(p, 0x89, HOST[i], CTX_REG(i));
+        }
+        emit8(p, 0x48); emit8(p, 0x83); emit8(p, 0xC4);
+        emit8(p, 0x08);                                 /* add rsp, 8 */
+        emit8(p, 0x41); emit8(p, 0x5F);                 /* pop r15 */
+        emit8(p, 0x41); emit8(p, 0x5E);                 /* pop r14 */
+        emit8(p, 0x41); emit8(p, 0x5D);                 /* pop r13 */
+        emit8(p, 0x41); emit8(p, 0x5C);                 /* pop r12 */
+        emit8(p, 0x5D);                                 /* pop rbp */
+        emit8(p, 0x5B);                                 /* pop rbx */
+        emit8(p, 0xC3);                                 /* ret */
+}
+
+/* jcc rel32 with the offset patched later; returns the offset to patch */
+static unsigned char *emit_jcc(unsigned char **p, unsigned cc)
+{
+        emit8(p, 0x0F); emit8(p, cc);
+        unsigned char *patch = *p;
+        emit32(p, 0);
+        return patch;
+}
+
+static unsigned char *emit_jz(unsigned char **p)
+{
+        return emit_jcc(p, 0x84);
+}
+
+/* jumps when ZF is clear; after test r, r that is "r is not 0" */
+static unsigned char *emit_jnz(unsigned char **p)
+{
+        return emit_jcc(p, 0x85);
+}
+
+static void patch_jump(unsigned char *patch, unsigned char *target)
+{
+        int32_t rel = (int32_t)(target - (patch + 4));
+        memcpy(patch, &rel, sizeof(rel));
+}
+
+static void emit_exit_to(unsigned char **p, uint32_t pc)
+{
+        emit_mov_imm(p, RAX, pc);
+        emit_exit(p);
+}
+
+/*
+ * continue at the pc in eax: if that address already has a block, jump
+ * straight past its prologue, keeping the registers pinned; otherwise
+ * return to the dispatcher
+ */
+static void emit_chain(unsigned char **p, size_t prologue_size)
+{
+        unsigned char *miss1, *miss2;
+        emit_load_ctx_ptr(p);
+        emit8(p, 0x3B); emit8(p, 0x47); emit8(p, CTX_LENGTH);
+                                                /* cmp eax, [rdi+length] */
+        miss1 = emit_jcc(p, 0x83);              /* jae miss */
+        emit8(p, 0x48); emit8(p, 0x8B); emit8(p, 0x57);
+        emit8(p, CTX_ENTRY);                    /* mov rdx, [rdi+entry] */
+        emit8(p, 0x48); emit8(p, 0x8B); emit8(p, 0x14);
+        emit8(p, 0xC2);                         /* mov rdx, [rdx+rax*8] */
+        emit8(p, 0x48); emit8(p, 0x85); emit8(p, 0xD2); /* test rdx, rdx */
+        miss2 = emit_jz(p);
+        emit8(p, 0x48); emit8(p, 0x83); emit8(p, 0xC2);
+        emit8(p, prologue_size);                /* add rdx, prologue */
+        emit8(p, 0xFF); emit8(p, 0xE2);         /* jmp rdx */
+        patch_jump(miss1, *p);
+        patch_jump(miss2, *p);
+        emit_exit(p);
+}
+
+/*
+ * call fn(ctx, args...) where the arguments are UM registers; the result,
+ * if any, is left in eax
+ */
+static void emit_call(unsigned char **p, uintptr_t fn, int nargs,
+                      const int *args)
+{
+        static const int ARG[3] = { RSI, RDX, RCX };
+        emit_load_ctx_ptr(p);
+        emit_ctx(p, 0x89, HOST[6], CTX_REG(6));
+        emit_ctx(p, 0x89, HOST[7], CTX_REG(7));
+        for (int i = 0; i < nargs; i++) {
+                emit_mov(p, ARG[i], HOST[args[i]]);
+        }
+        emit8(p, 0x48); emit8(p, 0xB8); emit64(p, fn);  /* mov rax, fn */
+        emit8(p, 0xFF); emit8(p, 0xD0);                 /* call rax */
+        emit_load_ctx_ptr(p);
+        emit_ctx(p, 0x8B, HOST[6], CTX_REG(6));
+        emit_ctx(p, 0x8B, HOST[7], CTX_REG(7));
+}
+
+/****************************************************************/
+/*                          translation                         */
+/****************************************************************/
+
+/* translate
+*
+* Translate the block starting at pc and record it in the block table
+*
+* Parameters:
+*      Jit_T jit:		the JIT
+*      uint32_t pc:		the address of the first instruction
+*
+* Returns: the native code of the block
+* Expects: pc is inside $m[0]
+*
+* Notes: Flushes all translated code when the buffer is nearly full; this
+* is safe because no block is running while the dispatcher translates.
+*/
+static unsigned char *translate(Jit_T jit, uint32_t pc)
+{
+        if (CODE_SIZE - jit->code_used < MAX_BLOCK_BYTES) {
+                flush_code(jit);
+        }
+        const uint32_t *words = seg_words(jit->seg_mem, 0);
+        const SegTable *table = seg_table(jit->seg_mem);
+        unsigned char *start = jit->code + jit->code_used;
+        unsigned char *p = start;
+        uint32_t addr = pc;
+        bool done = false;
+
+        emit_prologue(&p);
+        jit->prologue_size = p - start;
+        while (!done && addr < jit->length && addr - pc < MAX_BLOCK) {
+                Um_decoded ins = decode_word(words[addr]);
+                int ra = HOST[ins.a], rb = HOST[ins.b], rc = HOST[ins.c];
+                int abc[3] = { ins.a, ins.b, ins.c };
+                unsigned char *skip, *skip2, *skip3;
+                addr++;
+
+                switch (ins.opcode) {
+                case CMOV:
+                        emit_rr(&p, 0x85, 0, rc, rc);   /* test rc, rc */
+                        emit_rr(&p, 0x45, 1, ra, rb);   /* cmovne ra, rb */
+                        break;
+                case SLOAD:
+                        emit_segment(&p, table, rb);
+                        emit_word(&p, 0x8B, ra, rc);
+                        break;
+                case SSTORE:
+                        emit_segment(&p, table, ra);
+                        emit_word(&p, 0x89, rc, rb);
+                        /* did the store hit translated code in $m[0]? */
+                        emit_rr(&p, 0x85, 0, ra, ra);   /* test ra, ra */
+                        skip = emit_jnz(&p);
+                        emit_load_ctx_ptr(&p);
+                        emit8(&p, 0x48); emit8(&p, 0x8B); emit8(&p, 0x57);
+                        emit8(&p, CTX_COVER);   /* mov rdx, [rdi+cover] */
+                        emit8(&p, 0x66);
+                        if (rb >= 8) {
+                                emit8(&p, 0x42);
+                        }
+                        emit8(&p, 0x83); emit8(&p, 0x3C);
+                        emit8(&p, 0x40 | ((rb & 7) << 3) | RDX);
+                        emit8(&p, 0);           /* cmp word [rdx+rb*2], 0 */
+                        skip2 = emit_jz(&p);
+                        emit_call(&p, (uintptr_t)helper_invalidate, 1,
+                                  abc + 1);
+                        emit_rr(&p, 0x85, 0, RAX, RAX);
+                        skip3 = emit_jz(&p);
+                        emit_exit_to(&p, addr);
+                        patch_jump(skip, p);
+                        patch_jump(skip2, p);
+                        patch_jump(skip3, p);
+                        break;
+                case ADD:
+                        emit_mov(&p, RAX, rb);
+                        emit_rr(&p, 0x01, 0, rc, RAX);  /* add eax, rc */
+                        emit_mov(&p, ra, RAX);
+                        break;
+                case MUL:
+                        emit_mov(&p, RAX, rb);
+                        emit_rr(&p, 0xAF, 1, RAX, rc);  /* imul eax, rc */
+                        emit_mov(&p, ra, RAX);
+                        break;
+                case DIV:
+                        emit_mov(&p, RAX, rb);
+                        emit8(&p, 0x31); emit8(&p, 0xD2); /* xor edx, edx */
+                        emit_rr(&p, 0xF7, 0, 6, rc);    /* div rc */
+                        emit_mov(&p, ra, RAX);
+                        break;
+                case NAND:
+                        emit_mov(&p, RAX, rb);
+                        emit_rr(&p, 0x21, 0, rc, RAX);  /* and eax, rc */
+                        emit8(&p, 0xF7); emit8(&p, 0xD0); /* not eax */
+                        emit_mov(&p, ra, RAX);
+                        break;
+                case HALT:
+                        emit_load_ctx_ptr(&p);
+                        emit8(&p, 0xC7); emit8(&p, 0x47);
+                        emit8(&p, CTX_HALTED); emit32(&p, 1);
+                        emit_exit_to(&p, addr);
+                        done = true;
+                        break;
+                case ACTIVATE:
+                        emit_call(&p, (uintptr_t)helper_activate, 1, abc + 2);
+                        emit_mov(&p, rb, RAX);
+                        break;
+                case INACTIVATE:
+                        emit_call(&p, (uintptr_t)helper_inactivate, 1,
+                                  abc + 2);
+                        break;
+                case OUT:
+                        emit_call(&p, (uintptr_t)helper_out, 1, abc + 2);
+                        break;
+                case IN:
+                        emit_call(&p, (uintptr_t)helper_in, 0, NULL);
+                        emit_mov(&p, rc, RAX);
+                        break;
+                case LOADP:
+                        emit_rr(&p, 0x85, 0, rb, rb);   /* test rb, rb */
+                        skip = emit_jz(&p);
+                        emit_call(&p, (uintptr_t)helper_loadp, 1, abc + 1);
+                        patch_jump(skip, p);
+                        emit_mov(&p, RAX, rc);
+                        emit_chain(&p, jit->prologue_size);
+                        done = true;
+                        break;
+                case LV:
+                        emit_mov_imm(&p, ra, ins.value);
+                        break;
+                default:
+                        emit_call(&p, (uintptr_t)helper_illegal, 0, NULL);
+                        break;
+                }
+                assert((size_t)(p - start)
+                       <= (addr - pc) * MAX_INSTRUCTION_BYTES + 128);
+        }
+        if (!done) {
+                emit_mov_imm(&p, RAX, addr);
+                emit_chain(&p, jit->prologue_size);
+        }
+
+        jit->code_used += p - start;
+        jit->entry[pc] = start;
+        jit->block_len[pc] = addr - pc;
+        for (uint32_t i = pc; i < addr; i++) {
+                jit->cover[i]++;
+        }
+        return start;
+}
+
+/* invalidate
+*
+* Drop every block that contains the word at addr
+*
+* Parameters:
+*      Jit_T jit:		the JIT
+*      uint32_t addr:		the address written in $m[0]
+*
+* Returns: 1 if a block was dropped, 0 otherwise
+* Expects: None
+*
+* Notes: Only blocks starting in the MAX_BLOCK words up to addr can cover
+* it. Their code stays in the buffer until the next flush, so a block that
+* drops itself can still run to its exit.
+*/
+static int invalidate(Jit_T jit, uint32_t addr)
+{
+        if (addr >= jit->length || jit->cover[addr] == 0) {
+                return 0;
+        }
+        uint32_t lo = addr >= MAX_BLOCK - 1 ? addr - (MAX_BLOCK - 1) : 0;
+        for (uint32_t s = lo; s <= addr; s++) {
+                if (jit->entry[s] != NULL && s + jit->block_len[s] > addr) {
+                        for (uint32_t i = s; i < s + jit->block_len[s]; i++) {
+                                jit->cover[i]--;
+                        }
+                        jit->entry[s] = NULL;
+                }
+        }
+        return 1;
+}
+
+/* reset_tables
+*
+* Resize the block tables to the current length of $m[0] and empty them
+*/
+static void reset_tables(Jit_T jit)
+{
+        jit->length = seg_length(jit->seg_mem, 0);
+        size_t n = (size_t)jit->length + 1;
+        free(jit->entry);
+        free(jit->block_len);
+        free(jit->cover);
+        jit->entry = calloc(n, sizeof(*jit->entry));
+        jit->block_len = calloc(n, sizeof(*jit->block_len));
+        jit->cover = calloc(n, sizeof(*jit->cover));
+        assert(jit->entry != NULL && jit->block_len != NULL
+               && jit->cover != NULL);
+}
+
+/* flush_code
+*
+* Forget every translated block and reuse the whole code buffer
+*/
+static void flush_code(Jit_T jit)
+{
+        size_t n = (size_t)jit->length + 1;
+        memset(jit->entry, 0, n * sizeof(*jit->entry));
+        memset(jit->block_len, 0, n * sizeof(*jit->block_len));
+        memset(jit->cover, 0, n * sizeof(*jit->cover));
+        jit->code_used = 0;
+}
+
+/****************************************************************/
+/*                          public API                          */
+/****************************************************************/
+
+/* jit_new
+*
+* Create a JIT for the program in $m[0] of seg_mem
+*
+* Parameters:
+*      SegMem_T seg_mem:	the segmented memory of the UM
+*      UmIO_T io:		the I/O device of the UM
+*
+* Returns: a new Jit_T, or NULL if executable memory is not available or 
+*          seg_mem is forked or has a memory limit
+* Expects: seg_mem and io cannot be NULL
+*
+* Notes: The JIT is freed with jit_free(). Forked memories are left to the 
+* interpreter, since the inlined stores do not copy shared segments, and so
+* are limited ones, since translated code cannot stop on a failed ACTIVATE.
+*/
+Jit_T jit_new(SegMem_T seg_mem, UmIO_T io)
+{
+        assert(seg_mem != NULL);
+        assert(io != NULL);
+        if (seg_forked(seg_mem) || seg_usage(seg_mem).limit != 0) {
+                return NULL;
+        }
+        /* emit_segment indexes the table with this layout */
+        assert(sizeof(SegEntry) == 16 && offsetof(SegEntry, base) == 0);
+        void *code = mmap(NULL, CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (code == MAP_FAILED) {
+                return NULL;
+        }
+        Jit_T jit = calloc(1, sizeof(*jit));
+        assert(jit != NULL);
+        jit->seg_mem = seg_mem;
+        jit->io = io;
+        jit->code = code;
+        jit->code_used = 0;
+        reset_tables(jit);
+        return jit;
+}
+
+/* jit_run
+*
+* Run the program in $m[0] until it halts
+*
+* Parameters:
+*      Jit_T jit:			the JIT
+*      uint32_t registers[8]:		the UM registers, updated in place
+*      uint32_t *program_counter:	the program counter, updated in place
+*
+* Returns: None
+* Expects: jit, registers and program_counter cannot be NULL
+*
+* Notes: CRE if the program counter leaves $m[0]
+*/
+void jit_run(Jit_T jit, uint32_t registers[8], uint32_t *program_counter)
+{
+        assert(jit != NULL);
+        memcpy(jit->regs, registers, sizeof(jit->regs));
+        jit->halted = 0;
+        uint32_t pc = *program_counter;
+
+        while (!jit->halted) {
+                assert(pc < jit->length);
+                unsigned char *code = jit->entry[pc];
+                if (code == NULL) {
+                        code = translate(jit, pc);
+                }
+                Block_fn block;
+                memcpy(&block, &code, sizeof(block));
+                pc = block(jit);
+        }
+
+        memcpy(registers, jit->regs, sizeof(jit->regs));
+        *program_counter = pc;
+}
+
+/* jit_free
+*
+* Deallocate the JIT and its code buffer
+*
+* Parameters:
+*      Jit_T jit:		the JIT
+*
+* Returns: None
+* Expects: jit cannot be NULL
+*
+* Notes: None
+*/
+void jit_free(Jit_T jit)
+{
+        assert(jit != NULL);
+        munmap(jit->code, CODE_SIZE);
+        free(jit->entry);
+        free(jit->block_len);
+        free(jit->cover);
+        free(jit);
+}
+
+#else
+
+/* unsupported host: callers fall back to the interpreter */
+
+Jit_T jit_new(SegMem_T seg_mem, UmIO_T io)
+{
+        (void)seg_mem;
+        (void)io;
+        return NULL;
+}
+
+void jit_run(Jit_T jit, uint32_t registers[8], uint32_t *program_counter)
+{
+        (void)jit;
+        (void)registers;
+        (void)program_counter;
+        assert(0);
+}
+
+void jit_free(Jit_T jit)
+{
+        (void)jit;
+}
+
+#endif
@@ -0,0 +1,30 @@
+/*
+ *     jit.h
+ *     by Elisa and Cynthia, 04/10/2025
+ *     Project 6 - um
+ *
+ *     Declarations for the jit module, a template JIT compiler that
+ *     translates basic blocks of $m[0] into x86-64 machine code. It is an
+ *     alternative to the interpreter loop in um.c; on hosts it does not
+ *     support jit_new() returns NULL and the caller falls back to the
+ *     interpreter.
+ */
+#ifndef JIT_INCLUDED
+#define JIT_INCLUDED
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "SegMem.h"
+#include "UmIO.h"
+
+#define T Jit_T
+typedef struct T *T;
+
+T jit_new(SegMem_T seg_mem, UmIO_T io);
+
+void jit_run(T jit, uint32_t registers[8], uint32_t *program_counter);
+
+void jit_free(T jit);
+
+#undef T
+#endif
@@ -5,38 +5,577 @@
  *
  *     This file includes a main function that initialize and execute the UM 
  *     class according the instructions stored in the provided files.
+ *
+ *     With --cache=DIR, a self-decompressing image (sandmark.umz, advent.umz,
+ *     codex.umz) is unpacked once: the UM is saved when the first LOADP 
+ *     installs a program at least as long as the image, and the next run of
+ *     the same image restores that snapshot instead of unpacking again.
+ *
+ *     With --record=TRACE the run is recorded with its input (see UmTrace.h)
+ *     and --replay=TRACE runs it again from the trace, checking that it 
+ *     takes the same path.
  */
 
+/* fileno, read, getpid and mkdir are POSIX */
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include "um.h"
+#include "UmTrace.h"
+
+/* 
+ * The output of a run that may fill the cache. Until the program is 
+ * unpacked its output is kept too, since a run from the cache must print it
+ * again; a program that reads input first is not cached.
+ */
+typedef struct Capture {
+        int input; /* descriptor of the input */
+        FILE *output;
+        bool read; /* the program asked for input */
+        bool recording; /* the output is kept in bytes */
+        unsigned char *bytes;
+        size_t length, capacity;
+} Capture;
+
+/* longest path of a cache file */
+#define CACHE_PATH 4096
+
+/* instructions between the checkpoints of a recorded trace by default */
+#define TRACE_PERIOD (1u << 24)
+
+static void usage(const char *program)
+{
+        fprintf(stderr, "Usage: %s [--jit | --checked | "
+                "--profile[=report.json] | "
+                "--snapshot-at=<icount|on-input> out.ums] "
+                "[--cache=<dir>] "
+                "[--record=<trace> [--trace-period=<n>] | "
+                "--replay=<trace>] "
+                "[--max-memory=<bytes>[K|M|G]] [--memory-stats] "
+                "{<instructions_file> | --restore <snapshot.ums>}\n", 
+                program);
+}
+
+/* print_memory
+*
+* Write the memory usage of the UM to stderr
+*
+* Parameters:
+*      UM_T um:			The UM
+*
+* Returns: None
+* Expects: um cannot be NULL
+*
+* Notes: See seg_usage for what is counted
+*/
+static void print_memory(UM_T um)
+{
+        SegMem_usage usage = seg_usage(um_seg_mem(um));
+        fprintf(stderr, "UM memory\n");
+        fprintf(stderr, "segments %u, %zu bytes\n", usage.segments, 
+                usage.mapped_bytes);
+        fprintf(stderr, "pooled %zu bytes, arenas %zu bytes, table %zu "
+                "bytes\n", usage.pooled_bytes, usage.arena_bytes, 
+                usage.table_bytes);
+        fprintf(stderr, "peak %zu bytes", usage.peak_bytes);
+        if (usage.limit != 0) {
+                fprintf(stderr, " (limit %zu)", usage.limit);
+        }
+        fprintf(stderr, "\n");
+}
+
+/* take_snapshot
+*
+* Run the UM until the snapshot point, write the snapshot to the file at 
+* path, then let the program continue
+*
+* Parameters:
+*      UM_T um:			The UM to be executed
+*      uint64_t instructions:	The number of instructions to run first
+*      bool on_input:		Whether to snapshot in front of the first 
+*                               input instead
+*      const char *path:	The path of the snapshot file
+*
+* Returns: true if the snapshot was written
+* Expects: um and path cannot be NULL
+*
+* Notes: No snapshot is written if the program halts before the point
+*/
+static bool take_snapshot(UM_T um, uint64_t instructions, bool on_input,
+                          const char *path)
+{
+        if (!fetch_decode_execute_until(um, instructions, on_input)) {
+                if (um_fault(um) == NULL) {
+                        fprintf(stderr, "Program halted before the snapshot "
+                                "point, no snapshot written\n");
+                }
+                return false;
+        }
+        FILE *snapshot = fopen(path, "wb");
+        bool ok = snapshot != NULL && um_snapshot(um, snapshot);
+        if (snapshot != NULL && fclose(snapshot) != 0) {
+                ok = false;
+        }
+        if (!ok) {
+                fprintf(stderr, "Error writing snapshot %s\n", path);
+        }
+        fetch_decode_execute(um);
+        return ok;
+}
+
+/* run_profile
+*
+* Run the UM with the profiling loop, then write the text report to stderr 
+* and the JSON report to the file at path
+*
+* Parameters:
+*      UM_T um:			The UM to be executed
+*      const char *path:	The path of the JSON report
+*
+* Returns: None
+* Expects: um and path cannot be NULL
+*
+* Notes: If the JSON file cannot be opened only the text report is written
+*/
+static void run_profile(UM_T um, const char *path)
+{
+        UmProfile_T prof = profile_new();
+        fetch_decode_execute_profile(um, prof);
+
+        FILE *json = fopen(path, "w");
+        if (json == NULL) {
+                fprintf(stderr, "Error opening profile report %s\n", path);
+        }
+        SegMem_T seg_mem = um_seg_mem(um);
+        profile_allocations(prof, seg_allocations(seg_mem));
+        profile_report(prof, seg_words(seg_mem, 0), seg_length(seg_mem, 0),
+                       stderr, json);
+        if (json != NULL) {
+                fclose(json);
+        }
+        profile_free(prof);
+}
+
+/* run_trace
+*
+* Record the run of the UM to the trace file at path, or replay it from 
+* the trace
+*
+* Parameters:
+*      UM_T um:			The UM to be executed
+*      const char *path:	The path of the trace file
+*      bool record:		Whether to record rather than replay
+*      uint64_t period:		The instructions between checkpoints of a 
+*                               recording
+*
+* Returns: true if the trace was written, or the replay matched it
+* Expects: um and path cannot be NULL
+*
+* Notes: See trace_record and trace_replay
+*/
+static bool run_trace(UM_T um, const char *path, bool record, 
+                      uint64_t period)
+{
+        FILE *trace = fopen(path, record ? "wb" : "rb");
+        if (trace == NULL) {
+                fprintf(stderr, "Error opening trace %s\n", path);
+                return false;
+        }
+        bool ok = record ? trace_record(um, stdin, stdout, trace, period)
+                         : trace_replay(um, stdout, trace);
+        if (fclose(trace) != 0) {
+                ok = false;
+        }
+        if (!ok && record) {
+                fprintf(stderr, "Error writing trace %s\n", path);
+        }
+        return ok;
+}
+
+/* capture_read
+*
+* The input callback of a run that may fill the cache: read what is 
+* available of the input, blocking like the stream device does
+*
+* Parameters:
+*      void *cl:		The Capture
+*      unsigned char *buf:	Receives the bytes
+*      size_t size:		The room in buf
+*
+* Returns: the number of bytes read, or -1 at the end of the input
+* Expects: cl and buf cannot be NULL
+*
+* Notes: Notes that the program asked for input
+*/
+static long capture_read(void *cl, unsigned char *buf, size_t size)
+{
+        Capture *capture = cl;
+        capture->read = true;
+        ssize_t n;
+        do {
+                n = read(capture->input, buf, size);
+        } while (n < 0 && errno == EINTR);
+        return n > 0 ? (long)n : -1;
+}
+
+/* capture_write
+*
+* The output callback of a run that may fill the cache: write the bytes, and
+* keep them while recording
+*
+* Parameters:
+*      void *cl:		The Capture
+*      const unsigned char *buf:	The bytes
+*      size_t len:		The number of bytes
+*
+* Returns: None
+* Expects: cl and buf cannot be NULL
+*
+* Notes: CRE if the kept bytes cannot grow
+*/
+static void capture_write(void *cl, const unsigned char *buf, size_t len)
+{
+        Capture *capture = cl;
+        fwrite(buf, 1, len, capture->output);
+        if (!capture->recording) {
+                return;
+        }
+        if (capture->length + len > capture->capacity) {
+                capture->capacity = (capture->length + len) * 2;
+                capture->bytes = realloc(capture->bytes, capture->capacity);
+                assert(capture->bytes != NULL);
+        }
+        memcpy(capture->bytes + capture->length, buf, len);
+        capture->length += len;
+}
+
+/* cache_key
+*
+* Name an image in the cache by the FNV-1a hash of its contents and its size
+*
+* Parameters:
+*      FILE *image:		The image, rewound afterwards
+*      char *key:		Receives the name
+*      size_t size:		The room in key
+*
+* Returns: true if the image could be read
+* Expects: image and key cannot be NULL
+*
+* Notes: None
+*/
+static bool cache_key(FILE *image, char *key, size_t size)
+{
+        uint64_t hash = 0xcbf29ce484222325u;
+        unsigned long long length = 0;
+        unsigned char buf[65536];
+        size_t n;
+        while ((n = fread(buf, 1, sizeof(buf), image)) > 0) {
+                for (size_t i = 0; i < n; i++) {
+                        hash = (hash ^ buf[i]) * 0x100000001b3u;
+                }
+                length += n;
+        }
+        bool ok = !ferror(image);
+        rewind(image);
+        snprintf(key, size, "%016llx-%llu", (unsigned long long)hash, 
+                 length);
+        return ok;
+}
+
+/* cache_open
+*
+* Start a UM on an image, from the cache if the image is in it
+*
+* Parameters:
+*      const char *dir:		The cache directory
+*      const char *key:		The name of the image, see cache_key
+*      FILE *image:		The image
+*      FILE **snapshot:		Receives the open cache file on a hit, which
+*                               must stay open until the UM is freed
+*      Capture *capture:	Set up to fill the cache on a miss
+*
+* Returns: the UM, or NULL if the image could not be loaded (an error 
+*          message has been printed)
+* Expects: dir, key, image, snapshot and capture cannot be NULL
+*
+* Notes: 
+* On a hit the output the program printed while unpacking is printed again
+* and the UM continues from the snapshot. On a miss the UM runs from the 
+* image with its output going through capture, see cache_fill; a damaged 
+* cache file counts as a miss and is replaced.
+*/
+static UM_T cache_open(const char *dir, const char *key, FILE *image, 
+                       FILE **snapshot, Capture *capture)
+{
+        char path[CACHE_PATH];
+        memset(capture, 0, sizeof(*capture));
+        *snapshot = NULL;
+
+        snprintf(path, sizeof(path), "%s/%s.out", dir, key);
+        FILE *output = fopen(path, "rb");
+        snprintf(path, sizeof(path), "%s/%s.ums", dir, key);
+        FILE *cached = output != NULL ? fopen(path, "rb") : NULL;
+        UM_T um = cached != NULL ? um_restore(cached, stdin, stdout) : NULL;
+        if (um != NULL) {
+                int ch;
+                while ((ch = getc(output)) != EOF) {
+                        putchar(ch);
+                }
+                /* the UM writes to the descriptor, so this must go first */
+                fflush(stdout);
+                fclose(output);
+                *snapshot = cached;
+                return um;
+        }
+        if (cached != NULL) {
+                fclose(cached);
+        }
+        if (output != NULL) {
+                fclose(output);
+        }
+
+        capture->input = fileno(stdin);
+        capture->output = stdout;
+        capture->recording = true;
+        return new_um_callbacks(image, capture_read, capture_write, capture);
+}
+
+/* cache_save
+*
+* Write a file of the cache under a temporary name, then move it in place 
+* so that a run never sees it half written
+*
+* Parameters:
+*      const char *path:	The path of the file
+*      UM_T um:			The UM to save, or NULL
+*      const Capture *capture:	The output to save if um is NULL
+*
+* Returns: true if the file was written
+* Expects: path and capture cannot be NULL
+*
+* Notes: None
+*/
+static bool cache_save(const char *path, UM_T um, const Capture *capture)
+{
+        char temporary[CACHE_PATH + 32];
+        snprintf(temporary, sizeof(temporary), "%s.%ld", path, 
+                 (long)getpid());
+        FILE *file = fopen(temporary, "wb");
+        if (file == NULL) {
+                return false;
+        }
+        bool ok = um != NULL ? um_snapshot(um, file)
+                             : fwrite(capture->bytes, 1, capture->length, 
+                                      file) == capture->length;
+        if (fclose(file) != 0) {
+                ok = false;
+        }
+        if (ok && rename(temporary, path) == 0) {
+                return true;
+        }
+        remove(temporary);
+        return false;
+}
+
+/* cache_fill
+*
+* Run a UM started by cache_open on a miss until it has unpacked itself, 
+* and save it in the cache
+*
+* Parameters:
+*      UM_T um:			The UM
+*      const char *dir:		The cache directory, created if missing
+*      const char *key:		The name of the image, see cache_key
+*      Capture *capture:	The output of the UM
+*
+* Returns: true if the program is still running, false if it halted or 
+*          failed before loading a new program
+* Expects: um, dir, key and capture cannot be NULL
+*
+* Notes: 
+* The program is unpacked when the first LOADP installs a program at least
+* as long as the image (see fetch_decode_execute_to_load). Nothing is saved
+* if the program read input before that. The output file goes in after the
+* snapshot, so a cache entry is complete once its output file exists.
+*/
+static bool cache_fill(UM_T um, const char *dir, const char *key, 
+                       Capture *capture)
+{
+        uint32_t length = seg_length(um_seg_mem(um), 0);
+        bool running = fetch_decode_execute_to_load(um, length > 0 ? length
+                                                                   : 1);
+        if (running && !capture->read) {
+                char path[CACHE_PATH];
+                mkdir(dir, 0777);
+                snprintf(path, sizeof(path), "%s/%s.ums", dir, key);
+                bool ok = cache_save(path, um, capture);
+                snprintf(path, sizeof(path), "%s/%s.out", dir, key);
+                if (!ok || !cache_save(path, NULL, capture)) {
+                        fprintf(stderr, "Error writing the cache in %s\n", 
+                                dir);
+                }
+        }
+        capture->recording = false;
+        free(capture->bytes);
+        capture->bytes = NULL;
+        return running;
+}
 
 int main(int argc, char *argv[])
 {
+        bool use_jit = false;
+        bool checked = false;
+        const char *profile = NULL;
+        const char *snapshot = NULL;
+        uint64_t snapshot_at = UINT64_MAX;
+        bool on_input = false;
+        bool restore = false;
+        const char *cache = NULL;
+        const char *trace = NULL;
+        bool record = false;
+        uint64_t period = TRACE_PERIOD;
+        size_t max_memory = 0;
+        bool memory_stats = false;
+        int i = 1;
+
+        /* Parse the options in front of the instruction file */
+        for (; i < argc && strncmp(argv[i], "--", 2) == 0; i++) {
+                if (strcmp(argv[i], "--jit") == 0) {
+                        use_jit = true;
+                } else if (strcmp(argv[i], "--checked") == 0) {
+                        checked = true;
+                } else if (strcmp(argv[i], "--profile") == 0) {
+                        profile = "um-profile.json";
+                } else if (strncmp(argv[i], "--profile=", 10) == 0 &&
+                           argv[i][10] != '\0') {
+                        profile = argv[i] + 10;
+                } else if (strncmp(argv[i], "--snapshot-at=", 14) == 0 &&
+                           i + 1 < argc) {
+                        const char *point = argv[i] + 14;
+                        char *end;
+                        if (strcmp(point, "on-input") == 0) {
+                                on_input = true;
+                        } else {
+                                snapshot_at = strtoull(point, &end, 10);
+                                if (*point < '0' || *point > '9' ||
+                                    *end != '\0') {
+                                        usage(argv[0]);
+                                        return EXIT_FAILURE;
+                                }
+                        }
+                        snapshot = argv[++i];
+                } else if (strcmp(argv[i], "--restore") == 0) {
+                        restore = true;
+                } else if (strncmp(argv[i], "--cache=", 8) == 0 &&
+                           argv[i][8] != '\0') {
+                        cache = argv[i] + 8;
+                } else if (strncmp(argv[i], "--record=", 9) == 0 &&
+                           argv[i][9] != '\0' && trace == NULL) {
+                        trace = argv[i] + 9;
+                        record = true;
+                } else if (strncmp(argv[i], "--replay=", 9) == 0 &&
+                           argv[i][9] != '\0' && trace == NULL) {
+                        trace = argv[i] + 9;
+                } else if (strncmp(argv[i], "--trace-period=", 15) == 0) {
+                        const char *number = argv[i] + 15;
+                        char *end;
+                        period = strtoull(number, &end, 10);
+                        if (*number < '0' || *number > '9' || 
+                            *end != '\0' || period == 0) {
+                                usage(argv[0]);
+                                return EXIT_FAILURE;
+                        }
+                } else if (strncmp(argv[i], "--max-memory=", 13) == 0) {
+                        if (!seg_parse_limit(argv[i] + 13, &max_memory)) {
+                                usage(argv[0]);
+                                return EXIT_FAILURE;
+                        }
+                } else if (strcmp(argv[i], "--memory-stats") == 0) {
+                        memory_stats = true;
+                } else {
+                        usage(argv[0]);
+                        return EXIT_FAILURE;
+                }
+        }
+
         /* Check for correct number of arguments */
-        if (argc != 2) {
-                fprintf(stderr, "Usage: %s <instructions_file>\n", argv[0]);
+        if (argc - i != 1 || use_jit + checked + (profile != NULL) + 
+            (snapshot != NULL) + (trace != NULL) > 1 || 
+            (cache != NULL && (restore || profile != NULL || 
+            snapshot != NULL || trace != NULL))) {
+                usage(argv[0]);
                 return EXIT_FAILURE;
         }
 
-        /* Open the instruction file */
-        FILE *instructions = fopen(argv[1], "r");
+        /* Open the instruction file, or the snapshot to restore */
+        FILE *instructions = fopen(argv[i], "rb");
 
         /* Check if the file was opened successfully */
         if (instructions == NULL) {
-                fprintf(stderr, "Error opening instruction file\n");
+                fprintf(stderr, "Error opening %s file\n", 
+                        restore ? "snapshot" : "instruction");
                 return EXIT_FAILURE;
         }
 
         /* Open the input and output streams */
-        UM_T um = new_um(instructions, stdin, stdout);
+        char key[64];
+        FILE *cached = NULL;
+        Capture capture;
+        UM_T um;
+        if (cache != NULL && cache_key(instructions, key, sizeof(key))) {
+                um = cache_open(cache, key, instructions, &cached, &capture);
+        } else {
+                cache = NULL;
+                um = restore ? um_restore(instructions, stdin, stdout)
+                             : new_um(instructions, stdin, stdout);
+        }
+        if (um == NULL) {
+                fclose(instructions);
+                return EXIT_FAILURE;
+        }
+
+        seg_set_limit(um_seg_mem(um), max_memory);
 
         /* enter the fetch_decode_execute cycle */
-        fetch_decode_execute(um);
+        bool ok = true;
+        if (cache != NULL && cached == NULL && 
+            !cache_fill(um, cache, key, &capture)) {
+                /* it halted or failed while unpacking, see um_fault */
+        } else if (snapshot != NULL) {
+                ok = take_snapshot(um, snapshot_at, on_input, snapshot);
+        } else if (trace != NULL) {
+                ok = run_trace(um, trace, record, period);
+        } else if (profile != NULL) {
+                run_profile(um, profile);
+        } else if (use_jit) {
+                fetch_decode_execute_jit(um);
+        } else if (checked) {
+                fetch_decode_execute_checked(um);
+        } else {
+                fetch_decode_execute(um);
+        }
+        if (um_fault(um) != NULL) {
+                fprintf(stderr, "Error: %s\n", um_fault(um));
+                ok = false;
+        }
+        if (memory_stats) {
+                print_memory(um);
+        }
         um_free(um);
 
-        /* Close the instruction file */
+        /* Close the instruction file, and the snapshot of the cache */
         fclose(instructions);
+        if (cached != NULL) {
+                fclose(cached);
+        }
 
-        return EXIT_SUCCESS;
+        return ok ? EXIT_SUCCESS : EXIT_FAILURE;
 }
\ No newline at end of file
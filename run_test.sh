@@ -4,7 +4,166 @@
 for file in *.um; do
   # Check if file exists (in case no .um files are found)
   [ -e "$file" ] || continue
+  # the fault tests are run with --checked below
+  case "$file" in fault-*) continue ;; esac
 
   echo "Running ./um on $file"
   ./um "$file"
-done
\ No newline at end of file
+done
+# a snapshot taken part way must restore to the rest of a straight run, and
+# one taken in front of the first input to the whole of it
+snap=$(mktemp -d)
+./um umbin/midmark.um > "$snap/straight"
+./um --snapshot-at=10000000 "$snap/midmark.ums" umbin/midmark.um \
+  > "$snap/snapshot"
+./um --restore "$snap/midmark.ums" > "$snap/restored"
+rest=$(wc -c < "$snap/restored")
+if cmp -s "$snap/straight" "$snap/snapshot" && [ "$rest" -gt 0 ] &&
+   [ "$rest" -lt "$(wc -c < "$snap/straight")" ] &&
+   tail -c "$rest" "$snap/straight" | cmp -s - "$snap/restored"; then
+  echo "midmark.um --snapshot-at=10000000: ok"
+else
+  echo "midmark.um --snapshot-at=10000000: FAILED"
+fi
+./um --snapshot-at=on-input "$snap/times2.ums" times2.um < times2.0 \
+  > /dev/null
+if [ "$(./um --restore "$snap/times2.ums" < times2.0)" = \
+     "$(cat times2.1)" ]; then
+  echo "times2.um --snapshot-at=on-input: ok"
+else
+  echo "times2.um --snapshot-at=on-input: FAILED"
+fi
+rm -rf "$snap"
+
+# the um functions that um itself does not call, see test_um.c
+./test_um umbin/midmark.um
+
+# um-batch reports every job of a manifest in manifest order and fails 
+# when one of them does
+batch=$(mktemp -d)
+cat > "$batch/manifest" <<EOF
+print-six.um - print-six.1
+times2.um times2.0 times2.1
+nand.um - multiply.1
+halt.um
+EOF
+./um-batch --threads=2 "$batch/manifest" > "$batch/report"
+status=$?
+if [ $status -ne 0 ] && [ "$(awk '$1 ~ /^[A-Z]+$/ { print $1, $NF }' \
+     "$batch/report")" = "$(printf '%s\n' 'PASS print-six.um' \
+     'PASS times2.um' 'FAIL nand.um' 'DONE halt.um')" ]; then
+  echo "um-batch manifest: ok"
+else
+  echo "um-batch manifest: FAILED"
+fi
+cat > "$batch/limit" <<EOF
+print-six.um - print-six.1
+umbin/midmark.um
+EOF
+./um-batch --max-instructions=100000 "$batch/limit" > "$batch/report"
+status=$?
+if [ $status -ne 0 ] && [ "$(awk '$1 ~ /^[A-Z]+$/ { print $1, $NF }' \
+     "$batch/report")" = "$(printf '%s\n' 'PASS print-six.um' \
+     'LIMIT umbin/midmark.um')" ]; then
+  echo "um-batch --max-instructions: ok"
+else
+  echo "um-batch --max-instructions: FAILED"
+fi
+for option in --threads=2x --max-instructions=abc; do
+  if ./um-batch "$option" "$batch/manifest" 2>&1 | grep -q '^Usage:'; then
+    echo "um-batch $option: ok"
+  else
+    echo "um-batch $option: FAILED"
+  fi
+done
+rm -rf "$batch"
+
+# seg-grow.um maps 16 MB: under a 4 MB limit um and um-batch must stop it
+limit=$(mktemp -d)
+./um --max-memory=4M seg-grow.um > "$limit/out" 2> "$limit/err"
+status=$?
+if [ $status -ne 0 ] && [ ! -s "$limit/out" ] &&
+   grep -q '^Error: memory limit exceeded' "$limit/err" &&
+   [ "$(./um --max-memory=64M seg-grow.um)" = "$(cat seg-grow.1)" ]; then
+  echo "seg-grow.um --max-memory: ok"
+else
+  echo "seg-grow.um --max-memory: FAILED"
+fi
+echo "seg-grow.um - seg-grow.1" > "$limit/manifest"
+if ! ./um-batch --max-memory=4M "$limit/manifest" > "$limit/report" \
+     2> /dev/null && [ "$(awk '$1 ~ /^[A-Z]+$/ { print $1, $NF }' \
+     "$limit/report")" = "FAULT seg-grow.um" ]; then
+  echo "um-batch --max-memory: ok"
+else
+  echo "um-batch --max-memory: FAILED"
+fi
+for tool in um um-batch; do
+  if "./$tool" --max-memory=4X seg-grow.um 2>&1 | grep -q '^Usage:'; then
+    echo "$tool --max-memory=4X: ok"
+  else
+    echo "$tool --max-memory=4X: FAILED"
+  fi
+done
+rm -rf "$limit"
+
+# every fault-*.um must fail under --checked with the report in its .1 file
+for file in fault-*.um; do
+  report=$(./um --checked "$file" 2>&1)
+  status=$?
+  if [ $status -ne 0 ] && [ "$report" = "$(cat "${file%.um}.1")" ]; then
+    echo "$file --checked: ok"
+  else
+    echo "$file --checked: FAILED"
+  fi
+done
+
+# seg-cycle.um maps 16 MB, unmaps it and maps 8 MB in another size class: 
+# it only fits under 24 MB if the slabs of the unmapped segments are freed
+if [ "$(./um --max-memory=24M seg-cycle.um)" = "$(cat seg-cycle.1)" ]; then
+  echo "seg-cycle.um --max-memory: ok"
+else
+  echo "seg-cycle.um --max-memory: FAILED"
+fi
+
+# unpack.um prints before and after it unpacks itself: a run from the 
+# cache must print the same as the run that filled it
+cache=$(mktemp -d)
+for run in filling cached; do
+  if [ "$(./um --cache="$cache" unpack.um)" = "$(cat unpack.1)" ]; then
+    echo "unpack.um --cache ($run): ok"
+  else
+    echo "unpack.um --cache ($run): FAILED"
+  fi
+done
+rm -rf "$cache"
+
+# a run recorded with its input replays the same without it; the trace 
+# must not replay on another program or once it is cut short
+trace=$(mktemp -d)
+if [ "$(./um --record="$trace/times2.umt" times2.um < times2.0)" = \
+     "$(cat times2.1)" ] &&
+   [ "$(./um --replay="$trace/times2.umt" times2.um < /dev/null)" = \
+     "$(cat times2.1)" ]; then
+  echo "times2.um --record, --replay: ok"
+else
+  echo "times2.um --record, --replay: FAILED"
+fi
+./um --replay="$trace/times2.umt" times3.um < /dev/null > "$trace/out" \
+  2> "$trace/err"
+status=$?
+if [ $status -ne 0 ] && [ ! -s "$trace/out" ] &&
+   grep -q '^Error: the trace is of another program' "$trace/err"; then
+  echo "times3.um --replay of times2: ok"
+else
+  echo "times3.um --replay of times2: FAILED"
+fi
+head -c -1 "$trace/times2.umt" > "$trace/cut.umt"
+./um --replay="$trace/cut.umt" times2.um < /dev/null > /dev/null \
+  2> "$trace/err"
+status=$?
+if [ $status -ne 0 ] && grep -q '^Error: the trace ends' "$trace/err"; then
+  echo "times2.um --replay of a cut trace: ok"
+else
+  echo "times2.um --replay of a cut trace: FAILED"
+fi
+rm -rf "$trace"
@@ -0,0 +1,405 @@
+/*
+ *     test_um.c
+ *     by Elisa and Cynthia, 04/10/2025
+ *     Project 6 - um
+ *
+ *     This file includes a main function that tests the parts of the um
+ *     module that the um program does not reach from its command line.
+ *     It is run by run_test.sh with a program that prints as it goes (such
+ *     as umbin/midmark.um), prints a line per test and exits with failure
+ *     if any test failed.
+ */
+
+/* pipe and fdopen are POSIX */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include "um.h"
+#include "decode.h"
+
+/* instructions the parent runs before it is forked */
+#define FORK_AT 10000000
+
+/* budget of every um_run slice */
+#define SLICE 1000000
+
+/* the client of a UM with callback I/O, see test_callbacks */
+typedef struct Feed {
+        const char *input; /* every byte the client will give */
+        size_t ready; /* how many of them it has given so far */
+        size_t read; /* how many of them the UM has read */
+        char output[16];
+        size_t written;
+} Feed;
+
+/* an output stream and what was written to it */
+typedef struct Output {
+        FILE *stream;
+        char *bytes;
+        size_t length;
+} Output;
+
+static UM_T start(const char *path, FILE *output);
+static void collect(Output *output);
+static bool report(const char *name, bool passed);
+static uint32_t three(Um_opcode opcode, unsigned a, unsigned b, unsigned c);
+static uint32_t loadval(unsigned a, uint32_t value);
+static bool test_fork(const char *path, const Output *straight);
+static bool test_slices(const char *path, const Output *straight);
+static bool test_fault(void);
+static bool test_waiting(void);
+static long feed_read(void *cl, unsigned char *buf, size_t size);
+static void feed_write(void *cl, const unsigned char *buf, size_t len);
+static bool test_callbacks(void);
+
+int main(int argc, char *argv[])
+{
+        if (argc != 2) {
+                fprintf(stderr, "Usage: %s <instructions_file>\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+        Output straight = { tmpfile(), NULL, 0 };
+        if (straight.stream == NULL) {
+                fprintf(stderr, "Error opening a temporary file\n");
+                return EXIT_FAILURE;
+        }
+        UM_T um = start(argv[1], straight.stream);
+        fetch_decode_execute(um);
+        um_free(um);
+        collect(&straight);
+
+        bool passed = test_fork(argv[1], &straight);
+        passed = test_slices(argv[1], &straight) && passed;
+        passed = test_fault() && passed;
+        passed = test_waiting() && passed;
+        passed = test_callbacks() && passed;
+        free(straight.bytes);
+        return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* start
+*
+* Create a UM running the program at path, with no input
+*
+* Parameters:
+*      const char *path:	The instruction file
+*      FILE *output:		The output stream of the UM
+*
+* Returns: the UM
+* Expects: path and output cannot be NULL
+*
+* Notes: CRE if the program cannot be loaded
+*/
+static UM_T start(const char *path, FILE *output)
+{
+        FILE *instructions = fopen(path, "rb");
+        if (instructions == NULL) {
+                fprintf(stderr, "Error opening instruction file\n");
+                exit(EXIT_FAILURE);
+        }
+        UM_T um = new_um(instructions, stdin, output);
+        fclose(instructions);
+        if (um == NULL) {
+                exit(EXIT_FAILURE);
+        }
+        return um;
+}
+
+/* collect
+*
+* Read back everything written to the temporary stream of an output, then
+* close it
+*
+* Parameters:
+*      Output *output:		The output, whose bytes are malloc'd here
+*
+* Returns: None
+* Expects: output cannot be NULL, its UM has been freed
+*
+* Notes: None
+*/
+static void collect(Output *output)
+{
+        FILE *stream = output->stream;
+        /* the UM writes to the descriptor, past what stdio knows of */
+        fseek(stream, 0, SEEK_END);
+        long length = ftell(stream);
+        output->length = length > 0 ? (size_t)length : 0;
+        output->bytes = malloc(output->length + 1);
+        if (output->bytes == NULL) {
+                exit(EXIT_FAILURE);
+        }
+        rewind(stream);
+        output->length = fread(output->bytes, 1, output->length, stream);
+        fclose(stream);
+}
+
+/* report
+*
+* Print the outcome of a test
+*
+* Parameters:
+*      const char *name:	The test
+*      bool passed:		Whether it passed
+*
+* Returns: passed
+*/
+static bool report(const char *name, bool passed)
+{
+        printf("%s: %s\n", name, passed ? "ok" : "FAILED");
+        return passed;
+}
+
+/* three
+*
+* Encode an instruction with three registers
+*/
+static uint32_t three(Um_opcode opcode, unsigned a, unsigned b, unsigned c)
+{
+        return (uint32_t)opcode << 28 | a << 6 | b << 3 | c;
+}
+
+/* loadval
+*
+* Encode a load value instruction
+*/
+static uint32_t loadval(unsigned a, uint32_t value)
+{
+        return (uint32_t)LV << 28 | a << 25 | value;
+}
+
+/* test_fork
+*
+* Fork a UM part way through its program twice, run the parent and the
+* forks to the end one after the other, freeing the parent before the
+* last fork runs, and compare their output with a straight run
+*
+* Parameters:
+*      const char *path:	The instruction file
+*      const Output *straight:	What a straight run of it printed
+*
+* Returns: true if the parent printed what the straight run did and each
+*          fork printed the part of it after the fork
+* Expects: path and straight cannot be NULL, the program prints after 
+*          FORK_AT instructions
+*
+* Notes: The forks share the segments of the parent copy-on-write, so a
+* store of one UM that reached another would show in its output
+*/
+static bool test_fork(const char *path, const Output *straight)
+{
+        Output parent = { tmpfile(), NULL, 0 };
+        Output forks[2] = { { tmpfile(), NULL, 0 }, { tmpfile(), NULL, 0 } };
+        if (parent.stream == NULL || forks[0].stream == NULL 
+            || forks[1].stream == NULL) {
+                return report("um_fork", false);
+        }
+
+        UM_T um = start(path, parent.stream);
+        fetch_decode_execute_until(um, FORK_AT, false);
+        UM_T first = um_fork(um, stdin, forks[0].stream);
+        UM_T second = um_fork(um, stdin, forks[1].stream);
+        fetch_decode_execute(um);
+        fetch_decode_execute(first);
+        um_free(um);
+        um_free(first);
+        fetch_decode_execute(second);
+        um_free(second);
+        collect(&parent);
+        collect(&forks[0]);
+        collect(&forks[1]);
+
+        size_t rest = forks[0].length;
+        bool passed = parent.length == straight->length
+                      && memcmp(parent.bytes, straight->bytes,
+                                straight->length) == 0
+                      && rest > 0 && rest < straight->length;
+        for (int f = 0; passed && f < 2; f++) {
+                passed = forks[f].length == rest
+                         && memcmp(forks[f].bytes, straight->bytes
+                                   + straight->length - rest, rest) == 0;
+        }
+        free(parent.bytes);
+        free(forks[0].bytes);
+        free(forks[1].bytes);
+        return report("um_fork", passed);
+}
+
+/* test_slices
+*
+* Run a program to the end in slices of SLICE instructions with um_run
+*
+* Parameters:
+*      const char *path:	The instruction file
+*      const Output *straight:	What a straight run of it printed
+*
+* Returns: true if every slice but the last returned UM_BUDGET, the last 
+*          UM_HALTED, a further call UM_HALTED again, and the program 
+*          printed what the straight run did
+* Expects: path and straight cannot be NULL, the program runs for more
+*          than one slice
+*
+* Notes: None
+*/
+static bool test_slices(const char *path, const Output *straight)
+{
+        Output sliced = { tmpfile(), NULL, 0 };
+        if (sliced.stream == NULL) {
+                return report("um_run slices", false);
+        }
+        UM_T um = start(path, sliced.stream);
+        unsigned slices = 0;
+        Um_status status;
+        do {
+                status = um_run(um, SLICE);
+                slices++;
+        } while (status == UM_BUDGET);
+        bool passed = status == UM_HALTED && slices > 1
+                      && um_instructions(um) >= (uint64_t)SLICE
+                      && um_run(um, SLICE) == UM_HALTED;
+        um_free(um);
+        collect(&sliced);
+        passed = passed && sliced.length == straight->length
+                 && memcmp(sliced.bytes, straight->bytes, 
+                           straight->length) == 0;
+        free(sliced.bytes);
+        return report("um_run slices", passed);
+}
+
+/* test_fault
+*
+* Run a program that divides by zero with um_run
+*
+* Parameters: None
+*
+* Returns: true if um_run returned UM_FAULT, again when called once more,
+*          and um_fault names the division
+* Expects: None
+*
+* Notes: The normal loop would fail an assertion instead
+*/
+static bool test_fault(void)
+{
+        const uint32_t words[] = {
+                loadval(1, 1), loadval(2, 0), three(DIV, 3, 1, 2), 
+                three(HALT, 0, 0, 0)
+        };
+        UM_T um = new_um_words(words, 4, stdin, stdout);
+        bool passed = um_run(um, SLICE) == UM_FAULT 
+                      && um_run(um, SLICE) == UM_FAULT
+                      && um_fault(um) != NULL
+                      && strncmp(um_fault(um), "division by zero", 16) == 0;
+        um_free(um);
+        return report("um_run fault", passed);
+}
+
+/* test_waiting
+*
+* Run a program that echoes a byte of its input with um_run, on an input 
+* pipe that is empty at first
+*
+* Parameters: None
+*
+* Returns: true if um_run returned UM_WAITING while the pipe was empty, 
+*          then UM_HALTED once a byte was written, and the byte was echoed
+* Expects: None
+*
+* Notes: None
+*/
+static bool test_waiting(void)
+{
+        const uint32_t words[] = {
+                three(IN, 0, 0, 1), three(OUT, 0, 0, 1), 
+                three(HALT, 0, 0, 0)
+        };
+        int fds[2];
+        Output echo = { tmpfile(), NULL, 0 };
+        FILE *input = pipe(fds) == 0 ? fdopen(fds[0], "rb") : NULL;
+        if (echo.stream == NULL || input == NULL) {
+                return report("um_run waiting", false);
+        }
+        UM_T um = new_um_words(words, 3, input, echo.stream);
+        bool passed = um_run(um, SLICE) == UM_WAITING
+                      && um_run(um, SLICE) == UM_WAITING
+                      && write(fds[1], "x", 1) == 1
+                      && um_run(um, SLICE) == UM_HALTED;
+        um_free(um);
+        close(fds[1]);
+        fclose(input);
+        collect(&echo);
+        passed = passed && echo.length == 1 && echo.bytes[0] == 'x';
+        free(echo.bytes);
+        return report("um_run waiting", passed);
+}
+
+/* feed_read
+*
+* The input callback of test_callbacks: one byte if the client has one 
+* ready, else nothing yet, or the end of the input after the last byte
+*/
+static long feed_read(void *cl, unsigned char *buf, size_t size)
+{
+        Feed *feed = cl;
+        (void)size;
+        if (feed->input[feed->read] == '\0') {
+                return -1;
+        }
+        if (feed->read == feed->ready) {
+                return 0;
+        }
+        buf[0] = feed->input[feed->read++];
+        return 1;
+}
+
+/* feed_write
+*
+* The output callback of test_callbacks: keep the bytes
+*/
+static void feed_write(void *cl, const unsigned char *buf, size_t len)
+{
+        Feed *feed = cl;
+        for (size_t i = 0; i < len && feed->written < sizeof(feed->output); 
+             i++) {
+                feed->output[feed->written++] = buf[i];
+        }
+}
+
+/* test_callbacks
+*
+* Run a program that echoes two bytes of its input with um_run, on a 
+* callback device whose client has no input at first and then hands over
+* one byte at a time
+*
+* Parameters: None
+*
+* Returns: true if um_run returned UM_WAITING until each byte was ready,
+*          the echo of the first byte reached the output callback before 
+*          the UM waited for the second one, and the program then halted
+* Expects: None
+*
+* Notes: None
+*/
+static bool test_callbacks(void)
+{
+        const uint32_t words[] = {
+                three(IN, 0, 0, 1), three(OUT, 0, 0, 1), 
+                three(IN, 0, 0, 1), three(OUT, 0, 0, 1), 
+                three(HALT, 0, 0, 0)
+        };
+        Feed feed = { "ab", 0, 0, { 0 }, 0 };
+        UM_T um = new_um_words(words, 5, stdin, stdout);
+        um_set_callbacks(um, feed_read, feed_write, &feed);
+        bool passed = um_run(um, SLICE) == UM_WAITING && feed.written == 0;
+        feed.ready = 1;
+        passed = passed && um_run(um, SLICE) == UM_WAITING
+                 && feed.written == 1 && feed.output[0] == 'a';
+        feed.ready = 2;
+        passed = passed && um_run(um, SLICE) == UM_HALTED
+                 && feed.written == 2 && feed.output[1] == 'b';
+        um_free(um);
+        return report("callback I/O", passed);
+}
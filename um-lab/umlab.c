@@ -19,13 +19,10 @@
 #include <assert.h>
 #include <seq.h>
 #include <bitpack.h>
+#include "decode.h"     /* the opcodes, shared with the um */
 
 
 typedef uint32_t Um_instruction;
-typedef enum Um_opcode {
-        CMOV = 0, SLOAD, SSTORE, ADD, MUL, DIV,
-        NAND, HALT, ACTIVATE, INACTIVATE, OUT, IN, LOADP, LV
-} Um_opcode;
 
 
 /* Functions that return the two instruction types */
@@ -369,6 +366,240 @@ void loadp_test1(Seq_T stream)
 }
 
 
+/* test self-modifying code: sstore into $m[0] replaces the instruction at */
+/* address 8 (output r1) with a copy of the one at address 9 (output r2) */
+void selfmod_test(Seq_T stream)
+{
+        append(stream, loadval(r1, 65));
+        append(stream, loadval(r2, 66));
+        append(stream, loadval(r3, 0));
+        append(stream, loadval(r4, 8));
+        append(stream, loadval(r6, 9));
+        append(stream, sload(r5, r3, r6));      /* r5 = m[0][9] */
+        append(stream, sstore(r3, r4, r5));     /* m[0][8] = r5 */
+        append(stream, output(r1));             /* output 'A' */
+        append(stream, output(r1));             /* patched: output 'B' */
+        append(stream, output(r2));             /* output 'B' */
+        append(stream, halt());
+}
+
+/* 
+ * test a self-unpacking program like sandmark.umz, for um --cache: print 'A',
+ * copy the three words at address 18 into a new 64 word segment, longer 
+ * than the program, and LOADP it; the unpacked program prints 'B'
+ */
+void unpack_test(Seq_T stream)
+{
+        append(stream, loadval(r1, 65));
+        append(stream, output(r1));             /* output 'A' */
+        append(stream, loadval(r2, 64));
+        append(stream, activate(r3, r2));       /* r3 = new segment */
+        for (unsigned k = 0; k < 3; k++) {
+                append(stream, loadval(r4, 18 + k));
+                append(stream, sload(r5, r0, r4));      /* r5 = m[0][18+k] */
+                append(stream, loadval(r6, k));
+                append(stream, sstore(r3, r6, r5));     /* m[r3][k] = r5 */
+        }
+        append(stream, loadval(r7, 0));
+        append(stream, loadp(r3, r7));          /* run the new segment */
+        append(stream, loadval(r6, 66));        /* address 18: packed */
+        append(stream, output(r6));             /* output 'B' */
+        append(stream, halt());
+}
+
+/* 
+ * test the instruction pairs the interpreter fuses: LV+OUT, LV+ADD, 
+ * NOT+NAND and LV+LOADP, then patch the ADD at address 16 into an output so 
+ * the LV+ADD pair in front of it has to be split again
+ */
+void fusion_test(Seq_T stream)
+{
+        append(stream, loadval(r1, 70));
+        append(stream, output(r1));             /* output 'F' */
+        append(stream, loadval(r2, 1));
+        append(stream, add(r1, r1, r2));
+        append(stream, output(r1));             /* output 'G' */
+        append(stream, nand(r3, r1, r1));
+        append(stream, nand(r3, r3, r3));
+        append(stream, output(r3));             /* output 'G' */
+        append(stream, loadval(r4, 11));
+        append(stream, loadp(r0, r4));          /* jump to 11 */
+        append(stream, output(r2));             /* skipped */
+        append(stream, loadval(r6, 1));
+        append(stream, sload(r5, r0, r6));      /* r5 = m[0][1] */
+        append(stream, loadval(r6, 16));
+        append(stream, sstore(r0, r6, r5));     /* m[0][16] = r5 */
+        append(stream, loadval(r7, 0));
+        append(stream, add(r1, r1, r1));        /* patched: output 'G' */
+        append(stream, halt());
+}
+
+/* 
+ * test the memory limit: map SEG_GROW_COUNT segments of SEG_GROW_WORDS 
+ * words (16 MB in all) and keep every one, then output 'M'. Under a lower 
+ * --max-memory the ACTIVATE that passes it stops the program first.
+ */
+#define SEG_GROW_COUNT 64
+#define SEG_GROW_WORDS 65536
+void seg_grow_test(Seq_T stream)
+{
+        append(stream, loadval(r1, SEG_GROW_WORDS));
+        append(stream, loadval(r5, SEG_GROW_COUNT));
+        append(stream, activate(r2, r1));       /* address 2: map */
+        append(stream, nand(r7, r0, r0));
+        append(stream, add(r5, r5, r7));        /* r5-- */
+        append(stream, loadval(r6, 9));
+        append(stream, loadval(r3, 2));
+        append(stream, conditional_move(r6, r3, r5));
+        append(stream, loadp(r0, r6));          /* back to 2 until r5 = 0 */
+        append(stream, loadval(r4, 77));
+        append(stream, output(r4));             /* output 'M' */
+        append(stream, halt());
+}
+
+/* 
+ * test that unmapped storage is given back: map SEG_GROW_COUNT segments of
+ * SEG_GROW_WORDS words (16 MB), unmap them all, then map as many segments 
+ * of half that size (8 MB) and output 'R'. The second size class cannot 
+ * reuse the pooled blocks of the first, so under a 24 MB --max-memory it 
+ * only fits once the slabs of the unmapped segments are released.
+ */
+void seg_cycle_test(Seq_T stream)
+{
+        append(stream, loadval(r1, SEG_GROW_WORDS));
+        append(stream, loadval(r5, SEG_GROW_COUNT));
+        append(stream, activate(r2, r1));       /* address 2: map */
+        append(stream, nand(r7, r0, r0));
+        append(stream, add(r5, r5, r7));        /* r5-- */
+        append(stream, loadval(r6, 9));
+        append(stream, loadval(r3, 2));
+        append(stream, conditional_move(r6, r3, r5));
+        append(stream, loadp(r0, r6));          /* back to 2 until r5 = 0 */
+        append(stream, loadval(r5, SEG_GROW_COUNT));
+        append(stream, inactivate(r5));         /* address 10: unmap r5 */
+        append(stream, add(r5, r5, r7));        /* r5-- */
+        append(stream, loadval(r6, 16));
+        append(stream, loadval(r3, 10));
+        append(stream, conditional_move(r6, r3, r5));
+        append(stream, loadp(r0, r6));          /* back to 10 until r5 = 0 */
+        append(stream, loadval(r1, SEG_GROW_WORDS / 2));
+        append(stream, loadval(r5, SEG_GROW_COUNT));
+        append(stream, activate(r2, r1));       /* address 18: map */
+        append(stream, add(r5, r5, r7));        /* r5-- */
+        append(stream, loadval(r6, 24));
+        append(stream, loadval(r3, 18));
+        append(stream, conditional_move(r6, r3, r5));
+        append(stream, loadp(r0, r6));          /* back to 18 until r5 = 0 */
+        append(stream, loadval(r4, 82));
+        append(stream, output(r4));             /* output 'R' */
+        append(stream, halt());
+}
+
+/* 
+ * point the load value at address `at` of the stream to `target`, for jumps
+ * to code that has not been written yet
+ */
+static void patch_loadval(Seq_T stream, int at, Um_register r, int target)
+{
+        Seq_put(stream, at, (void *)(uintptr_t)loadval(r, target));
+}
+
+/* 
+ * benchmark map/unmap churn: map SEG_CHURN_LIVE segments of 4 words and keep
+ * their ids in one big segment, then, SEG_CHURN_PASSES times over the whole
+ * set, unmap a batch of 256 of them and map 256 new ones in their place. 
+ * Nothing is printed. Registers: r0 is 0, r2 the id segment, r3 the index 
+ * into it, r4 the batch countdown, r5 the passes left.
+ */
+#define SEG_CHURN_LIVE (1 << 20)
+#define SEG_CHURN_PASSES 4
+#define SEG_CHURN_BATCH 256
+void seg_churn_test(Seq_T stream)
+{
+        append(stream, loadval(r1, SEG_CHURN_LIVE));
+        append(stream, activate(r2, r1));       /* r2 = the id segment */
+        append(stream, loadval(r3, 0));
+        int fill = Seq_length(stream);
+        append(stream, loadval(r6, 4));
+        append(stream, activate(r4, r6));
+        append(stream, sstore(r2, r3, r4));     /* ids[r3] = new id */
+        append(stream, loadval(r7, 1));
+        append(stream, add(r3, r3, r7));
+        append(stream, loadval(r1, SEG_CHURN_LIVE));
+        append(stream, nand(r1, r1, r1));
+        append(stream, add(r1, r1, r7));
+        append(stream, add(r1, r3, r1));        /* r1 = r3 - live */
+        int fill_exit = Seq_length(stream);
+        append(stream, halt());                 /* patched below */
+        append(stream, loadval(r7, fill));
+        append(stream, conditional_move(r6, r7, r1));
+        append(stream, loadp(r0, r6));          /* fill until r3 = live */
+
+        patch_loadval(stream, fill_exit, r6, Seq_length(stream));
+        append(stream, loadval(r5, SEG_CHURN_PASSES));
+        int pass = Seq_length(stream);
+        append(stream, loadval(r3, 0));
+        int batch = Seq_length(stream);
+        append(stream, loadval(r4, SEG_CHURN_BATCH));
+        int unmap = Seq_length(stream);
+        append(stream, sload(r6, r2, r3));
+        append(stream, inactivate(r6));         /* unmap ids[r3] */
+        append(stream, loadval(r7, 1));
+        append(stream, add(r3, r3, r7));
+        append(stream, nand(r7, r0, r0));
+        append(stream, add(r4, r4, r7));        /* r4-- */
+        int unmap_exit = Seq_length(stream);
+        append(stream, halt());                 /* patched below */
+        append(stream, loadval(r1, unmap));
+        append(stream, conditional_move(r6, r1, r4));
+        append(stream, loadp(r0, r6));
+
+        patch_loadval(stream, unmap_exit, r6, Seq_length(stream));
+        append(stream, loadval(r7, SEG_CHURN_BATCH));
+        append(stream, nand(r7, r7, r7));
+        append(stream, loadval(r1, 1));
+        append(stream, add(r7, r7, r1));
+        append(stream, add(r3, r3, r7));        /* back to the batch start */
+        append(stream, loadval(r4, SEG_CHURN_BATCH));
+        int map = Seq_length(stream);
+        append(stream, loadval(r6, 4));
+        append(stream, activate(r7, r6));
+        append(stream, sstore(r2, r3, r7));     /* ids[r3] = new id */
+        append(stream, loadval(r7, 1));
+        append(stream, add(r3, r3, r7));
+        append(stream, nand(r7, r0, r0));
+        append(stream, add(r4, r4, r7));        /* r4-- */
+        int map_exit = Seq_length(stream);
+        append(stream, halt());                 /* patched below */
+        append(stream, loadval(r1, map));
+        append(stream, conditional_move(r6, r1, r4));
+        append(stream, loadp(r0, r6));
+
+        patch_loadval(stream, map_exit, r6, Seq_length(stream));
+        append(stream, loadval(r1, SEG_CHURN_LIVE));
+        append(stream, nand(r1, r1, r1));
+        append(stream, loadval(r7, 1));
+        append(stream, add(r1, r1, r7));
+        append(stream, add(r1, r3, r1));        /* r1 = r3 - live */
+        int batch_exit = Seq_length(stream);
+        append(stream, halt());                 /* patched below */
+        append(stream, loadval(r7, batch));
+        append(stream, conditional_move(r6, r7, r1));
+        append(stream, loadp(r0, r6));          /* next batch */
+
+        patch_loadval(stream, batch_exit, r6, Seq_length(stream));
+        append(stream, nand(r7, r0, r0));
+        append(stream, add(r5, r5, r7));        /* r5-- */
+        int pass_exit = Seq_length(stream);
+        append(stream, halt());                 /* patched below */
+        append(stream, loadval(r7, pass));
+        append(stream, conditional_move(r6, r7, r5));
+        append(stream, loadp(r0, r6));          /* next pass */
+
+        patch_loadval(stream, pass_exit, r6, Seq_length(stream));
+        append(stream, halt());
+}
+
 /* test activate, sload, and sstore */
 void seg_test(Seq_T stream)
 {
@@ -406,4 +637,72 @@ void one_million_test(Seq_T stream)
                 append(stream, add(r2, r1, r2));
         }
         append(stream, halt());
-}
\ No newline at end of file
+}
+/* 
+ * Fault tests: each program fails under `um --checked`, which reports the
+ * fault on stderr and exits with failure. The expected output is that 
+ * report. The release loop does not check, so run_test.sh runs these with
+ * --checked only.
+ */
+
+/* load from offset 9 of a 4 word segment */
+void fault_load_bounds_test(Seq_T stream)
+{
+        append(stream, loadval(r1, 4));
+        append(stream, activate(r2, r1));
+        append(stream, loadval(r3, 9));
+        append(stream, sload(r4, r2, r3));
+        append(stream, halt());
+}
+
+/* store into a segment after unmapping it */
+void fault_store_unmapped_test(Seq_T stream)
+{
+        append(stream, loadval(r1, 4));
+        append(stream, activate(r2, r1));
+        append(stream, inactivate(r2));
+        append(stream, sstore(r2, r0, r1));
+        append(stream, halt());
+}
+
+/* load from a segment id that was never mapped */
+void fault_never_mapped_test(Seq_T stream)
+{
+        append(stream, loadval(r2, 5));
+        append(stream, sload(r4, r2, r0));
+        append(stream, halt());
+}
+
+/* unmap the same segment twice */
+void fault_double_unmap_test(Seq_T stream)
+{
+        append(stream, loadval(r1, 4));
+        append(stream, activate(r2, r1));
+        append(stream, inactivate(r2));
+        append(stream, inactivate(r2));
+        append(stream, halt());
+}
+
+/* jump past the end of the program */
+void fault_bad_jump_test(Seq_T stream)
+{
+        append(stream, loadval(r1, 100));
+        append(stream, loadp(r0, r1));
+        append(stream, halt());
+}
+
+/* divide by zero */
+void fault_divide_test(Seq_T stream)
+{
+        append(stream, loadval(r1, 1));
+        append(stream, divide(r3, r1, r0));
+        append(stream, halt());
+}
+
+/* run an instruction with opcode 14, which does not exist */
+void fault_opcode_test(Seq_T stream)
+{
+        append(stream, loadval(r1, 1));
+        append(stream, three_register((Um_opcode)14, r0, r0, r1));
+        append(stream, halt());
+}
@@ -26,6 +26,19 @@ extern void nand_test(Seq_T stream);
 extern void nand_test2(Seq_T stream);
 extern void loadp_test(Seq_T stream);
 extern void loadp_test1(Seq_T stream);
+extern void selfmod_test(Seq_T stream);
+extern void fusion_test(Seq_T stream);
+extern void seg_grow_test(Seq_T stream);
+extern void seg_cycle_test(Seq_T stream);
+extern void seg_churn_test(Seq_T stream);
+extern void fault_load_bounds_test(Seq_T stream);
+extern void fault_store_unmapped_test(Seq_T stream);
+extern void fault_never_mapped_test(Seq_T stream);
+extern void fault_double_unmap_test(Seq_T stream);
+extern void fault_bad_jump_test(Seq_T stream);
+extern void fault_divide_test(Seq_T stream);
+extern void fault_opcode_test(Seq_T stream);
+extern void unpack_test(Seq_T stream);
 
 
 extern void arith_test(Seq_T stream);
@@ -63,7 +76,35 @@ static struct test_info {
         { "times3",        "!", "c", times_three_test },
         { "one-million",  NULL, "", one_million_test },
         { "loadp",        NULL, "51", loadp_test },
-        { "loadp2",       NULL, "", loadp_test1 }
+        { "loadp2",       NULL, "", loadp_test1 },
+        { "selfmod",      NULL, "ABB", selfmod_test },
+        { "fusion",       NULL, "FGGG", fusion_test },
+        { "seg-grow",     NULL, "M", seg_grow_test },
+        { "seg-cycle",    NULL, "R", seg_cycle_test },
+        { "seg-churn",    NULL, "", seg_churn_test },
+        { "fault-load-bounds", NULL,
+          "Error: segmented load out of bounds at pc 3 (SLOAD): segment 1, "
+          "offset 9, 4 words long\n", fault_load_bounds_test },
+        { "fault-store-unmapped", NULL,
+          "Error: segmented store out of bounds at pc 3 (SSTORE): segment 1, "
+          "offset 0, not mapped (unmapped 1 time)\n", 
+          fault_store_unmapped_test },
+        { "fault-never-mapped", NULL,
+          "Error: segmented load out of bounds at pc 1 (SLOAD): segment 5, "
+          "offset 0, never mapped\n", fault_never_mapped_test },
+        { "fault-double-unmap", NULL,
+          "Error: unmap of segment 0 or of an unmapped segment at pc 3 "
+          "(INACTIVATE): segment 1, not mapped (unmapped 1 time)\n", 
+          fault_double_unmap_test },
+        { "fault-bad-jump", NULL,
+          "Error: jump outside the program at pc 1 (LOADP): segment 0, "
+          "offset 100, 3 words long\n", fault_bad_jump_test },
+        { "fault-divide", NULL, 
+          "Error: division by zero at pc 1 (DIV)\n", fault_divide_test },
+        { "fault-opcode", NULL,
+          "Error: illegal instruction at pc 1 (ILLEGAL)\n", 
+          fault_opcode_test },
+        { "unpack",       NULL, "AB", unpack_test }
 };
 
   
@@ -14,30 +14,129 @@
 #include <bitpack.h>
 #include <assert.h>
 #include "SegMem.h"
+#include "decode.h"
+#include "UmIO.h"
+#include "jit.h"
+#include "UmProfile.h"
 #include <math.h>
+#include <string.h>
+
+/* the number of registers, used to size the register file */
+#define REGISTERS 8
+
+/* the pre-decoded $m[0], defined below */
+struct Program;
 
 /* declare private functions */
-static inline void loadp_helper(uint32_t rb, uint32_t rc, UM_T um);
-static inline void input_helper(unsigned c, UM_T um);
+static inline void loadp_helper(uint32_t rb, UM_T um);
+static void predecode(UM_T um);
+static UM_T build_um(SegMem_T seg_mem, struct Program *program, 
+                     UmIO_T io);
+static inline Um_decoded *own_code(UM_T um);
+static void copy_program(UM_T um);
+static void release_program(struct Program *program);
+static void set_state(UM_T um, const uint32_t registers[8], 
+                      uint32_t program_counter);
+static void get_state(UM_T um, uint32_t registers[8], 
+                      uint32_t *program_counter);
+static void describe_segment(SegMem_T seg_mem, uint32_t segid, char *text, 
+                             size_t size);
+#ifdef UM_DEBUG
 static inline void decode_execute(UM_T um, uint32_t instruction, bool *halt);
+#endif
+#ifdef UM_FUSION_STATS
+static void report_fusions(UM_T um);
+#endif
+
+/* 
+ * Dispatch engine for the fast execution core. With GCC or Clang every 
+ * handler ends in its own indirect jump through a table of label addresses 
+ * (computed goto), so the branch predictor sees one jump per opcode. 
+ * Defining UM_DISPATCH_SWITCH (make DISPATCH=switch) selects the portable 
+ * switch loop instead.
+ */
+#if defined(__GNUC__) && !defined(UM_DISPATCH_SWITCH)
+#define UM_COMPUTED_GOTO 1
+#endif
+
+/* fetch the next pre-decoded instruction, no bit extraction needed */
+#define FETCH_DECODE() do {                                     \
+        FETCH_HOOK();                                           \
+        ins = &code[pc++];                                      \
+        a = ins->a;                                             \
+        b = ins->b;                                             \
+        c = ins->c;                                             \
+} while (0)
+
+#ifdef UM_COMPUTED_GOTO
+#define DISPATCH() do {                                         \
+        FETCH_DECODE();                                         \
+        goto *dispatch_table[ins->opcode];                      \
+} while (0)
+#define OPCODE(op, label) label:
+#define OPCODE_ILLEGAL(label) label:
+#define NEXT DISPATCH()
+#else
+#define OPCODE(op, label) case op:
+#define OPCODE_ILLEGAL(label) default:
+#define NEXT continue
+#endif
+
+/* 
+ * Building with -DUM_FUSION_STATS (make FUSION_STATS=1) counts how often 
+ * each superinstruction runs and reports it on stderr when the UM is freed
+ */
+#ifdef UM_FUSION_STATS
+#define FUSION_FIRED(op) (um->fusions[(op) - FUSED_FIRST]++)
+#else
+#define FUSION_FIRED(op) ((void)0)
+#endif
+
+/* 
+ * A snapshot starts with SNAPSHOT_MAGIC ("UMS1" read as a little-endian 
+ * word, so a snapshot from a host of the other byte order is rejected), 
+ * the program counter and the registers
+ */
+#define SNAPSHOT_MAGIC 0x31534D55u
+#define SNAPSHOT_HEADER_WORDS (2 + REGISTERS)
+
+/* 
+ * The records of the pre-decoded $m[0]. A forked UM shares them with its 
+ * parent until one of them changes $m[0]; the count is atomic since forked
+ * UMs may run on different threads.
+ */
+struct Program {
+        unsigned refs; /* number of UMs using the records */
+        unsigned capacity; /* records there is room for, minus the sentinel */
+        Um_decoded code[]; /* the records */
+};
+
+/* room for the text of um_fault */
+#define FAULT_REPORT 160
 
 /* declare the um struct */
 struct UM_T {
-	int program_counter; 
-	Seq_T registers; /* a sequence of 8 registers */
+	uint32_t program_counter; 
+#ifdef UM_DEBUG
+	Seq_T registers; /* a sequence of 8 registers (debug build only) */
+#else
+	uint32_t registers[REGISTERS]; /* the 8 general purpose registers */
+#endif
 	SegMem_T seg_mem; /* segmented memory */
-	FILE *input; /* input device */
-	FILE *output; /* output device */
+	Um_decoded *code; /* pre-decoded copy of $m[0], program->code */
+	struct Program *program; /* holds the records, see below */
+	UmIO_T io; /* buffered input and output device */
+	uint64_t instructions; /* instructions run by um_run */
+	const char *fault; /* why the program failed in um_run, or NULL */
+	char fault_report[FAULT_REPORT]; /* the fault in detail, see um_fault */
+	bool halted; /* the program halted in um_run */
+	uint32_t load_stop; /* see fetch_decode_execute_to_load, 0 if unset */
+#ifdef UM_FUSION_STATS
+	unsigned long fusions[FUSED_END - FUSED_FIRST]; /* times each ran */
+#endif
 };
 
-/* declare the opcodes, each represents a instruction */
-typedef enum Um_opcode {
-        CMOV = 0, SLOAD, SSTORE, ADD, MUL, DIV,
-        NAND, HALT, ACTIVATE, INACTIVATE, OUT, IN, LOADP, LV
-} Um_opcode;
-
 /* declare constants */
-const int REGISTERS = 8;
 const int REGISTER_WIDTH = 3;
 const int OPCODE_WIDTH = 4;
 const int INSTRUCTION_WIDTH = 32;
@@ -54,7 +153,8 @@ const int VAL_WIDTH = 25;
 *      FILE* input:			the input stream used in I/O device
 *      FILE* output:			the output stream used in I/O device
 *
-* Returns: An initialized UM struct
+* Returns: An initialized UM struct, or NULL if the program could not be 
+*          loaded (an error message has been printed)
 * Expects: The instructions cannot be NULL
 *
 * Notes: 
@@ -67,39 +167,155 @@ UM_T new_um(FILE *instructions, FILE *input, FILE *output)
 {
         assert(instructions != NULL);
 
+        /* initialize the segmented memory */
+        SegMem_T seg_mem = initialize_segmem();
+        assert(seg_mem != NULL);
+        if (!populate_seg(seg_mem, instructions)) {
+                seg_free(seg_mem);
+                return NULL;
+        }
+        return build_um(seg_mem, NULL, umio_new(input, output));
+}
+
+/* new_um_words
+*
+* Initialize the UM struct with a program that is already in memory
+*
+* Parameters:
+*      const uint32_t *words:		The instructions of the program
+*      unsigned length:			The number of instructions
+*      FILE* input:			the input stream used in I/O device
+*      FILE* output:			the output stream used in I/O device
+*
+* Returns: An initialized UM struct
+* Expects: words cannot be NULL unless length is 0
+*
+* Notes: 
+* Used by programs generated by um2c. The words are copied, and the UM is 
+* deallocated by calling um_free
+*/
+UM_T new_um_words(const uint32_t *words, unsigned length, 
+                  FILE *input, FILE *output)
+{
+        SegMem_T seg_mem = initialize_segmem();
+        assert(seg_mem != NULL);
+        populate_seg_words(seg_mem, words, length);
+        return build_um(seg_mem, NULL, umio_new(input, output));
+}
+
+/* new_um_callbacks
+*
+* Initialize the UM struct by reading from the file, with an I/O device that
+* calls back into the client instead of using streams
+*
+* Parameters:
+*      FILE * instructions:		The input file with instructions in it
+*      UmIO_read *read:			The input callback, see UmIO.h
+*      UmIO_write *write:		The output callback, see UmIO.h
+*      void *cl:			Passed to both callbacks
+*
+* Returns: An initialized UM struct, or NULL if the program could not be 
+*          loaded (an error message has been printed)
+* Expects: The instructions, read and write cannot be NULL
+*
+* Notes: 
+* CRE if instructions, read or write is NULL
+* Run with um_run, the UM never blocks on its input: when read has nothing, 
+* um_run returns UM_WAITING with the state of the UM saved, and the next 
+* um_run continues with the input instruction. An event loop can host many
+* interactive UMs on a few threads this way.
+*/
+UM_T new_um_callbacks(FILE *instructions, UmIO_read *read, 
+                      UmIO_write *write, void *cl)
+{
+        assert(instructions != NULL);
+        SegMem_T seg_mem = initialize_segmem();
+        assert(seg_mem != NULL);
+        if (!populate_seg(seg_mem, instructions)) {
+                seg_free(seg_mem);
+                return NULL;
+        }
+        return build_um(seg_mem, NULL, umio_new_callbacks(read, write, cl));
+}
+
+/* build_um
+*
+* Helper that allocates a UM around a segmented memory whose $m[0] holds 
+* the program
+*
+* Parameters:
+*      SegMem_T seg_mem:		The populated segmented memory
+*      struct Program *program:		The pre-decoded $m[0] to share, or
+*                                       NULL to decode it
+*      UmIO_T io:			The I/O device of the UM
+*
+* Returns: An initialized UM struct
+* Expects: seg_mem and io cannot be NULL
+*
+* Notes: The UM takes ownership of seg_mem and io
+*/
+static UM_T build_um(SegMem_T seg_mem, struct Program *program, UmIO_T io)
+{
         UM_T um = malloc(sizeof(struct UM_T));
         assert(um != NULL);
 
         /* initialize the program counter */
         um->program_counter = 0;
 
-        /* initialize the registers */
+        /* initialize the registers to 0 */
+#ifdef UM_DEBUG
         um->registers = Seq_new(REGISTERS);
         assert(um->registers != NULL);
-
-        /* initialize the registers to 0 */
         for (int i = 0; i < REGISTERS; i++) {
                 Seq_addhi(um->registers, (void *)(uintptr_t)0);
         }
+#else
+        memset(um->registers, 0, sizeof(um->registers));
+#endif
 
-        /* initialize the segmented memory */
-        um->seg_mem = initialize_segmem();
-        assert(um->seg_mem != NULL);
-        populate_seg(um->seg_mem, instructions);
+        um->seg_mem = seg_mem;
+        um->instructions = 0;
+        um->fault = NULL;
+        um->halted = false;
+        um->load_stop = 0;
+#ifdef UM_FUSION_STATS
+        memset(um->fusions, 0, sizeof(um->fusions));
+#endif
+
+        /* pre-decode the program, or share the records of the parent */
+        um->program = program;
+        if (program != NULL) {
+                __atomic_add_fetch(&program->refs, 1, __ATOMIC_RELAXED);
+                um->code = program->code;
+        } else {
+                predecode(um);
+        }
 
-        /* initialize the input and output streams */
-        um->input = input;
-        um->output = output;
-        assert(um->input != NULL);
-        assert(um->output != NULL);
+        assert(io != NULL);
+        um->io = io;
         
         return um;
 }
 
+#ifndef UM_DEBUG
+/* the normal, profiling, bounded and sliced execution loops, see execute.h */
+#define EXECUTE execute
+#include "execute.h"
+#define UM_PROFILE
+#define EXECUTE execute_profile
+#include "execute.h"
+#define UM_BOUNDED
+#define EXECUTE execute_bounded
+#include "execute.h"
+#define UM_SLICED
+#define EXECUTE execute_sliced
+#include "execute.h"
+#endif
+
 /* fetch_decode_execute
 *
 * Executes the program stored in $m[0]. Communicates with the registers and the
-* segmented memory using the functions defined in SegMem.h and registers.h. 
+* segmented memory using the functions defined in SegMem.h. 
 *
 * Parameters:
 *      UM um:		The UM to be executed
@@ -109,14 +325,29 @@ UM_T new_um(FILE *instructions, FILE *input, FILE *output)
 *
 * Notes: 
 * CRE if UM is NULL
-* this function deallocates the memory of the segmented memory
+* The registers and the program counter are kept in locals for the duration 
+* of the loop so the compiler can hold them in machine registers; they are 
+* written back to the UM struct when the program halts. Building with 
+* -DUM_DEBUG selects the original Seq_T based execution core instead.
+* Instructions are fetched from the pre-decoded copy of $m[0], which is 
+* patched when SSTORE writes to $m[0] and rebuilt when LOADP replaces it.
+* A superinstruction runs its own operands and then the plain record that 
+* follows it, skipping one dispatch.
+* The loop itself is in execute.h, which is compiled again for 
+* fetch_decode_execute_profile, fetch_decode_execute_until and um_run; 
+* fetch_decode_execute_checked and fetch_decode_execute_to_load share the 
+* copy of um_run.
+* The program also stops, with the UM left on the instruction, when 
+* ACTIVATE would exceed the memory limit of seg_set_limit; um_fault then 
+* says so.
 */
 void fetch_decode_execute(UM_T um)
 {
         assert(um != NULL);
         assert(um->seg_mem != NULL);
-        assert(um->registers != NULL);
 
+#ifdef UM_DEBUG
+        assert(um->registers != NULL);
         bool halt = false;
 
         while (!halt) {
@@ -131,8 +362,77 @@ void fetch_decode_execute(UM_T um)
                 decode_execute(um, instruction, &halt);
 
         }
+#else
+        execute(um, NULL, 0, false);
+#endif
+}
+
+/* fetch_decode_execute_profile
+*
+* Executes the program stored in $m[0] like fetch_decode_execute, with a 
+* separately compiled copy of the loop that counts every instruction, LOADP,
+* map and unmap in prof
+*
+* Parameters:
+*      UM um:			The UM to be executed
+*      UmProfile_T prof:	The profile that receives the counts
+*
+* Returns: None
+* Expects: The UM and prof cannot be NULL
+*
+* Notes: 
+* CRE if UM or prof is NULL
+* The debug build has no profiling loop; it runs the program and leaves 
+* prof empty.
+*/
+void fetch_decode_execute_profile(UM_T um, UmProfile_T prof)
+{
+        assert(um != NULL);
+        assert(prof != NULL);
+#ifdef UM_DEBUG
+        fetch_decode_execute(um);
+#else
+        execute_profile(um, prof, 0, false);
+#endif
+}
+
+/* fetch_decode_execute_jit
+*
+* Executes the program stored in $m[0] with the x86-64 JIT compiler, which
+* translates basic blocks of $m[0] into native code. Falls back to 
+* fetch_decode_execute() when the host is not supported or in the debug 
+* build.
+*
+* Parameters:
+*      UM um:		The UM to be executed
+*
+* Returns: None
+* Expects: The UM cannot be NULL
+*
+* Notes: 
+* CRE if UM is NULL
+* The pre-decoded copy of $m[0] is rebuilt afterwards, since the JIT does not
+* maintain it.
+*/
+void fetch_decode_execute_jit(UM_T um)
+{
+        assert(um != NULL);
+#ifdef UM_DEBUG
+        fetch_decode_execute(um);
+#else
+        Jit_T jit = jit_new(um->seg_mem, um->io);
+        if (jit == NULL) {
+                fetch_decode_execute(um);
+                return;
+        }
+        jit_run(jit, um->registers, &um->program_counter);
+        jit_free(jit);
+        umio_flush(um->io);
+        predecode(um);
+#endif
 }
 
+#ifdef UM_DEBUG
 /* decode_execute
 *
 * Helper functio that executes the instruction by retrieving the opcode and 
@@ -209,6 +509,12 @@ static inline void decode_execute(UM_T um, uint32_t instruction, bool *halt)
                         break;
                         case ACTIVATE:{
                                 uint32_t segid = map_seg(um->seg_mem, rc);
+                                if (segid == 0) {
+                                        um->fault = "memory limit exceeded";
+                                        um->program_counter--;
+                                        *halt = true;
+                                        break;
+                                }
                                 Seq_put(um->registers, b, 
                                         (void *)(uintptr_t)segid);
                         break;
@@ -217,14 +523,15 @@ static inline void decode_execute(UM_T um, uint32_t instruction, bool *halt)
                                 unmap_seg(um->seg_mem, rc);
                         break;
                         case OUT:
-                                assert(rc <= MAX_VAL);
-                                fprintf(um->output, "%c", (char)rc);
+                                umio_put(um->io, rc);
                         break;
                         case IN: 
-                                input_helper(c, um);
+                                Seq_put(um->registers, c, 
+                                        (void *)(uintptr_t)umio_get(um->io));
                         break;
                         case LOADP:
-                                loadp_helper(rb, rc, um);
+                                loadp_helper(rb, um);
+                                um->program_counter = rc;
                         break;
                 }
         } else {
@@ -235,6 +542,506 @@ static inline void decode_execute(UM_T um, uint32_t instruction, bool *halt)
                 Seq_put(um->registers, a, (void *)(uintptr_t)val);
         }
 }
+#endif
+
+/* um_fork
+*
+* Create a copy of a UM that continues from the same state, with its own 
+* I/O device. The segmented memory is shared copy-on-write (see seg_fork), 
+* and so is the pre-decoded $m[0], so forking copies no words or records.
+*
+* Parameters:
+*      UM um:				The UM to be copied
+*      FILE* input:			the input stream of the copy
+*      FILE* output:			the output stream of the copy
+*
+* Returns: the new UM, which is deallocated by calling um_free
+* Expects: The UM, input and output cannot be NULL
+*
+* Notes: 
+* CRE if UM is NULL
+* um must not be running. Pending output of um is flushed first; input it 
+* read ahead is not passed on. The two UMs can then run independently, also
+* on different threads, and be freed in any order. Forked UMs run with the
+* interpreter even when the JIT is asked for.
+*/
+UM_T um_fork(UM_T um, FILE *input, FILE *output)
+{
+        assert(um != NULL);
+        umio_flush(um->io);
+        uint32_t registers[REGISTERS];
+        uint32_t program_counter;
+        get_state(um, registers, &program_counter);
+        UM_T fork = build_um(seg_fork(um->seg_mem), um->program, 
+                             umio_new(input, output));
+        set_state(fork, registers, program_counter);
+        fork->halted = um->halted;
+        fork->fault = um->fault;
+        return fork;
+}
+
+/* um_resume
+*
+* Continue running the UM from the given registers and program counter with
+* the interpreter, until the program halts. $m[0] may have been changed 
+* since the UM last ran.
+*
+* Parameters:
+*      UM um:				The UM struct
+*      const uint32_t registers[8]:	The values of the registers
+*      uint32_t program_counter:	The address to continue at
+*
+* Returns: None
+* Expects: UM to be not NULL.
+*
+* Notes: Used as the fallback of programs generated by um2c when they load a
+* new program or modify their own code
+*/
+void um_resume(UM_T um, const uint32_t registers[8], uint32_t program_counter)
+{
+        assert(um != NULL);
+        assert(registers != NULL);
+        set_state(um, registers, program_counter);
+        predecode(um);
+        fetch_decode_execute(um);
+}
+
+/* fetch_decode_execute_until
+*
+* Executes the program stored in $m[0] like fetch_decode_execute, but stops
+* after the given number of instructions or, if on_input is set, in front of
+* the first input instruction
+*
+* Parameters:
+*      UM um:			The UM to be executed
+*      uint64_t instructions:	The most instructions to execute
+*      bool on_input:		Whether to stop in front of an input 
+*
+* Returns: true if the UM stopped, false if the program halted first
+* Expects: The UM cannot be NULL
+*
+* Notes: 
+* CRE if UM is NULL
+* A stopped UM keeps the registers and the address of the next instruction,
+* and pending output has been flushed, so it can be saved with um_snapshot 
+* or run further with any fetch_decode_execute function. Uses a separately 
+* compiled copy of the loop (see execute.h), so the normal loop does not 
+* count instructions.
+*/
+bool fetch_decode_execute_until(UM_T um, uint64_t instructions, 
+                                bool on_input)
+{
+        assert(um != NULL);
+#ifdef UM_DEBUG
+        bool halt = false;
+        while (!halt) {
+                uint32_t instruction = seg_load(um->seg_mem, 0, 
+                                                um->program_counter);
+                if (instructions == 0 || (on_input && instruction >> 
+                    (INSTRUCTION_WIDTH - OPCODE_WIDTH) == IN)) {
+                        umio_flush(um->io);
+                        return true;
+                }
+                instructions--;
+                um->program_counter++;
+                decode_execute(um, instruction, &halt);
+        }
+        return false;
+#else
+        Um_status status = execute_bounded(um, NULL, instructions, on_input);
+        return status == UM_BUDGET || status == UM_WAITING;
+#endif
+}
+
+/* fetch_decode_execute_to_load
+*
+* Executes the program stored in $m[0] with the checks of um_run until a 
+* LOADP replaces $m[0] with a program of at least min_length words, e.g. 
+* the one a self-decompressing image unpacks
+*
+* Parameters:
+*      UM um:			The UM to be executed
+*      uint32_t min_length:	The length of the program to stop after
+*
+* Returns: true if the UM stopped after such a load, false if the program 
+*          halted or failed first
+* Expects: The UM cannot be NULL, min_length cannot be 0
+*
+* Notes: 
+* CRE if UM is NULL or min_length is 0
+* The UM stops on the first instruction of the new program, with pending 
+* output flushed, so it can be saved with um_snapshot and then run further 
+* with any fetch_decode_execute function. Faults are reported by um_fault 
+* as in fetch_decode_execute_checked. The loop of um_run only looks at 
+* min_length when a program is loaded, so it runs at full speed.
+*/
+bool fetch_decode_execute_to_load(UM_T um, uint32_t min_length)
+{
+        assert(um != NULL);
+        assert(min_length != 0);
+        if (um->halted || um->fault != NULL) {
+                return false;
+        }
+#ifdef UM_DEBUG
+        bool halt = false;
+        while (!halt) {
+                uint32_t instruction = seg_load(um->seg_mem, 0, 
+                                                um->program_counter);
+                uint32_t registers[REGISTERS], pc;
+                get_state(um, registers, &pc);
+                bool load = instruction >> (INSTRUCTION_WIDTH - 
+                                            OPCODE_WIDTH) == LOADP &&
+                            registers[(instruction >> REGISTER_WIDTH) & 7]
+                            != 0;
+                um->program_counter++;
+                decode_execute(um, instruction, &halt);
+                if (load && (uint32_t)seg_length(um->seg_mem, 0) >= 
+                    min_length) {
+                        umio_flush(um->io);
+                        return true;
+                }
+        }
+        return false;
+#else
+        um->load_stop = min_length;
+        Um_status status = execute_sliced(um, NULL, UINT64_MAX, false);
+        um->load_stop = 0;
+        um->halted = status == UM_HALTED;
+        return status == UM_BUDGET;
+#endif
+}
+
+/* um_run
+*
+* Run the program in $m[0] for a slice of about max_instructions 
+* instructions, so that many UMs can take turns on one thread
+*
+* Parameters:
+*      UM um:				The UM to be executed
+*      uint64_t max_instructions:	The budget of the slice
+*
+* Returns: UM_HALTED once the program has halted, UM_BUDGET when the budget
+*          is spent, UM_WAITING when the next instruction is an input and no
+*          input is ready, UM_FAULT when the program failed
+* Expects: The UM cannot be NULL
+*
+* Notes: 
+* CRE if UM is NULL
+* Unless the program halted or failed, calling um_run again continues it; a 
+* halted or failed UM keeps returning the same status. The budget is only 
+* checked at LOADP, so a slice overshoots by the rest of the straight-line
+* run it ends in, and a program that never jumps runs in one slice. The 
+* checks that are assertions elsewhere make a fault here instead: the PC is 
+* left on the failing instruction and um_fault says what went wrong. The 
+* debug build checks the budget on every instruction and keeps the 
+* assertions.
+*/
+Um_status um_run(UM_T um, uint64_t max_instructions)
+{
+        assert(um != NULL);
+        if (um->halted) {
+                return UM_HALTED;
+        }
+        if (um->fault != NULL) {
+                return UM_FAULT;
+        }
+        if (max_instructions == 0) {
+                return UM_BUDGET;
+        }
+#ifdef UM_DEBUG
+        Um_status status = UM_BUDGET;
+        bool halt = false;
+        for (uint64_t ran = 0; ran < max_instructions && !halt; ran++) {
+                uint32_t instruction = seg_load(um->seg_mem, 0, 
+                                                um->program_counter);
+                if (instruction >> (INSTRUCTION_WIDTH - OPCODE_WIDTH) == IN
+                    && !umio_ready(um->io)) {
+                        status = UM_WAITING;
+                        break;
+                }
+                um->program_counter++;
+                um->instructions++;
+                decode_execute(um, instruction, &halt);
+        }
+        umio_flush(um->io);
+        if (halt) {
+                status = um->fault != NULL ? UM_FAULT : UM_HALTED;
+        }
+#else
+        Um_status status = execute_sliced(um, NULL, max_instructions, true);
+#endif
+        um->halted = status == UM_HALTED;
+        return status;
+}
+
+/* fetch_decode_execute_checked
+*
+* Executes the program stored in $m[0] like fetch_decode_execute, with the 
+* checks of um_run: an instruction that would fail stops the program
+*
+* Parameters:
+*      UM um:		The UM to be executed
+*
+* Returns: None
+* Expects: The UM cannot be NULL
+*
+* Notes: 
+* CRE if UM is NULL
+* Meant for images that are not trusted. Uses the loop of um_run with no 
+* budget, waiting for input like the normal loop. When the program fails, 
+* the UM is left on the failing instruction and um_fault says what went 
+* wrong. The debug build keeps its assertions.
+*/
+void fetch_decode_execute_checked(UM_T um)
+{
+        assert(um != NULL);
+        if (um->halted || um->fault != NULL) {
+                return;
+        }
+#ifdef UM_DEBUG
+        fetch_decode_execute(um);
+        um->halted = um->fault == NULL;
+#else
+        um->halted = execute_sliced(um, NULL, UINT64_MAX, false) 
+                     == UM_HALTED;
+#endif
+}
+
+/* um_fault
+*
+* Tell why the program of the UM failed
+*
+* Parameters:
+*      UM um:		The UM struct
+*
+* Returns: a description of the fault, or NULL if the program has not 
+*          failed
+* Expects: UM to be not NULL.
+*
+* Notes: 
+* The description names the failure, the address and opcode of the 
+* failing instruction and, for segment accesses, the segment id, the 
+* offset and the state of the segment, e.g. "segmented load out of bounds 
+* at pc 12 (SLOAD): segment 3, offset 9, 4 words long". It is valid until
+* the next call.
+*/
+const char *um_fault(UM_T um)
+{
+        assert(um != NULL);
+        if (um->fault == NULL) {
+                return NULL;
+        }
+        uint32_t r[REGISTERS];
+        uint32_t pc;
+        get_state(um, r, &pc);
+        SegMem_T seg_mem = um->seg_mem;
+        if (pc >= (unsigned)seg_length(seg_mem, 0)) {
+                snprintf(um->fault_report, FAULT_REPORT, "%s at pc %u", 
+                         um->fault, pc);
+                return um->fault_report;
+        }
+        Um_decoded ins = decode_word(seg_load(seg_mem, 0, pc));
+        char segment[64];
+        uint32_t segid = 0, offset = 0;
+        bool access = true;
+        if (ins.opcode == SLOAD || ins.opcode == LOADP) {
+                segid = r[ins.b];
+                offset = r[ins.c];
+        } else if (ins.opcode == SSTORE) {
+                segid = r[ins.a];
+                offset = r[ins.b];
+        } else if (ins.opcode == INACTIVATE) {
+                segid = r[ins.c];
+                access = false;
+        } else {
+                snprintf(um->fault_report, FAULT_REPORT, "%s at pc %u (%s)", 
+                         um->fault, pc, opcode_name(ins.opcode));
+                return um->fault_report;
+        }
+        describe_segment(seg_mem, segid, segment, sizeof(segment));
+        if (access) {
+                snprintf(um->fault_report, FAULT_REPORT, 
+                         "%s at pc %u (%s): segment %u, offset %u, %s", 
+                         um->fault, pc, opcode_name(ins.opcode), segid, 
+                         offset, segment);
+        } else {
+                snprintf(um->fault_report, FAULT_REPORT, 
+                         "%s at pc %u (%s): segment %u, %s", um->fault, pc,
+                         opcode_name(ins.opcode), segid, segment);
+        }
+        return um->fault_report;
+}
+
+/* um_instructions
+*
+* Return the number of instructions the UM has run with um_run
+*
+* Parameters:
+*      UM um:		The UM struct
+*
+* Returns: the instruction count; a fused pair counts as two
+* Expects: UM to be not NULL.
+*
+* Notes: Only um_run counts, the other loops stay free of counting
+*/
+uint64_t um_instructions(UM_T um)
+{
+        assert(um != NULL);
+        return um->instructions;
+}
+
+/* um_state
+*
+* Read the registers and the program counter of a stopped UM
+*
+* Parameters:
+*      UM um:				The UM struct
+*      uint32_t registers[8]:		Receives the values of the registers
+*      uint32_t *program_counter:	Receives the address of the next 
+*                                       instruction
+*
+* Returns: None
+* Expects: UM, registers and program_counter to be not NULL.
+*
+* Notes: Used to checksum a UM between slices of um_run, see UmTrace.c
+*/
+void um_state(UM_T um, uint32_t registers[8], uint32_t *program_counter)
+{
+        assert(um != NULL);
+        assert(registers != NULL && program_counter != NULL);
+        get_state(um, registers, program_counter);
+}
+
+/* um_snapshot
+*
+* Write the state of the UM to a snapshot file: the program counter, the 
+* registers and the whole segmented memory
+*
+* Parameters:
+*      UM um:			The UM to be saved
+*      FILE *snapshot:		The stream the snapshot is written to
+*
+* Returns: true if the snapshot was written
+* Expects: The UM and snapshot cannot be NULL
+*
+* Notes: 
+* CRE if UM or snapshot is NULL
+* The file holds native-endian words: SNAPSHOT_MAGIC, the program counter 
+* and the 8 registers, then the image written by seg_snapshot. The I/O 
+* device is not saved, so input that was read ahead but not yet consumed 
+* is lost; snapshots taken in front of an input have none.
+*/
+bool um_snapshot(UM_T um, FILE *snapshot)
+{
+        assert(um != NULL);
+        assert(snapshot != NULL);
+        uint32_t header[SNAPSHOT_HEADER_WORDS];
+        header[0] = SNAPSHOT_MAGIC;
+        get_state(um, &header[2], &header[1]);
+        return fwrite(header, sizeof(uint32_t), SNAPSHOT_HEADER_WORDS, 
+                      snapshot) == SNAPSHOT_HEADER_WORDS
+               && seg_snapshot(um->seg_mem, snapshot);
+}
+
+/* um_restore
+*
+* Initialize a UM from a snapshot written by um_snapshot, ready to continue 
+* the program where it was saved
+*
+* Parameters:
+*      FILE *snapshot:			The snapshot file
+*      FILE* input:			the input stream used in I/O device
+*      FILE* output:			the output stream used in I/O device
+*
+* Returns: An initialized UM struct, or NULL if the file is not a valid 
+*          snapshot (an error message has been printed)
+* Expects: snapshot cannot be NULL
+*
+* Notes: 
+* CRE if snapshot is NULL
+* The segments are mapped from the file rather than read (see seg_restore),
+* so the cost of a restore hardly depends on the size of the memory. The UM
+* is deallocated by calling um_free.
+*/
+UM_T um_restore(FILE *snapshot, FILE *input, FILE *output)
+{
+        assert(snapshot != NULL);
+        uint32_t header[SNAPSHOT_HEADER_WORDS];
+        SegMem_T seg_mem = seg_restore(snapshot, header, 
+                                       SNAPSHOT_HEADER_WORDS);
+        if (seg_mem == NULL) {
+                return NULL;
+        }
+        if (header[0] != SNAPSHOT_MAGIC) {
+                fprintf(stderr, "Error: not a UM snapshot\n");
+                seg_free(seg_mem);
+                return NULL;
+        }
+        UM_T um = build_um(seg_mem, NULL, umio_new(input, output));
+        set_state(um, &header[2], header[1]);
+        return um;
+}
+
+/* um_set_callbacks
+*
+* Replace the I/O device of the UM with one that calls back into the 
+* client, e.g. for a UM that was restored or forked from streams
+*
+* Parameters:
+*      UM um:			The UM struct
+*      UmIO_read *read:		The input callback, see UmIO.h
+*      UmIO_write *write:	The output callback, see UmIO.h
+*      void *cl:		Passed to both callbacks
+*
+* Returns: None
+* Expects: UM, read and write to be not NULL.
+*
+* Notes: 
+* um must not be running. Pending output goes to the old device before it 
+* is freed; input it read ahead is dropped.
+*/
+void um_set_callbacks(UM_T um, UmIO_read *read, UmIO_write *write, void *cl)
+{
+        assert(um != NULL);
+        umio_free(um->io);
+        um->io = umio_new_callbacks(read, write, cl);
+}
+
+/* um_seg_mem
+*
+* Return the segmented memory of the UM
+*
+* Parameters:
+*      UM um:		The UM struct
+*
+* Returns: the SegMem_T owned by the UM
+* Expects: UM to be not NULL.
+*
+* Notes: The segmented memory is freed by um_free
+*/
+SegMem_T um_seg_mem(UM_T um)
+{
+        assert(um != NULL);
+        return um->seg_mem;
+}
+
+/* um_io
+*
+* Return the I/O device of the UM
+*
+* Parameters:
+*      UM um:		The UM struct
+*
+* Returns: the UmIO_T owned by the UM
+* Expects: UM to be not NULL.
+*
+* Notes: The I/O device is freed by um_free
+*/
+UmIO_T um_io(UM_T um)
+{
+        assert(um != NULL);
+        return um->io;
+}
 
 /* um_free
 *
@@ -247,74 +1054,265 @@ static inline void decode_execute(UM_T um, uint32_t instruction, bool *halt)
 * Expects: UM to be not NULL.
 *
 * Notes: 
-* this function deallocates the memory of the segmented memory(SegMem_T) and 
-* registers 
+* this function flushes pending output and deallocates the memory of the 
+* segmented memory(SegMem_T), the I/O device and registers 
 */
 void um_free(UM_T um)
 {
         assert(um != NULL);
+#ifdef UM_DEBUG
         Seq_free(&um->registers);
+#endif
+#ifdef UM_FUSION_STATS
+        report_fusions(um);
+#endif
+        umio_free(um->io);
         seg_free(um->seg_mem);
+        release_program(um->program);
         free(um);
         um = NULL;
 }
 
-/* input_helper
+/* loadp_helper
 *
-* a helper funcion that reads from the input stream and stores the value in the
-* register
+* a helper function that replaces $m[0] with a duplicate of $m[rb]. The 
+* caller is responsible for updating the program counter and for flushing 
+* the pre-decoded copy of $m[0].
 *
 * Parameters:
-*      UM um:		        The UM struct 
-*      unsigned c:		The register to store the value
+*      uint32_t rb:		The id of the segment to be duplicated
+*      UM um:		        The UM struct
 *
 * Returns: None
 * Expects: UM to be not NULL.
 *
-* Notes: None
+* Notes: Nothing is copied when rb is 0
 */
-static inline void input_helper(unsigned c, UM_T um)         
+static inline void loadp_helper(uint32_t rb, UM_T um) 
 {
-        uint32_t value = 0;
-        value = getc(um->input);
-        assert(value <= MAX_VAL);
-        if ((int)value == EOF) {
-                Seq_put(um->registers, c, 
-                        (void *)(uintptr_t)0xFFFFFFFF);
-        } else {
-                Seq_put(um->registers, c, 
-                        (void *)(uintptr_t)value);
+        seg_load_program(um->seg_mem, rb);
+}
+
+/* predecode
+*
+* (Re)build the pre-decoded copy of $m[0], growing the record array if the 
+* program segment got longer
+*
+* Parameters:
+*      UM um:		        The UM struct
+*
+* Returns: None
+* Expects: UM to be not NULL.
+*
+* Notes: CRE if the allocation fails. Records shared with a forked UM are 
+* left to it and new ones are allocated.
+*/
+static void predecode(UM_T um)
+{
+        unsigned length = seg_length(um->seg_mem, 0);
+        struct Program *program = um->program;
+        if (program == NULL || length > program->capacity 
+            || __atomic_load_n(&program->refs, __ATOMIC_ACQUIRE) != 1) {
+                release_program(program);
+                program = malloc(sizeof(struct Program) 
+                                 + ((size_t)length + 1) * sizeof(Um_decoded));
+                assert(program != NULL);
+                program->refs = 1;
+                program->capacity = length;
+                um->program = program;
+                um->code = program->code;
         }
+        decode_program(seg_words(um->seg_mem, 0), length, um->code);
+}
 
+/* own_code
+*
+* Return the pre-decoded copy of $m[0] so that it can be patched, copying 
+* it first if it is shared with a forked UM
+*
+* Parameters:
+*      UM um:		        The UM struct
+*
+* Returns: um->code, owned by um alone
+* Expects: UM to be not NULL.
+*
+* Notes: Called by SSTORE to $m[0]; the loop must reload its code pointer
+*/
+static inline Um_decoded *own_code(UM_T um)
+{
+        if (__atomic_load_n(&um->program->refs, __ATOMIC_ACQUIRE) != 1) {
+                copy_program(um);
+        }
+        return um->code;
 }
 
-/* loadp_helper
+/* copy_program
 *
-* a helper function that loads the program from the segmented memory and
-* stores it in the register
+* Give the UM its own copy of the pre-decoded $m[0] it shares with forked 
+* UMs
 *
 * Parameters:
-*      UM um:		        The UM struct to be freed
-*      unsigned rb:		The register that has the segment id
-*      unsigned rc:		The register to store the value of 
-*                               the program counter
+*      UM um:		        The UM struct
 *
 * Returns: None
 * Expects: UM to be not NULL.
 *
+* Notes: CRE if the allocation fails
+*/
+static void copy_program(UM_T um)
+{
+        struct Program *shared = um->program;
+        size_t records = (size_t)shared->capacity + 1;
+        struct Program *program = malloc(sizeof(struct Program) 
+                                         + records * sizeof(Um_decoded));
+        assert(program != NULL);
+        program->refs = 1;
+        program->capacity = shared->capacity;
+        memcpy(program->code, shared->code, records * sizeof(Um_decoded));
+        release_program(shared);
+        um->program = program;
+        um->code = program->code;
+}
+
+/* release_program
+*
+* Drop a reference to pre-decoded records, freeing them with the last one
+*
+* Parameters:
+*      struct Program *program:	The records, or NULL
+*
+* Returns: None
+* Expects: None
+*
 * Notes: None
 */
-static inline void loadp_helper(uint32_t rb, uint32_t rc, UM_T um) 
+static void release_program(struct Program *program)
 {
-        if (rb != 0) {
-                int length = seg_length(um->seg_mem, rb);
-                unmap_seg(um->seg_mem, 0);
-                map_seg(um->seg_mem, length);
-                for (int i = 0; i < length; i++) {
-                        uint32_t temp_ins = seg_load(um->seg_mem, rb, i);
-                        seg_store(um->seg_mem, 0, i, temp_ins);
+        if (program != NULL 
+            && __atomic_sub_fetch(&program->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+                free(program);
+        }
+}
+
+/* set_state
+*
+* Set the registers and the program counter of the UM
+*
+* Parameters:
+*      UM um:				The UM struct
+*      const uint32_t registers[8]:	The values of the registers
+*      uint32_t program_counter:	The address of the next instruction
+*
+* Returns: None
+* Expects: UM and registers to be not NULL.
+*
+* Notes: None
+*/
+static void set_state(UM_T um, const uint32_t registers[8], 
+                      uint32_t program_counter)
+{
+#ifdef UM_DEBUG
+        for (int i = 0; i < REGISTERS; i++) {
+                Seq_put(um->registers, i, (void *)(uintptr_t)registers[i]);
+        }
+#else
+        memcpy(um->registers, registers, sizeof(um->registers));
+#endif
+        um->program_counter = program_counter;
+}
+
+/* get_state
+*
+* Copy out the registers and the program counter of the UM
+*
+* Parameters:
+*      UM um:				The UM struct
+*      uint32_t registers[8]:		Receives the values of the registers
+*      uint32_t *program_counter:	Receives the address of the next 
+*                                       instruction
+*
+* Returns: None
+* Expects: UM, registers and program_counter to be not NULL.
+*
+* Notes: None
+*/
+static void get_state(UM_T um, uint32_t registers[8], 
+                      uint32_t *program_counter)
+{
+#ifdef UM_DEBUG
+        for (int i = 0; i < REGISTERS; i++) {
+                registers[i] = (uintptr_t)Seq_get(um->registers, i);
+        }
+#else
+        memcpy(registers, um->registers, sizeof(um->registers));
+#endif
+        *program_counter = um->program_counter;
+}
+
+/* describe_segment
+*
+* Write the state of a segment id for a fault report
+*
+* Parameters:
+*      SegMem_T seg_mem:	The segmented memory
+*      uint32_t segid:		The id, which may be any value
+*      char *text:		Receives the description
+*      size_t size:		The room in text
+*
+* Returns: None
+* Expects: seg_mem and text cannot be NULL
+*
+* Notes: Tells an id that was unmapped from one that was never mapped by 
+* the generation count of its table entry
+*/
+static void describe_segment(SegMem_T seg_mem, uint32_t segid, char *text, 
+                             size_t size)
+{
+        const SegTable *table = seg_table(seg_mem);
+        const SegEntry *entry = segid < table->capacity 
+                                ? &table->entries[segid] : NULL;
+        if (entry != NULL && entry->base != NULL) {
+                snprintf(text, size, "%u words long", entry->length);
+        } else if (entry != NULL && entry->generation > 0) {
+                snprintf(text, size, "not mapped (unmapped %u time%s)", 
+                         entry->generation, 
+                         entry->generation == 1 ? "" : "s");
+        } else {
+                snprintf(text, size, "never mapped");
+        }
+}
+
+#ifdef UM_FUSION_STATS
+/* report_fusions
+*
+* Print, for every superinstruction, how many times it ran and at how many 
+* addresses the fusion pass placed it in the current $m[0]
+*
+* Parameters:
+*      UM um:		        The UM struct
+*
+* Returns: None
+* Expects: UM to be not NULL.
+*
+* Notes: Only built with -DUM_FUSION_STATS; the report goes to stderr
+*/
+static void report_fusions(UM_T um)
+{
+        static const char *const names[FUSED_END - FUSED_FIRST] = {
+                "LV+ADD", "NOT+NAND", "LV+LOADP", "LV+OUT"
+        };
+        unsigned long sites[FUSED_END - FUSED_FIRST] = { 0 };
+        unsigned length = seg_length(um->seg_mem, 0);
+        for (unsigned i = 0; i < length; i++) {
+                if (um->code[i].opcode >= FUSED_FIRST) {
+                        sites[um->code[i].opcode - FUSED_FIRST]++;
                 }
         }
-        um->program_counter = rc;
 
-}
\ No newline at end of file
+        fprintf(stderr, "fusion          sites        executed\n");
+        for (int i = 0; i < FUSED_END - FUSED_FIRST; i++) {
+                fprintf(stderr, "%-12s %8lu %15lu\n", names[i], sites[i], 
+                        um->fusions[i]);
+        }
+}
+#endif
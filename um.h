@@ -14,15 +14,66 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
 #include <bitpack.h>
+#include "SegMem.h"
+#include "UmIO.h"
+#include "UmProfile.h"
 
 #define T UM_T
 typedef struct T *T;
 
+/* why um_run returned */
+typedef enum Um_status { 
+        UM_HALTED,      /* the program halted */
+        UM_BUDGET,      /* the instruction budget is spent */
+        UM_WAITING,     /* the next instruction is an input with none ready */
+        UM_FAULT        /* the program failed, see um_fault */
+} Um_status;
+
 T new_um(FILE * instructions, FILE* input, FILE* output);
 
+T new_um_words(const uint32_t *words, unsigned length, 
+               FILE *input, FILE *output);
+
+T new_um_callbacks(FILE *instructions, UmIO_read *read, UmIO_write *write,
+                   void *cl);
+
 void fetch_decode_execute(T um);
 
+void fetch_decode_execute_jit(T um);
+
+void fetch_decode_execute_checked(T um);
+
+void fetch_decode_execute_profile(T um, UmProfile_T prof);
+
+bool fetch_decode_execute_until(T um, uint64_t instructions, bool on_input);
+
+bool fetch_decode_execute_to_load(T um, uint32_t min_length);
+
+Um_status um_run(T um, uint64_t max_instructions);
+
+const char *um_fault(T um);
+
+uint64_t um_instructions(T um);
+
+void um_state(T um, uint32_t registers[8], uint32_t *program_counter);
+
+bool um_snapshot(T um, FILE *snapshot);
+
+T um_restore(FILE *snapshot, FILE *input, FILE *output);
+
+T um_fork(T um, FILE *input, FILE *output);
+
+void um_set_callbacks(T um, UmIO_read *read, UmIO_write *write, void *cl);
+
+void um_resume(T um, const uint32_t registers[8], uint32_t program_counter);
+
+SegMem_T um_seg_mem(T um);
+
+UmIO_T um_io(T um);
+
 void um_free(T um);
 
 #undef T
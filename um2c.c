@@ -0,0 +1,437 @@
+/*
+ *     um2c.c
+ *     by Elisa and Cynthia, 04/10/2025
+ *     Project 6 - um
+ *
+ *     This file includes a main function that translates a UM program into
+ *     a C program ahead of time. Every instruction address gets a label,
+ *     LOADP jumps go through computed-goto tables of those labels, and the
+ *     memory and I/O instructions call into the SegMem and UmIO modules. When
+ *     the program writes a different word into $m[0] or loads a new program,
+ *     the generated code hands its registers to the interpreter of the um
+ *     module, which finishes the run.
+ *
+ *     Stores into $m[0] are common for data, so the generated code only
+ *     falls back when it would execute a changed word. The program is cut
+ *     into runs, straight-line code that ends in LOADP, HALT or an illegal
+ *     instruction, and for each run the generated code records the highest
+ *     address that was changed. Entering a run at or below that address
+ *     goes to the interpreter.
+ *
+ *     The program is split into chunks of CHUNK instructions, one C function
+ *     each, so the C compiler never sees a control flow graph with more than
+ *     CHUNK indirect jump targets. The generated file is linked against
+ *     libum.a, see the Makefile.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <assert.h>
+#include "SegMem.h"
+#include "decode.h"
+
+/* number of instructions translated into one C function */
+#define CHUNK 256
+
+static uint32_t *find_runs(const uint32_t *words, unsigned length);
+static void emit_prologue(FILE *out, const char *name,
+                          const uint32_t *words, const uint32_t *runs,
+                          unsigned length);
+static void emit_chunk(FILE *out, const uint32_t *words, unsigned base,
+                       unsigned count);
+static bool emit_instruction(FILE *out, uint32_t word, unsigned pc);
+static void emit_main(FILE *out, unsigned length);
+
+static void usage(const char *program)
+{
+        fprintf(stderr, "Usage: %s <instructions_file> [output_file]\n",
+                program);
+}
+
+int main(int argc, char *argv[])
+{
+        /* Check for correct number of arguments */
+        if (argc != 2 && argc != 3) {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+
+        /* Open the instruction file */
+        FILE *instructions = fopen(argv[1], "r");
+        if (instructions == NULL) {
+                fprintf(stderr, "Error opening instruction file\n");
+                return EXIT_FAILURE;
+        }
+
+        /* Load the program the same way the um does */
+        SegMem_T seg_mem = initialize_segmem();
+        if (!populate_seg(seg_mem, instructions)) {
+                seg_free(seg_mem);
+                fclose(instructions);
+                return EXIT_FAILURE;
+        }
+        fclose(instructions);
+
+        FILE *out = stdout;
+        if (argc == 3) {
+                out = fopen(argv[2], "w");
+                if (out == NULL) {
+                        fprintf(stderr, "Error opening output file\n");
+                        seg_free(seg_mem);
+                        return EXIT_FAILURE;
+                }
+        }
+
+        unsigned length = seg_length(seg_mem, 0);
+        const uint32_t *words = seg_words(seg_mem, 0);
+
+        uint32_t *runs = find_runs(words, length);
+
+        emit_prologue(out, argv[1], words, runs, length);
+        for (unsigned base = 0; base < length; base += CHUNK) {
+                unsigned count = length - base < CHUNK ? length - base
+                                                       : CHUNK;
+                emit_chunk(out, words, base, count);
+        }
+        emit_main(out, length);
+
+        free(runs);
+        seg_free(seg_mem);
+        if (out != stdout && fclose(out) != 0) {
+                fprintf(stderr, "Error writing output file\n");
+                return EXIT_FAILURE;
+        }
+        return EXIT_SUCCESS;
+}
+
+/* find_runs
+*
+* Find the run of every address, named by the address of the instruction 
+* that ends it
+*
+* Parameters:
+*      const uint32_t *words:	The instructions of the program
+*      unsigned length:		The number of instructions
+*
+* Returns: a malloc'd array of length + 1 run names
+* Expects: words cannot be NULL unless length is 0
+*
+* Notes:
+* Code that runs off the end of the program belongs to the run named 
+* length. The caller frees the array.
+*/
+static uint32_t *find_runs(const uint32_t *words, unsigned length)
+{
+        uint32_t *runs = malloc(((size_t)length + 1) * sizeof(uint32_t));
+        assert(runs != NULL);
+
+        uint32_t end = length;
+        runs[length] = length;
+        for (unsigned pc = length; pc-- > 0; ) {
+                unsigned opcode = words[pc] >> 28;
+                if (opcode == LOADP || opcode == HALT || opcode > LV) {
+                        end = pc;
+                }
+                runs[pc] = end;
+        }
+        return runs;
+}
+
+/* emit_prologue
+*
+* Write the includes, the copy of the program and its runs, the state 
+* shared by the chunks and the helper functions and macros
+*
+* Parameters:
+*      FILE *out:		The output file
+*      const char *name:	The name of the instruction file
+*      const uint32_t *words:	The instructions of the program
+*      const uint32_t *runs:	The run of every address
+*      unsigned length:		The number of instructions
+*
+* Returns: None
+* Expects: out, words and runs cannot be NULL
+*
+* Notes:
+* The program is kept in the generated file so the run starts with the
+* original $m[0] and so SSTORE can tell whether a write changes the code
+*/
+static void emit_prologue(FILE *out, const char *name,
+                          const uint32_t *words, const uint32_t *runs,
+                          unsigned length)
+{
+        fprintf(out, "/* Generated by um2c from %s, do not edit */\n\n"
+                     "#include <stdio.h>\n"
+                     "#include <stdlib.h>\n"
+                     "#include <string.h>\n"
+                     "#include <stdint.h>\n"
+                     "#include \"um.h\"\n\n"
+                     "/* labels as values are a GNU extension */\n"
+                     "#pragma GCC diagnostic ignored \"-Wpedantic\"\n\n",
+                     name);
+
+        /* an empty program still needs a well-formed array */
+        fprintf(out, "#define LENGTH %uu\n"
+                     "#define CHUNK %uu\n\n", length, CHUNK);
+        fprintf(out, "static const uint32_t program[LENGTH + 1] = {");
+        for (unsigned i = 0; i < length; i++) {
+                fprintf(out, "%s0x%08x,", i % 6 == 0 ? "\n\t" : " ",
+                        (unsigned)words[i]);
+        }
+        fprintf(out, "\n\t0\n};\n\n");
+
+        fprintf(out, "static const uint32_t run_of[LENGTH + 1] = {");
+        for (unsigned i = 0; i <= length; i++) {
+                fprintf(out, "%s%u,", i % 8 == 0 ? "\n\t" : " ",
+                        (unsigned)runs[i]);
+        }
+        fprintf(out, "\n};\n\n");
+
+        /* one past the highest changed address of each run, 0 if none */
+        fprintf(out,
+                "static uint32_t stale[LENGTH + 1];\n\n"
+                "#define STALE(pc) (stale[run_of[pc]] > (pc))\n\n");
+
+        fprintf(out,
+                "enum { RUNNING, HALTED, INTERPRET };\n\n"
+                "struct state {\n"
+                "\tSegMem_T mem;\n"
+                "\tUmIO_T io;\n"
+                "\tuint32_t r[8];\n"
+                "\tint exit;\n"
+                "};\n\n");
+
+        /*
+         * A chunk keeps the registers in locals and writes them back on
+         * its single way out
+         */
+        fprintf(out,
+                "#define ENTER \\\n"
+                "\tSegMem_T mem = s->mem; \\\n"
+                "\tUmIO_T io = s->io; \\\n"
+                "\tuint32_t r0 = s->r[0], r1 = s->r[1], r2 = s->r[2], "
+                "r3 = s->r[3]; \\\n"
+                "\tuint32_t r4 = s->r[4], r5 = s->r[5], r6 = s->r[6], "
+                "r7 = s->r[7]; \\\n"
+                "\tuint32_t target; \\\n"
+                "\tint how; \\\n"
+                "\t(void)mem; \\\n"
+                "\t(void)io\n\n"
+                "#define LEAVE(pc, why) do { target = (pc); how = (why); "
+                "goto leave; } while (0)\n\n"
+                "#define EXIT \\\n"
+                "\ts->r[0] = r0; s->r[1] = r1; s->r[2] = r2; "
+                "s->r[3] = r3; \\\n"
+                "\ts->r[4] = r4; s->r[5] = r5; s->r[6] = r6; "
+                "s->r[7] = r7; \\\n"
+                "\ts->exit = how; \\\n"
+                "\treturn target\n\n");
+
+        /*
+         * A changed word ahead of pc in the current run makes the rest of
+         * the run stale at once
+         */
+        fprintf(out,
+                "static int code_store(uint32_t address, uint32_t pc)\n"
+                "{\n"
+                "\tuint32_t run = run_of[address];\n"
+                "\tif (stale[run] <= address)\n"
+                "\t\tstale[run] = address + 1;\n"
+                "\treturn run == run_of[pc] && address > pc;\n"
+                "}\n\n");
+
+        /* LOADP keeps running native code when $m[0] is the program again */
+        fprintf(out,
+                "static int same_program(SegMem_T mem)\n"
+                "{\n"
+                "\tif ((unsigned)seg_length(mem, 0) != LENGTH ||\n"
+                "\t    memcmp(seg_words(mem, 0), program, \n"
+                "\t           LENGTH * sizeof(uint32_t)) != 0)\n"
+                "\t\treturn 0;\n"
+                "\tmemset(stale, 0, sizeof(stale));\n"
+                "\treturn 1;\n"
+                "}\n\n");
+}
+
+/* emit_chunk
+*
+* Write the function of one chunk. It is entered at any address of the
+* chunk through its label table and returns the address to continue at.
+*
+* Parameters:
+*      FILE *out:		The output file
+*      const uint32_t *words:	The instructions of the program
+*      unsigned base:		The address of the first instruction
+*      unsigned count:		The number of instructions in the chunk
+*
+* Returns: None
+* Expects: out and words cannot be NULL, count is at least 1
+*
+* Notes:
+* LOADP jumps that stay within the chunk do not leave the function
+*/
+static void emit_chunk(FILE *out, const uint32_t *words, unsigned base,
+                       unsigned count)
+{
+        fprintf(out, "static uint32_t chunk_%u(struct state *s, "
+                     "uint32_t pc)\n{\n"
+                     "\tstatic void *const labels[%u] = {",
+                     base / CHUNK, count);
+        for (unsigned i = 0; i < count; i++) {
+                fprintf(out, "%s&&L%u,", i % 8 == 0 ? "\n\t\t" : " ",
+                        base + i);
+        }
+        fprintf(out, "\n\t};\n\tENTER;\n\n"
+                     "\tgoto *labels[pc - %uu];\n", base);
+
+        bool jumps = false;
+        for (unsigned i = 0; i < count; i++) {
+                jumps |= emit_instruction(out, words[base + i], base + i);
+        }
+
+        fprintf(out, "\tLEAVE(%uu, RUNNING);\n", base + count);
+        if (jumps) {
+                fprintf(out, "dispatch:\n"
+                             "\tif (target - %uu < %uu && !STALE(target))\n"
+                             "\t\tgoto *labels[target - %uu];\n"
+                             "\tLEAVE(target, RUNNING);\n",
+                             base, count, base);
+        }
+        fprintf(out, "leave:\n\tEXIT;\n}\n\n");
+}
+
+/* emit_instruction
+*
+* Write the label and the C statements of one instruction
+*
+* Parameters:
+*      FILE *out:		The output file
+*      uint32_t word:		The instruction word
+*      unsigned pc:		The address of the instruction
+*
+* Returns: true if the instruction jumps to the dispatch label of its chunk
+* Expects: out cannot be NULL
+*
+* Notes:
+* Words that are not valid instructions may be data, they only fall back
+* to the interpreter if they are ever executed, which then reports them
+*/
+static bool emit_instruction(FILE *out, uint32_t word, unsigned pc)
+{
+        Um_decoded ins = decode_word(word);
+        unsigned a = ins.a, b = ins.b, c = ins.c;
+
+        fprintf(out, "L%u:\n\t", pc);
+        switch (ins.opcode) {
+        case CMOV:
+                fprintf(out, "if (r%u != 0) r%u = r%u;\n", c, a, b);
+                break;
+        case SLOAD:
+                fprintf(out, "r%u = seg_load(mem, r%u, r%u);\n", a, b, c);
+                break;
+        case SSTORE:
+                fprintf(out, "seg_store(mem, r%u, r%u, r%u);\n"
+                             "\tif (r%u == 0 && r%u != program[r%u] && "
+                             "code_store(r%u, %uu))\n"
+                             "\t\tLEAVE(%uu, INTERPRET);\n",
+                             a, b, c, a, c, b, b, pc, pc + 1);
+                break;
+        case ADD:
+                fprintf(out, "r%u = r%u + r%u;\n", a, b, c);
+                break;
+        case MUL:
+                fprintf(out, "r%u = r%u * r%u;\n", a, b, c);
+                break;
+        case DIV:
+                fprintf(out, "r%u = r%u / r%u;\n", a, b, c);
+                break;
+        case NAND:
+                fprintf(out, "r%u = ~(r%u & r%u);\n", a, b, c);
+                break;
+        case HALT:
+                fprintf(out, "LEAVE(%uu, HALTED);\n", pc);
+                break;
+        case ACTIVATE:
+                fprintf(out, "r%u = map_seg(mem, r%u);\n", b, c);
+                break;
+        case INACTIVATE:
+                fprintf(out, "unmap_seg(mem, r%u);\n", c);
+                break;
+        case OUT:
+                fprintf(out, "umio_put(io, r%u);\n", c);
+                break;
+        case IN:
+                fprintf(out, "r%u = umio_get(io);\n", c);
+                break;
+        case LOADP:
+                fprintf(out, "if (r%u != 0) {\n"
+                             "\t\tseg_load_program(mem, r%u);\n"
+                             "\t\tif (!same_program(mem)) "
+                             "LEAVE(r%u, INTERPRET);\n"
+                             "\t}\n"
+                             "\ttarget = r%u;\n"
+                             "\tgoto dispatch;\n",
+                             b, b, c, c);
+                return true;
+        case LV:
+                fprintf(out, "r%u = 0x%xu;\n", a, (unsigned)ins.value);
+                break;
+        default:
+                fprintf(out, "LEAVE(%uu, INTERPRET);\n", pc);
+                break;
+        }
+        return false;
+}
+
+/* emit_main
+*
+* Write the chunk table and main, which runs the chunks until the program
+* halts or has to be finished by the interpreter
+*
+* Parameters:
+*      FILE *out:		The output file
+*      unsigned length:		The number of instructions
+*
+* Returns: None
+* Expects: out cannot be NULL
+*
+* Notes:
+* Running past the last instruction is left to the interpreter, which
+* reports it the same way as the um does
+*/
+static void emit_main(FILE *out, unsigned length)
+{
+        unsigned chunks = (length + CHUNK - 1) / CHUNK;
+
+        fprintf(out, "static uint32_t (*const chunks[%u])"
+                     "(struct state *, uint32_t) = {", chunks + 1);
+        for (unsigned i = 0; i < chunks; i++) {
+                fprintf(out, "%schunk_%u,", i % 6 == 0 ? "\n\t" : " ", i);
+        }
+        fprintf(out, "\n\tNULL\n};\n\n");
+
+        fprintf(out,
+                "int main(void)\n"
+                "{\n"
+                "\tUM_T um = new_um_words(program, LENGTH, stdin, stdout);\n"
+                "\tstruct state s = { um_seg_mem(um), um_io(um), "
+                "{ 0 }, RUNNING };\n"
+                "\tuint32_t pc = 0;\n\n"
+                "\twhile (s.exit == RUNNING) {\n"
+                "\t\tif (pc >= LENGTH || STALE(pc)) {\n"
+                "\t\t\ts.exit = INTERPRET;\n"
+                "\t\t\tbreak;\n"
+                "\t\t}\n"
+                "\t\tpc = chunks[pc / CHUNK](&s, pc);\n"
+                "\t}\n"
+                "\tif (s.exit == INTERPRET) {\n"
+                "\t\tum_resume(um, s.r, pc);\n"
+                "\t}\n"
+                "\t(void)same_program;\n"
+                "\t(void)code_store;\n"
+                "\tum_free(um);\n"
+                "\treturn EXIT_SUCCESS;\n"
+                "}\n");
+}
@@ -0,0 +1,525 @@
+/*
+ *     umbatch.c
+ *     by Elisa and Cynthia, 04/10/2025
+ *     Project 6 - um
+ *
+ *     This file includes a main function that runs many UM programs in one
+ *     process (um-batch). A manifest lists the jobs, one per line:
+ *
+ *         <image> [<stdin file> | -] [<expected stdout> | -]
+ *
+ *     Blank lines and lines starting with # are skipped. Every job gets its
+ *     own UM_T and runs on a pool of threads; each thread owns a deque of
+ *     jobs and steals the back half of another deque when its own is empty.
+ *     The output of a job is captured in memory and compared with the
+ *     expected output, then a line per job and a summary are printed in
+ *     manifest order. A checked runtime error in a job still aborts the
+ *     whole batch, as it aborts um, unless --checked or --max-instructions 
+ *     is given: then jobs run with the checked loop, a job that fails is 
+ *     reported as a fault and, with a budget, a job that exceeds it is 
+ *     stopped. --max-memory caps the memory of every job the same way, in
+ *     bytes with an optional K, M or G suffix as for um.
+ */
+
+/* open_memstream, strdup, clock_gettime and sysconf are POSIX */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <assert.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include "um.h"
+
+/* the most threads the pool will start */
+#define MAX_THREADS 256
+
+/* the outcome of a job */
+typedef enum {
+        JOB_PASS, /* the output matched the expected output */
+        JOB_FAIL, /* the output differed from the expected output */
+        JOB_DONE, /* the program halted, there was nothing to compare */
+        JOB_ERROR, /* a file could not be opened or the image is invalid */
+        JOB_LIMIT, /* the program ran out of instructions */
+        JOB_FAULT /* the program failed */
+} Job_status;
+
+static const char *const status_names[] = { 
+        "PASS", "FAIL", "DONE", "ERROR", "LIMIT", "FAULT" 
+};
+
+/* a line of the manifest and what happened when it ran */
+typedef struct Job {
+        char *image; /* path of the program */
+        char *input; /* path of its standard input, or NULL */
+        char *expected; /* path of the expected output, or NULL */
+        Job_status status;
+        double seconds; /* wall time of the job */
+        size_t output_bytes; /* number of bytes the program wrote */
+        char *fault; /* why the program failed, for JOB_FAULT */
+} Job;
+
+/* the jobs head..tail-1 that a thread still has to run */
+typedef struct Deque {
+        pthread_mutex_t lock;
+        size_t head, tail;
+} Deque;
+
+/* the jobs and the deques of every thread */
+typedef struct Pool {
+        Job *jobs;
+        Deque *deques;
+        unsigned threads;
+        uint64_t max_instructions; /* budget of every job, 0 for none */
+        size_t max_memory; /* memory limit of every job, 0 for none */
+        bool checked; /* run every job with the checked loop */
+} Pool;
+
+/* what a thread of the pool is started with */
+typedef struct Worker {
+        Pool *pool;
+        unsigned id;
+        pthread_t thread;
+} Worker;
+
+static Job *read_manifest(const char *path, size_t *count);
+static void *work(void *arg);
+static bool pop(Deque *deque, size_t *job);
+static bool steal(Pool *pool, unsigned thief, size_t *job);
+static void run_job(Job *job, uint64_t max_instructions, size_t max_memory,
+                    bool checked);
+static char *read_file(const char *path, size_t *size);
+static double now(void);
+
+static void usage(const char *program)
+{
+        fprintf(stderr, "Usage: %s [--threads=N] [--max-instructions=N] "
+                "[--max-memory=<bytes>[K|M|G]] [--checked] [--quiet] "
+                "<manifest>\n", 
+                program);
+}
+
+int main(int argc, char *argv[])
+{
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        unsigned threads = online > 0 ? (unsigned)online : 1;
+        bool quiet = false;
+        uint64_t max_instructions = 0;
+        size_t max_memory = 0;
+        bool checked = false;
+        int i = 1;
+
+        for (; i < argc && strncmp(argv[i], "--", 2) == 0; i++) {
+                if (strncmp(argv[i], "--threads=", 10) == 0) {
+                        const char *number = argv[i] + 10;
+                        char *end;
+                        threads = (unsigned)strtoul(number, &end, 10);
+                        if (*number < '0' || *number > '9' 
+                            || *end != '\0') {
+                                usage(argv[0]);
+                                return EXIT_FAILURE;
+                        }
+                } else if (strncmp(argv[i], "--max-instructions=", 19) 
+                           == 0) {
+                        const char *number = argv[i] + 19;
+                        char *end;
+                        max_instructions = strtoull(number, &end, 10);
+                        if (*number < '0' || *number > '9' 
+                            || *end != '\0') {
+                                usage(argv[0]);
+                                return EXIT_FAILURE;
+                        }
+                } else if (strncmp(argv[i], "--max-memory=", 13) == 0) {
+                        if (!seg_parse_limit(argv[i] + 13, &max_memory)) {
+                                usage(argv[0]);
+                                return EXIT_FAILURE;
+                        }
+                } else if (strcmp(argv[i], "--checked") == 0) {
+                        checked = true;
+                } else if (strcmp(argv[i], "--quiet") == 0) {
+                        quiet = true;
+                } else {
+                        usage(argv[0]);
+                        return EXIT_FAILURE;
+                }
+        }
+        if (argc - i != 1 || threads < 1 || threads > MAX_THREADS) {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+
+        size_t count;
+        Job *jobs = read_manifest(argv[i], &count);
+        if (jobs == NULL) {
+                return EXIT_FAILURE;
+        }
+        if (threads > count && count > 0) {
+                threads = (unsigned)count;
+        }
+
+        /* hand every thread an equal block of consecutive jobs */
+        Pool pool = { jobs, malloc(threads * sizeof(Deque)), threads, 
+                      max_instructions, max_memory, checked };
+        Worker *workers = malloc(threads * sizeof(Worker));
+        assert(pool.deques != NULL && workers != NULL);
+        for (unsigned t = 0; t < threads; t++) {
+                pthread_mutex_init(&pool.deques[t].lock, NULL);
+                pool.deques[t].head = count * t / threads;
+                pool.deques[t].tail = count * (t + 1) / threads;
+        }
+
+        double start = now();
+        for (unsigned t = 0; t < threads; t++) {
+                workers[t].pool = &pool;
+                workers[t].id = t;
+                int err = pthread_create(&workers[t].thread, NULL, work,
+                                         &workers[t]);
+                assert(err == 0);
+                (void)err;
+        }
+        for (unsigned t = 0; t < threads; t++) {
+                pthread_join(workers[t].thread, NULL);
+        }
+        double elapsed = now() - start;
+
+        size_t totals[6] = { 0, 0, 0, 0, 0, 0 };
+        double busy = 0;
+        for (size_t j = 0; j < count; j++) {
+                Job *job = &jobs[j];
+                totals[job->status]++;
+                busy += job->seconds;
+                if (!quiet || (job->status != JOB_PASS 
+                               && job->status != JOB_DONE)) {
+                        printf("%-5s %10.3f ms %8zu bytes  %s\n",
+                               status_names[job->status],
+                               job->seconds * 1000, job->output_bytes,
+                               job->image);
+                }
+                if (job->status == JOB_FAULT) {
+                        fprintf(stderr, "%s: %s\n", job->image, job->fault);
+                }
+        }
+        printf("%zu jobs: %zu passed, %zu failed, %zu errors, %zu unchecked"
+               ", %zu over the limit, %zu faults in %.3f s on %u threads "
+               "(%.3f s of jobs)\n", count,
+               totals[JOB_PASS], totals[JOB_FAIL], totals[JOB_ERROR],
+               totals[JOB_DONE], totals[JOB_LIMIT], totals[JOB_FAULT], 
+               elapsed, threads, busy);
+
+        for (unsigned t = 0; t < threads; t++) {
+                pthread_mutex_destroy(&pool.deques[t].lock);
+        }
+        for (size_t j = 0; j < count; j++) {
+                free(jobs[j].image);
+                free(jobs[j].input);
+                free(jobs[j].expected);
+                free(jobs[j].fault);
+        }
+        free(workers);
+        free(pool.deques);
+        free(jobs);
+        return totals[JOB_FAIL] + totals[JOB_ERROR] + totals[JOB_LIMIT] 
+               + totals[JOB_FAULT] == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* read_manifest
+*
+* Read the jobs of a manifest
+*
+* Parameters:
+*      const char *path:	The manifest
+*      size_t *count:		Receives the number of jobs
+*
+* Returns: a malloc'd array of jobs, or NULL if the manifest cannot be read
+* Expects: path and count cannot be NULL
+*
+* Notes: Paths cannot contain whitespace; a - stands for no input file or
+* no expected output
+*/
+static Job *read_manifest(const char *path, size_t *count)
+{
+        FILE *manifest = fopen(path, "r");
+        if (manifest == NULL) {
+                fprintf(stderr, "Error opening manifest %s\n", path);
+                return NULL;
+        }
+        size_t capacity = 64;
+        Job *jobs = malloc(capacity * sizeof(Job));
+        assert(jobs != NULL);
+        char line[4096];
+        *count = 0;
+
+        while (fgets(line, sizeof(line), manifest) != NULL) {
+                char *fields[3] = { NULL, NULL, NULL };
+                char *save;
+                char *token = strtok_r(line, " \t\r\n", &save);
+                if (token == NULL || token[0] == '#') {
+                        continue;
+                }
+                for (int f = 0; f < 3 && token != NULL; f++) {
+                        fields[f] = f > 0 && strcmp(token, "-") == 0 
+                                    ? NULL : strdup(token);
+                        token = strtok_r(NULL, " \t\r\n", &save);
+                }
+                if (*count == capacity) {
+                        capacity *= 2;
+                        jobs = realloc(jobs, capacity * sizeof(Job));
+                        assert(jobs != NULL);
+                }
+                Job *job = &jobs[(*count)++];
+                job->image = fields[0];
+                job->input = fields[1];
+                job->expected = fields[2];
+                job->status = JOB_ERROR;
+                job->seconds = 0;
+                job->output_bytes = 0;
+                job->fault = NULL;
+        }
+        fclose(manifest);
+        return jobs;
+}
+
+/* work
+*
+* The body of a thread of the pool: run jobs from its own deque, then from
+* the deques of the other threads, until every deque is empty
+*
+* Parameters:
+*      void *arg:		The Worker of the thread
+*
+* Returns: NULL
+* Expects: arg cannot be NULL
+*
+* Notes: None
+*/
+static void *work(void *arg)
+{
+        Worker *worker = arg;
+        Pool *pool = worker->pool;
+        size_t job;
+        while (pop(&pool->deques[worker->id], &job)
+               || steal(pool, worker->id, &job)) {
+                run_job(&pool->jobs[job], pool->max_instructions, 
+                        pool->max_memory, pool->checked);
+        }
+        return NULL;
+}
+
+/* pop
+*
+* Take the job at the front of a deque
+*
+* Parameters:
+*      Deque *deque:		The deque
+*      size_t *job:		Receives the index of the job
+*
+* Returns: true if the deque had a job
+* Expects: deque and job cannot be NULL
+*
+* Notes: None
+*/
+static bool pop(Deque *deque, size_t *job)
+{
+        pthread_mutex_lock(&deque->lock);
+        bool found = deque->head < deque->tail;
+        if (found) {
+                *job = deque->head++;
+        }
+        pthread_mutex_unlock(&deque->lock);
+        return found;
+}
+
+/* steal
+*
+* Move the back half of the first non-empty deque of another thread into
+* the empty deque of the thief
+*
+* Parameters:
+*      Pool *pool:		The pool
+*      unsigned thief:		The thread that ran out of jobs
+*      size_t *job:		Receives the first stolen job, to run now
+*
+* Returns: true if a job was stolen, false if every deque is empty
+* Expects: pool and job cannot be NULL
+*
+* Notes: The victims are tried in order starting after the thief, so the
+* threads spread out over them
+*/
+static bool steal(Pool *pool, unsigned thief, size_t *job)
+{
+        for (unsigned k = 1; k < pool->threads; k++) {
+                Deque *victim = &pool->deques[(thief + k) % pool->threads];
+                pthread_mutex_lock(&victim->lock);
+                size_t head = victim->head;
+                size_t tail = victim->tail;
+                size_t middle = head + (tail - head) / 2;
+                if (head < tail) {
+                        victim->tail = middle;
+                }
+                pthread_mutex_unlock(&victim->lock);
+                if (head < tail) {
+                        Deque *own = &pool->deques[thief];
+                        pthread_mutex_lock(&own->lock);
+                        own->head = middle + 1;
+                        own->tail = tail;
+                        pthread_mutex_unlock(&own->lock);
+                        *job = middle;
+                        return true;
+                }
+        }
+        return false;
+}
+
+/* run_job
+*
+* Run one job with its own UM, capturing its output in memory, and record
+* its status and time
+*
+* Parameters:
+*      Job *job:			The job
+*      uint64_t max_instructions:	The budget of the job, or 0 to run
+*                                       it to the end with the fast loop
+*      size_t max_memory:		The memory limit of the job in bytes,
+*                                       or 0 for none
+*      bool checked:			Whether to run a job without a 
+*                                       budget with the checked loop
+*
+* Returns: None
+* Expects: job cannot be NULL
+*
+* Notes: Error messages of the UM (such as a truncated image) go to stderr.
+* Input comes from files, so a UM waiting for input is simply run again.
+*/
+static void run_job(Job *job, uint64_t max_instructions, size_t max_memory,
+                    bool checked)
+{
+        double start = now();
+        char *output = NULL;
+        size_t size = 0;
+        FILE *image = fopen(job->image, "rb");
+        FILE *input = fopen(job->input != NULL ? job->input : "/dev/null",
+                            "rb");
+        FILE *out = open_memstream(&output, &size);
+        UM_T um = NULL;
+        Um_status status = UM_HALTED;
+
+        if (image != NULL && input != NULL && out != NULL) {
+                um = new_um(image, input, out);
+        }
+        if (um != NULL) {
+                seg_set_limit(um_seg_mem(um), max_memory);
+        }
+        if (um != NULL && max_instructions == 0 && checked) {
+                fetch_decode_execute_checked(um);
+        } else if (um != NULL && max_instructions == 0) {
+                fetch_decode_execute(um);
+        } else if (um != NULL) {
+                do {
+                        uint64_t used = um_instructions(um);
+                        status = used < max_instructions 
+                                 ? um_run(um, max_instructions - used) 
+                                 : UM_BUDGET;
+                } while (status == UM_WAITING);
+        }
+        if (um != NULL) {
+                const char *fault = um_fault(um);
+                if (fault != NULL) {
+                        /* the report lives in the UM */
+                        job->fault = strdup(fault);
+                        assert(job->fault != NULL);
+                        status = UM_FAULT;
+                }
+                um_free(um);
+        }
+        if (out != NULL) {
+                fclose(out);
+        }
+
+        if (um == NULL) {
+                job->status = JOB_ERROR;
+        } else if (status == UM_BUDGET) {
+                job->status = JOB_LIMIT;
+        } else if (status == UM_FAULT) {
+                job->status = JOB_FAULT;
+        } else if (job->expected == NULL) {
+                job->status = JOB_DONE;
+        } else {
+                size_t expected_size;
+                char *expected = read_file(job->expected, &expected_size);
+                if (expected == NULL) {
+                        job->status = JOB_ERROR;
+                } else {
+                        job->status = expected_size == size &&
+                                      memcmp(expected, output, size) == 0
+                                      ? JOB_PASS : JOB_FAIL;
+                        free(expected);
+                }
+        }
+        job->output_bytes = size;
+
+        free(output);
+        if (image != NULL) {
+                fclose(image);
+        }
+        if (input != NULL) {
+                fclose(input);
+        }
+        job->seconds = now() - start;
+}
+
+/* read_file
+*
+* Read a whole file into memory
+*
+* Parameters:
+*      const char *path:	The file
+*      size_t *size:		Receives the number of bytes
+*
+* Returns: a malloc'd buffer with the bytes, or NULL if the file cannot be
+*          read
+* Expects: path and size cannot be NULL
+*
+* Notes: None
+*/
+static char *read_file(const char *path, size_t *size)
+{
+        FILE *file = fopen(path, "rb");
+        if (file == NULL) {
+                return NULL;
+        }
+        size_t capacity = 4096;
+        size_t used = 0;
+        char *bytes = malloc(capacity);
+        assert(bytes != NULL);
+        for (;;) {
+                used += fread(bytes + used, 1, capacity - used, file);
+                if (used < capacity) {
+                        break;
+                }
+                capacity *= 2;
+                bytes = realloc(bytes, capacity);
+                assert(bytes != NULL);
+        }
+        bool ok = !ferror(file);
+        fclose(file);
+        if (!ok) {
+                free(bytes);
+                return NULL;
+        }
+        *size = used;
+        return bytes;
+}
+
+/* now
+*
+* Return the time of a monotonic clock in seconds
+*/
+static double now(void)
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+}
@@ -0,0 +1,462 @@
+/*
+ *     umbench.c
+ *     by Elisa and Cynthia, 04/10/2025
+ *     Project 6 - um
+ *
+ *     This file includes a main function that benchmarks the um on the
+ *     images in umbin/ (make bench). Every scenario is run once with
+ *     --profile to count its instructions and allocations, then timed
+ *     several times. The harness reports the median wall time, instructions
+ *     per second and peak RSS, writes the results as JSON and fails when an
+ *     output is wrong or a median is slower than the stored baseline by more
+ *     than the threshold.
+ */
+
+/* fork, exec, mkstemp and clock_gettime are POSIX; wait4 is BSD */
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+/* the most runs of one scenario */
+#define MAX_RUNS 101
+
+/* slowdowns smaller than this many seconds are timer and scheduler noise */
+#define NOISE_FLOOR 0.05
+
+/* a benchmark: one image with its input and expected output */
+typedef struct Scenario {
+        const char *name;
+        const char *image;
+        const char *input; /* NULL means no input */
+        const char *expected; /* NULL means the output is not checked */
+} Scenario;
+
+static const Scenario scenarios[] = {
+        { "midmark",       "umbin/midmark.um",   NULL, NULL },
+        { "sandmark",      "umbin/sandmark.umz", NULL, "umbin/sandmark.out" },
+        { "one-million",   "one-million.um",     NULL, NULL },
+        { "seg-churn",     "seg-churn.um",       NULL, NULL },
+        { "codex-startup", "umbin/codex.umz",    NULL, NULL }
+};
+
+#define NSCENARIOS (sizeof(scenarios) / sizeof(scenarios[0]))
+
+/* what was measured for one scenario */
+typedef struct Result {
+        bool ok; /* every run exited cleanly with the expected output */
+        double median; /* median wall time in seconds */
+        double min, max; /* fastest and slowest run */
+        uint64_t instructions; /* instructions per run */
+        uint64_t allocations; /* heap allocations per run */
+        long peak_rss; /* largest resident set of a run, in KB */
+        double baseline; /* median of the baseline, 0 if there is none */
+        bool regressed; /* median is past the baseline and threshold */
+} Result;
+
+static bool run_um(const char *um, const char *option, const char *image,
+                   const char *input, const char *output, double *seconds,
+                   long *rss);
+static bool same_file(const char *path1, const char *path2);
+static bool read_profile(const char *path, uint64_t *instructions,
+                         uint64_t *allocations);
+static double read_baseline(const char *path, const char *name);
+static void write_baseline(const char *path, const Result *results);
+static void write_results(const char *path, const Result *results, int runs,
+                          double threshold);
+static int compare_doubles(const void *x, const void *y);
+
+static void usage(const char *program)
+{
+        fprintf(stderr, "Usage: %s [--runs=N] [--threshold=PERCENT] "
+                "[--um=PATH] [--baseline=FILE] [--results=FILE] "
+                "[--save-baseline]\n", program);
+}
+
+int main(int argc, char *argv[])
+{
+        int runs = 5;
+        double threshold = 10.0;
+        const char *um = "./um";
+        const char *baseline = "bench.baseline";
+        const char *results_path = "bench-results.json";
+        bool save = false;
+
+        for (int i = 1; i < argc; i++) {
+                if (strncmp(argv[i], "--runs=", 7) == 0) {
+                        runs = atoi(argv[i] + 7);
+                } else if (strncmp(argv[i], "--threshold=", 12) == 0) {
+                        threshold = atof(argv[i] + 12);
+                } else if (strncmp(argv[i], "--um=", 5) == 0) {
+                        um = argv[i] + 5;
+                } else if (strncmp(argv[i], "--baseline=", 11) == 0) {
+                        baseline = argv[i] + 11;
+                } else if (strncmp(argv[i], "--results=", 10) == 0) {
+                        results_path = argv[i] + 10;
+                } else if (strcmp(argv[i], "--save-baseline") == 0) {
+                        save = true;
+                } else {
+                        usage(argv[0]);
+                        return EXIT_FAILURE;
+                }
+        }
+        if (runs < 1 || runs > MAX_RUNS || threshold < 0) {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+
+        /* scratch files for the output and the profile of each run */
+        char output[] = "/tmp/umbench-out.XXXXXX";
+        char profile[] = "/tmp/umbench-prof.XXXXXX";
+        int fd1 = mkstemp(output);
+        int fd2 = mkstemp(profile);
+        if (fd1 < 0 || fd2 < 0) {
+                fprintf(stderr, "Error creating scratch files\n");
+                return EXIT_FAILURE;
+        }
+        close(fd1);
+        close(fd2);
+        char profile_option[sizeof(profile) + 16];
+        sprintf(profile_option, "--profile=%s", profile);
+
+        Result results[NSCENARIOS];
+        bool failed = false;
+
+        printf("%-14s %9s %9s %9s %14s %10s %12s %9s\n", "scenario",
+               "median s", "min s", "max s", "instructions/s", "peak KB",
+               "allocations", "baseline");
+        for (unsigned k = 0; k < NSCENARIOS; k++) {
+                const Scenario *sc = &scenarios[k];
+                Result *res = &results[k];
+                double times[MAX_RUNS];
+                double seconds;
+                long rss;
+
+                memset(res, 0, sizeof(*res));
+                res->ok = run_um(um, profile_option, sc->image, sc->input,
+                                 output, &seconds, &rss) &&
+                          read_profile(profile, &res->instructions,
+                                       &res->allocations);
+                for (int i = 0; i < runs && res->ok; i++) {
+                        res->ok = run_um(um, NULL, sc->image, sc->input,
+                                         output, &times[i], &rss) &&
+                                  (sc->expected == NULL ||
+                                   same_file(output, sc->expected));
+                        if (rss > res->peak_rss) {
+                                res->peak_rss = rss;
+                        }
+                }
+                if (!res->ok) {
+                        printf("%-14s FAILED\n", sc->name);
+                        failed = true;
+                        continue;
+                }
+
+                qsort(times, runs, sizeof(double), compare_doubles);
+                res->min = times[0];
+                res->max = times[runs - 1];
+                res->median = runs % 2 == 1 ? times[runs / 2]
+                            : (times[runs / 2 - 1] + times[runs / 2]) / 2;
+                res->baseline = save ? 0 : read_baseline(baseline, sc->name);
+                res->regressed = res->baseline > 0 &&
+                        res->median > res->baseline * (1 + threshold / 100) &&
+                        res->median > res->baseline + NOISE_FLOOR;
+                failed = failed || res->regressed;
+
+                printf("%-14s %9.3f %9.3f %9.3f %14.0f %10ld %12" PRIu64,
+                       sc->name, res->median, res->min, res->max,
+                       res->median > 0 ? res->instructions / res->median : 0,
+                       res->peak_rss, res->allocations);
+                if (res->baseline > 0) {
+                        printf(" %9.3f%s", res->baseline,
+                               res->regressed ? "  REGRESSED" : "");
+                }
+                printf("\n");
+        }
+        remove(output);
+        remove(profile);
+
+        write_results(results_path, results, runs, threshold);
+        if (save && !failed) {
+                write_baseline(baseline, results);
+                printf("baseline written to %s\n", baseline);
+        }
+        return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* run_um
+*
+* Run the um on an image once and measure it
+*
+* Parameters:
+*      const char *um:		The path of the um executable
+*      const char *option:	An option for the um, or NULL
+*      const char *image:	The path of the image
+*      const char *input:	The file to read input from, or NULL
+*      const char *output:	The file that receives the output
+*      double *seconds:		Receives the wall time of the run
+*      long *rss:		Receives the peak resident set in KB
+*
+* Returns: true if the um exited with status 0
+* Expects: um, image, output, seconds and rss cannot be NULL
+*
+* Notes: The standard error of the um is discarded
+*/
+static bool run_um(const char *um, const char *option, const char *image,
+                   const char *input, const char *output, double *seconds,
+                   long *rss)
+{
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        pid_t pid = fork();
+        if (pid < 0) {
+                return false;
+        }
+        if (pid == 0) {
+                int in = open(input != NULL ? input : "/dev/null", O_RDONLY);
+                int out = open(output, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+                int err = open("/dev/null", O_WRONLY);
+                if (in < 0 || out < 0 || err < 0) {
+                        _exit(127);
+                }
+                dup2(in, STDIN_FILENO);
+                dup2(out, STDOUT_FILENO);
+                dup2(err, STDERR_FILENO);
+                if (option != NULL) {
+                        execl(um, um, option, image, (char *)NULL);
+                } else {
+                        execl(um, um, image, (char *)NULL);
+                }
+                _exit(127);
+        }
+
+        int status;
+        struct rusage usage;
+        if (wait4(pid, &status, 0, &usage) != pid) {
+                return false;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        *seconds = (end.tv_sec - start.tv_sec) +
+                   (end.tv_nsec - start.tv_nsec) / 1e9;
+        *rss = usage.ru_maxrss;
+        return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+/* same_file
+*
+* Compare two files byte by byte
+*
+* Parameters:
+*      const char *path1:	The first file
+*      const char *path2:	The second file
+*
+* Returns: true if both can be read and are equal
+* Expects: path1 and path2 cannot be NULL
+*
+* Notes: None
+*/
+static bool same_file(const char *path1, const char *path2)
+{
+        FILE *f1 = fopen(path1, "rb");
+        FILE *f2 = fopen(path2, "rb");
+        bool same = f1 != NULL && f2 != NULL;
+        while (same) {
+                int c1 = getc(f1);
+                int c2 = getc(f2);
+                same = c1 == c2;
+                if (c1 == EOF) {
+                        break;
+                }
+        }
+        if (f1 != NULL) {
+                fclose(f1);
+        }
+        if (f2 != NULL) {
+                fclose(f2);
+        }
+        return same;
+}
+
+/* read_profile
+*
+* Read the instruction and allocation counts from the JSON report of
+* um --profile
+*
+* Parameters:
+*      const char *path:	The JSON report
+*      uint64_t *instructions:	Receives the number of instructions
+*      uint64_t *allocations:	Receives the number of allocations
+*
+* Returns: true if both counts were found
+* Expects: None
+*
+* Notes: Only the top level keys the report starts with are looked for
+*/
+static bool read_profile(const char *path, uint64_t *instructions,
+                         uint64_t *allocations)
+{
+        FILE *json = fopen(path, "r");
+        if (json == NULL) {
+                return false;
+        }
+        char line[256];
+        int found = 0;
+        while (fgets(line, sizeof(line), json) != NULL) {
+                char *value = strchr(line, ':');
+                if (value == NULL) {
+                        continue;
+                }
+                if (strstr(line, "\"instructions\"") != NULL) {
+                        *instructions = strtoull(value + 1, NULL, 10);
+                        found++;
+                } else if (strstr(line, "\"allocations\"") != NULL) {
+                        *allocations = strtoull(value + 1, NULL, 10);
+                        found++;
+                }
+        }
+        fclose(json);
+        return found == 2;
+}
+
+/* read_baseline
+*
+* Look up the median of a scenario in the baseline file
+*
+* Parameters:
+*      const char *path:	The baseline file, one "name seconds" per line
+*      const char *name:	The scenario
+*
+* Returns: the median in seconds, or 0 if there is none
+* Expects: None
+*
+* Notes: A missing baseline file means there is nothing to compare to
+*/
+static double read_baseline(const char *path, const char *name)
+{
+        FILE *file = fopen(path, "r");
+        if (file == NULL) {
+                return 0;
+        }
+        char key[64];
+        double seconds, found = 0;
+        while (fscanf(file, "%63s %lf", key, &seconds) == 2) {
+                if (strcmp(key, name) == 0) {
+                        found = seconds;
+                }
+        }
+        fclose(file);
+        return found;
+}
+
+/* write_baseline
+*
+* Store the medians of this run as the new baseline
+*
+* Parameters:
+*      const char *path:	The baseline file
+*      const Result *results:	The results of every scenario
+*
+* Returns: None
+* Expects: results has NSCENARIOS entries
+*
+* Notes: None
+*/
+static void write_baseline(const char *path, const Result *results)
+{
+        FILE *file = fopen(path, "w");
+        if (file == NULL) {
+                fprintf(stderr, "Error writing baseline %s\n", path);
+                return;
+        }
+        for (unsigned k = 0; k < NSCENARIOS; k++) {
+                fprintf(file, "%s %.6f\n", scenarios[k].name,
+                        results[k].median);
+        }
+        fclose(file);
+}
+
+/* write_results
+*
+* Write the results of every scenario as JSON
+*
+* Parameters:
+*      const char *path:	The results file
+*      const Result *results:	The results of every scenario
+*      int runs:		The number of timed runs per scenario
+*      double threshold:	The allowed slowdown in percent
+*
+* Returns: None
+* Expects: results has NSCENARIOS entries
+*
+* Notes: None
+*/
+static void write_results(const char *path, const Result *results, int runs,
+                          double threshold)
+{
+        FILE *json = fopen(path, "w");
+        if (json == NULL) {
+                fprintf(stderr, "Error writing results %s\n", path);
+                return;
+        }
+        fprintf(json, "{\n  \"runs\": %d,\n  \"threshold_percent\": %g,\n"
+                      "  \"scenarios\": [", runs, threshold);
+        for (unsigned k = 0; k < NSCENARIOS; k++) {
+                const Result *res = &results[k];
+                fprintf(json, "%s\n    {\n"
+                              "      \"name\": \"%s\",\n"
+                              "      \"image\": \"%s\",\n"
+                              "      \"ok\": %s,\n"
+                              "      \"median_seconds\": %.6f,\n"
+                              "      \"min_seconds\": %.6f,\n"
+                              "      \"max_seconds\": %.6f,\n"
+                              "      \"instructions\": %" PRIu64 ",\n"
+                              "      \"instructions_per_second\": %.0f,\n"
+                              "      \"peak_rss_kb\": %ld,\n"
+                              "      \"allocations\": %" PRIu64 ",\n"
+                              "      \"baseline_seconds\": %.6f,\n"
+                              "      \"regressed\": %s\n"
+                              "    }",
+                        k == 0 ? "" : ",", scenarios[k].name,
+                        scenarios[k].image, res->ok ? "true" : "false",
+                        res->median, res->min, res->max, res->instructions,
+                        res->median > 0 ? res->instructions / res->median
+                                        : 0,
+                        res->peak_rss, res->allocations, res->baseline,
+                        res->regressed ? "true" : "false");
+        }
+        fprintf(json, "\n  ]\n}\n");
+        fclose(json);
+}
+
+/* compare_doubles
+*
+* qsort comparison of two doubles, ascending
+*
+* Parameters:
+*      const void *x:		The first double
+*      const void *y:		The second double
+*
+* Returns: negative, zero or positive as x is less, equal or greater than y
+* Expects: None
+*
+* Notes: None
+*/
+static int compare_doubles(const void *x, const void *y)
+{
+        double a = *(const double *)x;
+        double b = *(const double *)y;
+        return (a > b) - (a < b);
+}
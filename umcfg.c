@@ -0,0 +1,1041 @@
+/*
+ *     umcfg.c
+ *     by Elisa and Cynthia, 04/10/2025
+ *     Project 6 - um
+ *
+ *     This file includes a main function that disassembles a UM program and
+ *     recovers the control flow graph of segment 0 (umcfg). The program is
+ *     cut into basic blocks: a block ends at LOADP, HALT or an illegal
+ *     instruction, and a new one starts at every address a LOADP is known to
+ *     jump to.
+ *
+ *     Jump targets are found by propagating the values of the registers
+ *     through the graph: each register holds a small set of possible
+ *     constants or is unknown, so LV/ADD chains and the usual LV, LV, CMOV,
+ *     LOADP conditional jump resolve to their targets. All registers are 0
+ *     when the program starts. A LOADP whose target stays unknown is an
+ *     indirect jump, usually a return through an address kept in memory or
+ *     a jump through a table. It is taken to go to the blocks whose address
+ *     is loaded by an LV somewhere, as a return address is, and to the 
+ *     entries of the jump tables, so its register values flow into them. A
+ *     jump table is found where a segmented load reads $m[0] at an LV 
+ *     constant plus an unknown index; its entries are the words from there
+ *     on that are addresses in the program. Blocks are split at the new 
+ *     targets and the analysis runs again until no block changes. Stores 
+ *     into $m[0] are not followed: the graph is that of the program as 
+ *     loaded.
+ *
+ *     The graph is written as a disassembly listing, as DOT or as JSON,
+ *     with the instruction count of every block.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <assert.h>
+#include "SegMem.h"
+#include "decode.h"
+
+/* most constants a register may hold before it counts as unknown */
+#define MAX_VALUES 4
+
+/* the possible values of a register */
+typedef struct Value {
+        unsigned count; /* number of values, 0 if unknown */
+        uint32_t values[MAX_VALUES];
+        bool based; /* unknown, but a known base plus an index */
+        uint32_t base;
+} Value;
+
+/* the registers on entry to a block, or after one of its instructions */
+typedef struct State {
+        bool defined; /* the block can be entered, see analyze */
+        Value r[8];
+} State;
+
+/* a basic block of $m[0] and where it goes */
+typedef struct Block {
+        uint32_t start, end; /* the addresses start..end-1 */
+        State entry; /* the join of the states flowing in */
+        uint32_t *targets; /* addresses the block jumps or falls to */
+        unsigned target_count, target_capacity;
+        bool halts; /* ends in HALT */
+        bool loads_program; /* ends in a LOADP that may replace $m[0] */
+        bool indirect; /* ends in a LOADP with an unknown target */
+        bool faults; /* ends in an illegal instruction or a bad jump */
+        bool taken; /* its address is loaded by an LV of an entered block */
+        bool reachable; /* reached from address 0 */
+} Block;
+
+/* the program and its blocks */
+typedef struct Cfg {
+        const uint32_t *words;
+        uint32_t length;
+        bool *leader; /* leader[pc]: a block starts at pc */
+        bool *table; /* table[pc]: pc holds a jump table entry */
+        bool *entry; /* entry[pc]: a jump table entry holds pc */
+        unsigned tables; /* number of jump table entries */
+        uint32_t *block_of; /* block_of[pc]: the block holding pc */
+        Block *blocks;
+        unsigned count;
+        State indirect; /* join of the states at indirect jumps */
+        unsigned *work; /* blocks to analyze, see analyze */
+        bool *queued; /* queued[b]: block b is in work */
+        unsigned pending; /* size of work */
+        bool flow_indirect; /* the indirect jumps enter the taken blocks */
+} Cfg;
+
+static void build_blocks(Cfg *cfg);
+static void analyze(Cfg *cfg);
+static void enter(Cfg *cfg, unsigned b, const State *s);
+static void take_address(Cfg *cfg, uint32_t address);
+static void jump_table(Cfg *cfg, uint32_t base);
+static void run_block(Cfg *cfg, Block *block, State *s);
+static void jump(Cfg *cfg, Block *block, const State *s, Um_decoded ins);
+static void add_target(Block *block, uint32_t target);
+static bool join_state(State *into, const State *from);
+static bool join_value(Value *into, const Value *from);
+static void set_value(Value *v, uint32_t value);
+static void set_unknown(Value *v);
+static void binop(Value *a, const Value *b, const Value *c, uint8_t op);
+static void mark_reachable(Cfg *cfg);
+static void disassemble(uint32_t word, char *text, size_t size);
+static void write_listing(FILE *out, const Cfg *cfg);
+static void write_dot(FILE *out, const Cfg *cfg, const char *name);
+static void write_json(FILE *out, const Cfg *cfg, const char *name);
+
+static void usage(const char *program)
+{
+        fprintf(stderr, "Usage: %s [--dis | --dot | --json] "
+                "<instructions_file> [output_file]\n", program);
+}
+
+int main(int argc, char *argv[])
+{
+        const char *format = "--dis";
+        int i = 1;
+        if (i < argc && (strcmp(argv[i], "--dis") == 0 ||
+                         strcmp(argv[i], "--dot") == 0 ||
+                         strcmp(argv[i], "--json") == 0)) {
+                format = argv[i++];
+        }
+        if (argc - i != 1 && argc - i != 2) {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+
+        /* Load the program the same way the um does */
+        FILE *instructions = fopen(argv[i], "rb");
+        if (instructions == NULL) {
+                fprintf(stderr, "Error opening instruction file\n");
+                return EXIT_FAILURE;
+        }
+        SegMem_T seg_mem = initialize_segmem();
+        if (!populate_seg(seg_mem, instructions)) {
+                seg_free(seg_mem);
+                fclose(instructions);
+                return EXIT_FAILURE;
+        }
+        fclose(instructions);
+
+        Cfg cfg;
+        memset(&cfg, 0, sizeof(cfg));
+        cfg.length = seg_length(seg_mem, 0);
+        cfg.words = seg_words(seg_mem, 0);
+        cfg.leader = calloc((size_t)cfg.length + 1, sizeof(bool));
+        cfg.table = calloc((size_t)cfg.length + 1, sizeof(bool));
+        cfg.entry = calloc((size_t)cfg.length + 1, sizeof(bool));
+        cfg.block_of = malloc(((size_t)cfg.length + 1) * sizeof(uint32_t));
+        assert(cfg.leader != NULL && cfg.table != NULL &&
+               cfg.entry != NULL && cfg.block_of != NULL);
+
+        /* blocks end after every LOADP, HALT and illegal instruction */
+        cfg.leader[0] = true;
+        for (uint32_t pc = 0; pc < cfg.length; pc++) {
+                uint8_t op = cfg.words[pc] >> 28;
+                if (op == LOADP || op == HALT || op > LV) {
+                        cfg.leader[pc + 1] = true;
+                }
+        }
+
+        /* 
+         * split the blocks at the targets found until none is new; a new 
+         * jump table also starts over, its words are no code
+         */
+        unsigned passes = 0;
+        bool split = true;
+        while (split) {
+                unsigned tables = cfg.tables;
+                build_blocks(&cfg);
+                analyze(&cfg);
+                passes++;
+                split = cfg.tables != tables;
+                for (uint32_t pc = 0; pc < cfg.length; pc++) {
+                        if (cfg.entry[pc] && !cfg.leader[pc]) {
+                                cfg.leader[pc] = true;
+                                split = true;
+                        }
+                }
+                for (unsigned b = 0; b < cfg.count; b++) {
+                        Block *block = &cfg.blocks[b];
+                        for (unsigned t = 0; t < block->target_count; t++) {
+                                uint32_t target = block->targets[t];
+                                if (!cfg.leader[target]) {
+                                        cfg.leader[target] = true;
+                                        split = true;
+                                }
+                        }
+                }
+        }
+        mark_reachable(&cfg);
+
+        FILE *out = stdout;
+        if (argc - i == 2) {
+                out = fopen(argv[i + 1], "w");
+                if (out == NULL) {
+                        fprintf(stderr, "Error opening output file\n");
+                        return EXIT_FAILURE;
+                }
+        }
+        if (strcmp(format, "--dot") == 0) {
+                write_dot(out, &cfg, argv[i]);
+        } else if (strcmp(format, "--json") == 0) {
+                write_json(out, &cfg, argv[i]);
+        } else {
+                write_listing(out, &cfg);
+        }
+        if (out != stdout) {
+                fclose(out);
+        }
+
+        unsigned reachable = 0, indirect = 0;
+        for (unsigned b = 0; b < cfg.count; b++) {
+                reachable += cfg.blocks[b].reachable;
+                indirect += cfg.blocks[b].reachable &&
+                            cfg.blocks[b].indirect;
+        }
+        fprintf(stderr, "%u instruction%s, %u block%s (%u reachable, %u "
+                "with an indirect jump) after %u pass%s\n", cfg.length,
+                cfg.length == 1 ? "" : "s", cfg.count,
+                cfg.count == 1 ? "" : "s", reachable, indirect, passes,
+                passes == 1 ? "" : "es");
+
+        for (unsigned b = 0; b < cfg.count; b++) {
+                free(cfg.blocks[b].targets);
+        }
+        free(cfg.blocks);
+        free(cfg.leader);
+        free(cfg.table);
+        free(cfg.entry);
+        free(cfg.block_of);
+        seg_free(seg_mem);
+        return EXIT_SUCCESS;
+}
+
+/* build_blocks
+*
+* Cut the program into blocks at the leaders
+*
+* Parameters:
+*      Cfg *cfg:		The program, with its leaders marked
+*
+* Returns: None
+* Expects: cfg cannot be NULL
+*
+* Notes: Replaces the blocks of an earlier pass
+*/
+static void build_blocks(Cfg *cfg)
+{
+        for (unsigned b = 0; b < cfg->count; b++) {
+                free(cfg->blocks[b].targets);
+        }
+        free(cfg->blocks);
+
+        cfg->count = 0;
+        for (uint32_t pc = 0; pc < cfg->length; pc++) {
+                cfg->count += cfg->leader[pc];
+        }
+        cfg->blocks = calloc(cfg->count, sizeof(Block));
+        assert(cfg->count == 0 || cfg->blocks != NULL);
+
+        unsigned b = 0;
+        for (uint32_t pc = 0; pc < cfg->length; pc++) {
+                if (cfg->leader[pc]) {
+                        cfg->blocks[b].taken = cfg->entry[pc];
+                        cfg->blocks[b++].start = pc;
+                }
+                cfg->block_of[pc] = b - 1;
+        }
+        for (b = 0; b < cfg->count; b++) {
+                cfg->blocks[b].end = b + 1 < cfg->count
+                                     ? cfg->blocks[b + 1].start
+                                     : cfg->length;
+        }
+}
+
+/* analyze
+*
+* Propagate the register values through the blocks until they settle,
+* recording the targets of every block
+*
+* Parameters:
+*      Cfg *cfg:		The program and its blocks
+*
+* Returns: None
+* Expects: cfg cannot be NULL
+*
+* Notes:
+* A worklist algorithm. A block whose entry state is not defined is never
+* entered and is not analyzed, so data after the code does not make up
+* jumps. A block is analyzed again when its entry state grows; the value
+* sets only grow and are bounded, so this ends. The states at the indirect
+* jumps only flow once the known edges have settled: they are vague, and 
+* the jump tables are easier to see before they blur the registers.
+*/
+static void analyze(Cfg *cfg)
+{
+        if (cfg->count == 0) {
+                return;
+        }
+        memset(&cfg->indirect, 0, sizeof(cfg->indirect));
+        cfg->work = malloc(cfg->count * sizeof(unsigned));
+        cfg->queued = calloc(cfg->count, sizeof(bool));
+        assert(cfg->work != NULL && cfg->queued != NULL);
+        cfg->pending = 0;
+
+        /* the program starts at 0 with every register 0 */
+        State start;
+        memset(&start, 0, sizeof(start));
+        start.defined = true;
+        for (int r = 0; r < 8; r++) {
+                set_value(&start.r[r], 0);
+        }
+        enter(cfg, 0, &start);
+
+        /* first along the known edges only, then the indirect jumps too */
+        cfg->flow_indirect = false;
+        for (;;) {
+                if (cfg->pending == 0 && cfg->flow_indirect) {
+                        break;
+                }
+                if (cfg->pending == 0) {
+                        cfg->flow_indirect = true;
+                        for (unsigned b = 0; b < cfg->count; b++) {
+                                if (cfg->blocks[b].taken) {
+                                        enter(cfg, b, &cfg->indirect);
+                                }
+                        }
+                        continue;
+                }
+                unsigned b = cfg->work[--cfg->pending];
+                Block *block = &cfg->blocks[b];
+                cfg->queued[b] = false;
+                State s = block->entry;
+                run_block(cfg, block, &s);
+
+                /* flow into the blocks it goes to */
+                for (unsigned t = 0; t < block->target_count; t++) {
+                        uint32_t target = block->targets[t];
+                        unsigned next = cfg->block_of[target];
+                        if (cfg->blocks[next].start == target) {
+                                enter(cfg, next, &s);
+                        }
+                }
+                if (!block->indirect || !join_state(&cfg->indirect, &s) ||
+                    !cfg->flow_indirect) {
+                        continue;
+                }
+                for (unsigned next = 0; next < cfg->count; next++) {
+                        if (cfg->blocks[next].taken) {
+                                enter(cfg, next, &cfg->indirect);
+                        }
+                }
+        }
+        free(cfg->work);
+        free(cfg->queued);
+}
+
+/* enter
+*
+* Let a state flow into a block, queueing the block if its entry state grew
+*
+* Parameters:
+*      Cfg *cfg:		The program and its blocks
+*      unsigned b:		The index of the block
+*      const State *s:		The state
+*
+* Returns: None
+* Expects: cfg and s cannot be NULL, b is below cfg->count
+*
+* Notes: None
+*/
+static void enter(Cfg *cfg, unsigned b, const State *s)
+{
+        if (join_state(&cfg->blocks[b].entry, s) && !cfg->queued[b]) {
+                cfg->work[cfg->pending++] = b;
+                cfg->queued[b] = true;
+        }
+}
+
+/* take_address
+*
+* Note that an address is loaded by an LV or held in a jump table, so the
+* indirect jumps may go to it
+*
+* Parameters:
+*      Cfg *cfg:		The program and its blocks
+*      uint32_t address:	The address
+*
+* Returns: None
+* Expects: cfg cannot be NULL
+*
+* Notes: 
+* Only the start of a block counts, so that small constants do not cut the
+* program into pieces: a return address follows a LOADP and is always one.
+* Nor do jump tables, which an LV loads the address of. The indirect jumps 
+* seen so far flow into a block when it becomes taken, see analyze.
+*/
+static void take_address(Cfg *cfg, uint32_t address)
+{
+        if (address >= cfg->length || !cfg->leader[address] ||
+            cfg->table[address]) {
+                return;
+        }
+        unsigned b = cfg->block_of[address];
+        if (!cfg->blocks[b].taken) {
+                cfg->blocks[b].taken = true;
+                if (cfg->flow_indirect) {
+                        enter(cfg, b, &cfg->indirect);
+                }
+        }
+}
+
+/* jump_table
+*
+* Record the jump table a segmented load from $m[0] reads
+*
+* Parameters:
+*      Cfg *cfg:		The program and its blocks
+*      uint32_t base:		The address of the table
+*
+* Returns: None
+* Expects: cfg cannot be NULL
+*
+* Notes: The table ends at the first word that is not an address in the 
+* program. Its entries become block starts on the next pass.
+*/
+static void jump_table(Cfg *cfg, uint32_t base)
+{
+        for (uint32_t pc = base; pc < cfg->length; pc++) {
+                uint32_t target = cfg->words[pc];
+                if (target == 0 || target >= cfg->length) {
+                        return;
+                }
+                if (!cfg->table[pc]) {
+                        cfg->table[pc] = true;
+                        cfg->tables++;
+                }
+                cfg->entry[target] = true;
+                take_address(cfg, target);
+        }
+}
+
+/* run_block
+*
+* Run a block over the register values and record where it ends up
+*
+* Parameters:
+*      Cfg *cfg:		The program
+*      Block *block:		The block, its targets and exits are reset
+*      State *s:		The entry state, updated to the state before
+*                               the last instruction's jump
+*
+* Returns: None
+* Expects: cfg, block and s cannot be NULL
+*
+* Notes: None
+*/
+static void run_block(Cfg *cfg, Block *block, State *s)
+{
+        block->target_count = 0;
+        block->halts = block->loads_program = false;
+        block->indirect = block->faults = false;
+
+        for (uint32_t pc = block->start; pc < block->end; pc++) {
+                Um_decoded ins = decode_word(cfg->words[pc]);
+                Value *ra = &s->r[ins.a];
+                switch (ins.opcode) {
+                case CMOV:
+                        if (s->r[ins.c].count == 0) {
+                                join_value(ra, &s->r[ins.b]);
+                        } else {
+                                bool zero = false, nonzero = false;
+                                for (unsigned k = 0; k < s->r[ins.c].count;
+                                     k++) {
+                                        zero |= s->r[ins.c].values[k] == 0;
+                                        nonzero |= s->r[ins.c].values[k]
+                                                   != 0;
+                                }
+                                if (zero && nonzero) {
+                                        join_value(ra, &s->r[ins.b]);
+                                } else if (nonzero) {
+                                        *ra = s->r[ins.b];
+                                }
+                        }
+                        break;
+                case SLOAD:
+                        if (s->r[ins.c].count == 0 && s->r[ins.c].based &&
+                            s->r[ins.b].count == 1 &&
+                            s->r[ins.b].values[0] == 0) {
+                                jump_table(cfg, s->r[ins.c].base);
+                        }
+                        set_unknown(ra);
+                        break;
+                case ADD: case MUL: case DIV: case NAND:
+                        binop(ra, &s->r[ins.b], &s->r[ins.c], ins.opcode);
+                        break;
+                case HALT:
+                        block->halts = true;
+                        return;
+                case ACTIVATE:
+                        set_unknown(&s->r[ins.b]);
+                        break;
+                case IN:
+                        set_unknown(&s->r[ins.c]);
+                        break;
+                case LOADP:
+                        jump(cfg, block, s, ins);
+                        return;
+                case LV:
+                        set_value(ra, ins.value);
+                        if (ins.value != 0) {
+                                /* LV loads 0 as a number far too often */
+                                take_address(cfg, ins.value);
+                        }
+                        break;
+                case SSTORE: case INACTIVATE: case OUT:
+                        break;
+                default:
+                        block->faults = true;
+                        return;
+                }
+        }
+
+        /* split at a leader: fall into the next block, or off the end */
+        if (block->end < cfg->length) {
+                add_target(block, block->end);
+        } else {
+                block->faults = true;
+        }
+}
+
+/* jump
+*
+* Record where the LOADP ending a block goes
+*
+* Parameters:
+*      Cfg *cfg:		The program
+*      Block *block:		The block
+*      const State *s:		The registers at the LOADP
+*      Um_decoded ins:		The LOADP
+*
+* Returns: None
+* Expects: cfg, block and s cannot be NULL
+*
+* Notes: A LOADP from a segment other than 0 replaces the program, so it
+* leaves the graph
+*/
+static void jump(Cfg *cfg, Block *block, const State *s, Um_decoded ins)
+{
+        const Value *segment = &s->r[ins.b];
+        const Value *target = &s->r[ins.c];
+        bool zero = segment->count == 0, nonzero = segment->count == 0;
+        for (unsigned k = 0; k < segment->count; k++) {
+                zero |= segment->values[k] == 0;
+                nonzero |= segment->values[k] != 0;
+        }
+        block->loads_program = nonzero;
+        if (!zero) {
+                return;
+        }
+        if (target->count == 0) {
+                block->indirect = true;
+                return;
+        }
+        for (unsigned k = 0; k < target->count; k++) {
+                if (target->values[k] < cfg->length) {
+                        add_target(block, target->values[k]);
+                } else {
+                        block->faults = true;
+                }
+        }
+}
+
+/* add_target
+*
+* Add an address to the targets of a block
+*
+* Parameters:
+*      Block *block:		The block
+*      uint32_t target:		The address
+*
+* Returns: None
+* Expects: block cannot be NULL
+*
+* Notes: CRE if the list cannot grow
+*/
+static void add_target(Block *block, uint32_t target)
+{
+        for (unsigned t = 0; t < block->target_count; t++) {
+                if (block->targets[t] == target) {
+                        return;
+                }
+        }
+        if (block->target_count == block->target_capacity) {
+                block->target_capacity = block->target_capacity * 2 + 2;
+                block->targets = realloc(block->targets,
+                                         block->target_capacity *
+                                         sizeof(uint32_t));
+                assert(block->targets != NULL);
+        }
+        block->targets[block->target_count++] = target;
+}
+
+/* join_state
+*
+* Widen a state to cover another one
+*
+* Parameters:
+*      State *into:		The state to widen
+*      const State *from:	The state to cover
+*
+* Returns: true if into changed
+* Expects: into and from cannot be NULL
+*
+* Notes: None
+*/
+static bool join_state(State *into, const State *from)
+{
+        if (!from->defined) {
+                return false;
+        }
+        if (!into->defined) {
+                *into = *from;
+                return true;
+        }
+        bool changed = false;
+        for (int r = 0; r < 8; r++) {
+                changed |= join_value(&into->r[r], &from->r[r]);
+        }
+        return changed;
+}
+
+/* join_value
+*
+* Widen the values of a register to cover another set of values
+*
+* Parameters:
+*      Value *into:		The values to widen
+*      const Value *from:	The values to cover
+*
+* Returns: true if into changed
+* Expects: into and from cannot be NULL
+*
+* Notes: More than MAX_VALUES values become unknown. A base plus an index
+* covers any known value, but not another base.
+*/
+static bool join_value(Value *into, const Value *from)
+{
+        if (into->count == 0) {
+                if (!into->based || from->count != 0 ||
+                    (from->based && from->base == into->base)) {
+                        return false;
+                }
+                into->based = false;
+                return true;
+        }
+        if (from->count == 0) {
+                *into = *from;
+                return true;
+        }
+        bool changed = false;
+        for (unsigned k = 0; k < from->count; k++) {
+                bool found = false;
+                for (unsigned j = 0; j < into->count && !found; j++) {
+                        found = into->values[j] == from->values[k];
+                }
+                if (found) {
+                        continue;
+                }
+                changed = true;
+                if (into->count == MAX_VALUES) {
+                        set_unknown(into);
+                        return true;
+                }
+                into->values[into->count++] = from->values[k];
+        }
+        return changed;
+}
+
+/* set_value
+*
+* Make a register hold one known value
+*
+* Parameters:
+*      Value *v:		The register
+*      uint32_t value:		The value
+*
+* Returns: None
+* Expects: v cannot be NULL
+*
+* Notes: None
+*/
+static void set_value(Value *v, uint32_t value)
+{
+        v->count = 1;
+        v->values[0] = value;
+        v->based = false;
+}
+
+/* set_unknown
+*
+* Make a register hold any value
+*
+* Parameters:
+*      Value *v:		The register
+*
+* Returns: None
+* Expects: v cannot be NULL
+*
+* Notes: None
+*/
+static void set_unknown(Value *v)
+{
+        v->count = 0;
+        v->based = false;
+}
+
+/* binop
+*
+* Compute the values of an ADD, MUL, DIV or NAND from those of its operands
+*
+* Parameters:
+*      Value *a:		The destination register
+*      const Value *b, *c:	The operands
+*      uint8_t op:		The opcode
+*
+* Returns: None
+* Expects: a, b and c cannot be NULL; a may be b or c
+*
+* Notes: A division by zero has no value; it would fail at run time. A 
+* known value plus an unknown one is a base plus an index.
+*/
+static void binop(Value *a, const Value *b, const Value *c, uint8_t op)
+{
+        Value result;
+        set_unknown(&result);
+        if (op == ADD && (b->count == 1) != (c->count == 1) &&
+            (b->count == 0 || c->count == 0)) {
+                result.based = true;
+                result.base = b->count == 1 ? b->values[0] : c->values[0];
+                *a = result;
+                return;
+        }
+        bool known = b->count != 0 && c->count != 0;
+        for (unsigned i = 0; known && i < b->count; i++) {
+                for (unsigned j = 0; known && j < c->count; j++) {
+                        uint32_t x = b->values[i], y = c->values[j];
+                        Value one;
+                        if (op == DIV && y == 0) {
+                                continue;
+                        }
+                        set_value(&one, op == ADD ? x + y : op == MUL ? x * y
+                                        : op == DIV ? x / y : ~(x & y));
+                        if (result.count == 0) {
+                                result = one;
+                        } else {
+                                join_value(&result, &one);
+                                known = result.count != 0;
+                        }
+                }
+        }
+        *a = result;
+}
+
+/* mark_reachable
+*
+* Mark the blocks reached from address 0
+*
+* Parameters:
+*      Cfg *cfg:		The program and its blocks
+*
+* Returns: None
+* Expects: cfg cannot be NULL
+*
+* Notes: An indirect jump reaches every taken block
+*/
+static void mark_reachable(Cfg *cfg)
+{
+        if (cfg->count == 0) {
+                return;
+        }
+        unsigned *work = malloc(cfg->count * sizeof(unsigned));
+        assert(work != NULL);
+        unsigned pending = 0;
+        cfg->blocks[0].reachable = true;
+        work[pending++] = 0;
+        bool indirect = false;
+        while (pending > 0) {
+                Block *block = &cfg->blocks[work[--pending]];
+                for (unsigned t = 0; t < block->target_count; t++) {
+                        unsigned b = cfg->block_of[block->targets[t]];
+                        if (!cfg->blocks[b].reachable) {
+                                cfg->blocks[b].reachable = true;
+                                work[pending++] = b;
+                        }
+                }
+                if (!block->indirect || indirect) {
+                        continue;
+                }
+                indirect = true;
+                for (unsigned b = 0; b < cfg->count; b++) {
+                        if (cfg->blocks[b].taken &&
+                            !cfg->blocks[b].reachable) {
+                                cfg->blocks[b].reachable = true;
+                                work[pending++] = b;
+                        }
+                }
+        }
+        free(work);
+}
+
+/* disassemble
+*
+* Write one instruction in assembly syntax
+*
+* Parameters:
+*      uint32_t word:		The instruction
+*      char *text:		Receives the text
+*      size_t size:		The room in text
+*
+* Returns: None
+* Expects: text cannot be NULL
+*
+* Notes: Operands are listed in the order of the instruction fields
+*/
+static void disassemble(uint32_t word, char *text, size_t size)
+{
+        Um_decoded ins = decode_word(word);
+        const char *name = opcode_name(ins.opcode);
+        switch (ins.opcode) {
+        case LV:
+                snprintf(text, size, "%-10s r%u, %u", name, ins.a,
+                         ins.value);
+                break;
+        case HALT:
+                snprintf(text, size, "%s", name);
+                break;
+        case INACTIVATE: case OUT: case IN:
+                snprintf(text, size, "%-10s r%u", name, ins.c);
+                break;
+        case ACTIVATE: case LOADP:
+                snprintf(text, size, "%-10s r%u, r%u", name, ins.b, ins.c);
+                break;
+        default:
+                if (ins.opcode > LV) {
+                        snprintf(text, size, "%-10s 0x%08x", name, word);
+                } else {
+                        snprintf(text, size, "%-10s r%u, r%u, r%u", name,
+                                 ins.a, ins.b, ins.c);
+                }
+                break;
+        }
+}
+
+/* write_exits
+*
+* Write the ways out of a block that are not edges to other blocks
+*
+* Parameters:
+*      FILE *out:		The stream
+*      const Block *block:	The block
+*      const char *separator:	Written in front of every exit
+*
+* Returns: None
+* Expects: out, block and separator cannot be NULL
+*
+* Notes: None
+*/
+static void write_exits(FILE *out, const Block *block, const char *separator)
+{
+        if (block->halts) {
+                fprintf(out, "%shalt", separator);
+        }
+        if (block->loads_program) {
+                fprintf(out, "%sload-program", separator);
+        }
+        if (block->indirect) {
+                fprintf(out, "%sindirect", separator);
+        }
+        if (block->faults) {
+                fprintf(out, "%sfault", separator);
+        }
+}
+
+/* write_listing
+*
+* Write the disassembly of the program, block by block
+*
+* Parameters:
+*      FILE *out:		The stream
+*      const Cfg *cfg:		The program and its blocks
+*
+* Returns: None
+* Expects: out and cfg cannot be NULL
+*
+* Notes: Every block starts with a header giving its addresses, its
+* instruction count and whether an indirect jump may enter it, then its 
+* successors
+*/
+static void write_listing(FILE *out, const Cfg *cfg)
+{
+        char text[64];
+        for (unsigned b = 0; b < cfg->count; b++) {
+                const Block *block = &cfg->blocks[b];
+                unsigned length = block->end - block->start;
+                fprintf(out, "\n; block %u: %u..%u, %u instruction%s%s%s",
+                        b, block->start, block->end - 1, length,
+                        length == 1 ? "" : "s",
+                        block->taken ? ", address taken" : "",
+                        block->reachable ? "" : ", unreachable");
+                fprintf(out, "\n; ->");
+                for (unsigned t = 0; t < block->target_count; t++) {
+                        fprintf(out, " %u", block->targets[t]);
+                }
+                write_exits(out, block, " ");
+                fprintf(out, "\n");
+                for (uint32_t pc = block->start; pc < block->end; pc++) {
+                        disassemble(cfg->words[pc], text, sizeof(text));
+                        fprintf(out, "%8u: %08x  %s\n", pc, cfg->words[pc],
+                                text);
+                }
+        }
+}
+
+/* write_dot
+*
+* Write the control flow graph in the DOT language of Graphviz
+*
+* Parameters:
+*      FILE *out:		The stream
+*      const Cfg *cfg:		The program and its blocks
+*      const char *name:	The name of the graph
+*
+* Returns: None
+* Expects: out, cfg and name cannot be NULL
+*
+* Notes: Only reachable blocks are drawn; exits go to one node each, and 
+* the indirect node has an edge to every taken block
+*/
+static void write_dot(FILE *out, const Cfg *cfg, const char *name)
+{
+        fprintf(out, "digraph \"%s\" {\n", name);
+        fprintf(out, "        node [shape=box, fontname=\"monospace\"];\n");
+        fprintf(out, "        halt [shape=oval];\n");
+        fprintf(out, "        indirect [shape=oval, style=dashed];\n");
+        fprintf(out, "        \"load-program\" [shape=oval];\n");
+        fprintf(out, "        fault [shape=oval];\n");
+        for (unsigned b = 0; b < cfg->count; b++) {
+                const Block *block = &cfg->blocks[b];
+                if (!block->reachable) {
+                        continue;
+                }
+                unsigned length = block->end - block->start;
+                fprintf(out, "        b%u [label=\"%u..%u\\n%u "
+                        "instruction%s\"];\n", block->start, block->start,
+                        block->end - 1, length, length == 1 ? "" : "s");
+                if (block->taken) {
+                        fprintf(out, "        indirect -> b%u "
+                                "[style=dashed];\n", block->start);
+                }
+                for (unsigned t = 0; t < block->target_count; t++) {
+                        fprintf(out, "        b%u -> b%u;\n", block->start,
+                                block->targets[t]);
+                }
+                if (block->halts) {
+                        fprintf(out, "        b%u -> halt;\n", block->start);
+                }
+                if (block->loads_program) {
+                        fprintf(out, "        b%u -> \"load-program\";\n",
+                                block->start);
+                }
+                if (block->indirect) {
+                        fprintf(out, "        b%u -> indirect "
+                                "[style=dashed];\n", block->start);
+                }
+                if (block->faults) {
+                        fprintf(out, "        b%u -> fault;\n", block->start);
+                }
+        }
+        fprintf(out, "}\n");
+}
+
+/* write_json
+*
+* Write the blocks and their edges as JSON
+*
+* Parameters:
+*      FILE *out:		The stream
+*      const Cfg *cfg:		The program and its blocks
+*      const char *name:	The image the program came from
+*
+* Returns: None
+* Expects: out, cfg and name cannot be NULL
+*
+* Notes: Every block is written, with "taken" telling whether an indirect
+* jump may enter it and "reachable" whether it is reached from address 0;
+* "successors" are the start addresses of the blocks it jumps or falls to
+*/
+static void write_json(FILE *out, const Cfg *cfg, const char *name)
+{
+        fprintf(out, "{\n  \"image\": \"");
+        for (const char *c = name; *c != '\0'; c++) {
+                if (*c == '"' || *c == '\\') {
+                        fputc('\\', out);
+                }
+                fputc(*c, out);
+        }
+        fprintf(out, "\",\n  \"instructions\": %u,\n  \"blocks\": [",
+                cfg->length);
+        for (unsigned b = 0; b < cfg->count; b++) {
+                const Block *block = &cfg->blocks[b];
+                fprintf(out, "%s\n    {\"start\": %u, \"end\": %u, "
+                        "\"instructions\": %u, \"taken\": %s, "
+                        "\"reachable\": %s, \"successors\": [",
+                        b == 0 ? "" : ",", block->start, block->end,
+                        block->end - block->start,
+                        block->taken ? "true" : "false",
+                        block->reachable ? "true" : "false");
+                for (unsigned t = 0; t < block->target_count; t++) {
+                        fprintf(out, "%s%u", t == 0 ? "" : ", ",
+                                block->targets[t]);
+                }
+                fprintf(out, "], \"exits\": [");
+                const char *separator = "";
+                const char *exits[4] = { "halt", "load-program",
+                                         "indirect", "fault" };
+                bool flags[4] = { block->halts, block->loads_program,
+                                  block->indirect, block->faults };
+                for (int e = 0; e < 4; e++) {
+                        if (flags[e]) {
+                                fprintf(out, "%s\"%s\"", separator,
+                                        exits[e]);
+                                separator = ", ";
+                        }
+                }
+                fprintf(out, "]}");
+        }
+        fprintf(out, "\n  ]\n}\n");
+}